@@ -0,0 +1,82 @@
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_ROUNDS 100
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Composite translucent full-surface panels and textures, in Mpixel/s
+int main(void)
+{
+	fbgl_t surface;
+	if (fbgl_init_surface(&surface, BENCH_WIDTH, BENCH_HEIGHT,
+			      FBGL_FORMAT_XRGB8888, FBGL_INIT_DEFAULT) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	// Translucent gradient, premultiplied like loaded textures
+	fbgl_tga_texture_t texture = { 0 };
+	texture.width = BENCH_WIDTH;
+	texture.height = BENCH_HEIGHT;
+	texture.data = malloc((size_t)BENCH_WIDTH * BENCH_HEIGHT *
+			      sizeof(uint32_t));
+	if (!texture.data) {
+		fprintf(stderr, "Failed to allocate texture.\n");
+		fbgl_destroy(&surface);
+		return EXIT_FAILURE;
+	}
+	for (int32_t y = 0; y < BENCH_HEIGHT; y++) {
+		for (int32_t x = 0; x < BENCH_WIDTH; x++) {
+			const uint32_t alpha = 1 + (x * 253) / BENCH_WIDTH;
+			const uint32_t color = FBGL_RGB(x & 0xFF, y & 0xFF, 0x80);
+			texture.data[(size_t)y * BENCH_WIDTH + x] =
+				fbgl_premultiply(alpha << 24 | color);
+		}
+	}
+	fbgl_texture_update_runs(&texture);
+
+	const fbgl_point_t top_left = { 0, 0 };
+	const fbgl_point_t bottom_right = { BENCH_WIDTH, BENCH_HEIGHT };
+	const double pixels = (double)BENCH_WIDTH * BENCH_HEIGHT * BENCH_ROUNDS;
+
+	fbgl_set_bg(&surface, 0x00204060);
+	double start = now_seconds();
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		fbgl_fill_rect_blend(top_left, bottom_right, 0x80FFFFFF,
+				     &surface);
+	}
+	const double fill = now_seconds() - start;
+
+	start = now_seconds();
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		fbgl_draw_texture(&surface, &texture, 0, 0);
+	}
+	const double blit = now_seconds() - start;
+
+	start = now_seconds();
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		fbgl_draw_texture_blend(&surface, &texture, 0, 0, 0x60);
+	}
+	const double faded = now_seconds() - start;
+
+	printf("%dx%d XRGB8888, %d rounds, kernels: %s\n", BENCH_WIDTH,
+	       BENCH_HEIGHT, BENCH_ROUNDS, fbgl_simd_info());
+	printf("fill_rect_blend      %8.1f Mpixel/s\n", pixels / fill / 1e6);
+	printf("draw_texture         %8.1f Mpixel/s\n", pixels / blit / 1e6);
+	printf("draw_texture_blend   %8.1f Mpixel/s\n", pixels / faded / 1e6);
+
+	free(texture.row_runs);
+	free(texture.data);
+	fbgl_destroy(&surface);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,74 @@
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_FONT "asset/font/font-16.psf"
+
+// Status console: a header that changes every frame and a log below it
+// that scrolls. Only changed cells are repainted, scrolled rows are moved.
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : DEFAULT_FONT;
+	fbgl_t fb;
+	if (fbgl_init(NULL, &fb) != 0) {
+		fprintf(stderr, "Failed to initialize framebuffer.\n");
+		return EXIT_FAILURE;
+	}
+
+	fbgl_psf1_font_t *font = fbgl_load_psf_font(path);
+	if (!font) {
+		fprintf(stderr, "Usage: %s [font.psf]\n", argv[0]);
+		fbgl_destroy(&fb);
+		return EXIT_FAILURE;
+	}
+
+	const int32_t cols = fb.width / font->char_width;
+	const int32_t rows = fb.height / font->char_height;
+	fbgl_console_t *status = fbgl_console_create(font, 0, 0, cols, 1);
+	fbgl_console_t *log =
+		rows > 1 ? fbgl_console_create(font, 0, font->char_height,
+					       cols, rows - 1) :
+			   NULL;
+	if (!status || !log) {
+		fbgl_console_destroy(status);
+		fbgl_destroy_psf1_font(font);
+		fbgl_destroy(&fb);
+		return EXIT_FAILURE;
+	}
+	fbgl_console_set_color(status, 0x000000, 0x40C0FF);
+	fbgl_console_clear(status);
+	fbgl_console_set_color(log, 0xC0C0C0, 0x101418);
+	fbgl_console_clear(log);
+
+	char line[128];
+	int64_t painted = 0;
+	for (int32_t frame = 0; frame < 600; frame++) {
+		snprintf(line, sizeof(line), " fbgl console | frame %5d | %.1f fps",
+			 (int)frame, fbgl_get_fps());
+		fbgl_console_write(status, 0, 0, line);
+
+		if (frame % 10 == 0) {
+			fbgl_console_set_color(log, frame % 50 ? 0xC0C0C0 :
+								 0xFFD040,
+					       0x101418);
+			snprintf(line, sizeof(line),
+				 "[%6d] event %d: all systems nominal\n",
+				 (int)frame, (int)frame / 10);
+			fbgl_console_print(log, line);
+		}
+
+		painted += fbgl_console_draw(&fb, status);
+		painted += fbgl_console_draw(&fb, log);
+		nanosleep((struct timespec[]){ { 0, (int)16e6 } }, NULL);
+	}
+	printf("%lld cells repainted over 600 frames of %d\n",
+	       (long long)painted, (int)(cols * rows));
+
+	fbgl_console_destroy(status);
+	fbgl_console_destroy(log);
+	fbgl_destroy_psf1_font(font);
+	fbgl_destroy(&fb);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NEEDLE_LENGTH 240
+#define NEEDLE_WIDTH 16
+
+// Sweep a needle texture around a dial with fbgl_draw_texture_affine
+int main(void)
+{
+	fbgl_t fb;
+	if (fbgl_init(NULL, &fb) != 0) {
+		fprintf(stderr, "Failed to initialize framebuffer.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Tapered needle pointing right, pivot at its left end
+	static uint32_t pixels[NEEDLE_LENGTH * NEEDLE_WIDTH];
+	fbgl_tga_texture_t needle = { 0 };
+	needle.width = NEEDLE_LENGTH;
+	needle.height = NEEDLE_WIDTH;
+	needle.data = pixels;
+	for (int32_t y = 0; y < NEEDLE_WIDTH; y++) {
+		for (int32_t x = 0; x < NEEDLE_LENGTH; x++) {
+			const int32_t taper = NEEDLE_LENGTH - x;
+			const int32_t half =
+				NEEDLE_WIDTH / 2 * taper / NEEDLE_LENGTH;
+			const int32_t dy = abs(2 * y + 1 - NEEDLE_WIDTH) / 2;
+			pixels[y * NEEDLE_LENGTH + x] =
+				dy <= half ? 0xFFFF3020 : 0x00000000;
+		}
+	}
+	fbgl_texture_update_runs(&needle);
+
+	const float cx = fb.width / 2.0f;
+	const float cy = fb.height / 2.0f;
+	const fbgl_matrix_t pivot =
+		fbgl_matrix_translate(0.0f, -NEEDLE_WIDTH / 2.0f);
+
+	for (int32_t frame = 0; frame < 600; frame++) {
+		// Ease between the ends of a 270 degree dial
+		const float sweep = 0.5f - 0.5f * cosf(frame * 0.02f);
+		const float angle = 3.14159265f * (0.75f + 1.5f * sweep);
+		const fbgl_matrix_t matrix = fbgl_matrix_multiply(
+			fbgl_matrix_translate(cx, cy),
+			fbgl_matrix_multiply(fbgl_matrix_rotate(angle), pivot));
+
+		fbgl_set_bg(&fb, 0x00101418);
+		fbgl_draw_circle_filled((int)cx, (int)cy, NEEDLE_LENGTH + 20,
+					0x00303840, &fb);
+		fbgl_draw_texture_affine(&fb, &needle, matrix);
+		fbgl_draw_circle_filled((int)cx, (int)cy, 12, 0x00E0E0E0, &fb);
+		nanosleep((struct timespec[]){ { 0, (int)16e6 } }, NULL);
+	}
+
+	free(needle.row_runs);
+	fbgl_destroy(&fb);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,182 @@
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Decode PNGs built in memory whose zlib stream is split over IDAT chunks
+// at every offset, with an empty IDAT at the split. Also checks that a
+// palette index past the PLTE entries is rejected. Needs no framebuffer.
+
+#define WIDTH 4
+#define HEIGHT 2
+#define STRIDE (1 + WIDTH * 4) // Filter byte and RGBA pixels
+
+typedef struct buffer {
+	uint8_t data[1024];
+	size_t size;
+} buffer_t;
+
+static uint32_t crc32(const uint8_t *p, size_t n)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < n; i++) {
+		crc ^= p[i];
+		for (int k = 0; k < 8; k++) {
+			crc = crc >> 1 ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+static void put32(buffer_t *b, uint32_t v)
+{
+	b->data[b->size++] = (uint8_t)(v >> 24);
+	b->data[b->size++] = (uint8_t)(v >> 16);
+	b->data[b->size++] = (uint8_t)(v >> 8);
+	b->data[b->size++] = (uint8_t)v;
+}
+
+static void chunk(buffer_t *b, const char *type, const uint8_t *body,
+		  size_t length)
+{
+	put32(b, (uint32_t)length);
+	const size_t start = b->size;
+	memcpy(b->data + b->size, type, 4);
+	memcpy(b->data + b->size + 4, body, length);
+	b->size += 4 + length;
+	put32(b, crc32(b->data + start, length + 4));
+}
+
+static void header(buffer_t *b, uint8_t depth, uint8_t color)
+{
+	static const uint8_t signature[8] = { 0x89, 'P',  'N',	'G',
+					      '\r', '\n', 0x1A, '\n' };
+	const uint8_t ihdr[13] = { 0, 0, 0, WIDTH, 0, 0, 0, HEIGHT,
+				   depth, color, 0, 0, 0 };
+	memcpy(b->data, signature, 8);
+	b->size = 8;
+	chunk(b, "IHDR", ihdr, sizeof(ihdr));
+}
+
+// Append count bits, least significant first
+static void bits(buffer_t *b, uint32_t *acc, int *held, uint32_t v, int count)
+{
+	*acc |= v << *held;
+	*held += count;
+	while (*held >= 8) {
+		b->data[b->size++] = (uint8_t)*acc;
+		*acc >>= 8;
+		*held -= 8;
+	}
+}
+
+// Fixed Huffman codes are sent most significant bit first
+static void code(buffer_t *b, uint32_t *acc, int *held, uint32_t v, int count)
+{
+	for (int i = count - 1; i >= 0; i--) {
+		bits(b, acc, held, v >> i & 1, 1);
+	}
+}
+
+// zlib stream of raw: a stored block with the first half, then a fixed
+// Huffman block with the rest, so both block readers cross the splits
+static void deflate(buffer_t *z, const uint8_t *raw, size_t size)
+{
+	const size_t half = size / 2;
+	uint32_t adler_a = 1;
+	uint32_t adler_b = 0;
+	for (size_t i = 0; i < size; i++) {
+		adler_a = (adler_a + raw[i]) % 65521;
+		adler_b = (adler_b + adler_a) % 65521;
+	}
+
+	z->size = 0;
+	z->data[z->size++] = 0x78;
+	z->data[z->size++] = 0x01;
+	z->data[z->size++] = 0x00; // Stored, not final
+	z->data[z->size++] = (uint8_t)half;
+	z->data[z->size++] = (uint8_t)(half >> 8);
+	z->data[z->size++] = (uint8_t)~half;
+	z->data[z->size++] = (uint8_t)(~half >> 8);
+	memcpy(z->data + z->size, raw, half);
+	z->size += half;
+
+	uint32_t acc = 0;
+	int held = 0;
+	bits(z, &acc, &held, 1, 1); // Final
+	bits(z, &acc, &held, 1, 2); // Fixed Huffman
+	for (size_t i = half; i < size; i++) {
+		if (raw[i] < 144) {
+			code(z, &acc, &held, 0x30 + raw[i], 8);
+		} else {
+			code(z, &acc, &held, 0x190 + raw[i] - 144, 9);
+		}
+	}
+	code(z, &acc, &held, 0, 7); // End of block
+	bits(z, &acc, &held, 0, 7); // Flush to a byte
+	put32(z, adler_b << 16 | adler_a);
+}
+
+static void finish(buffer_t *b, const buffer_t *z, size_t split)
+{
+	chunk(b, "IDAT", z->data, split);
+	chunk(b, "IDAT", NULL, 0);
+	chunk(b, "IDAT", z->data + split, z->size - split);
+	chunk(b, "IEND", NULL, 0);
+}
+
+int main(void)
+{
+	uint8_t raw[STRIDE * HEIGHT];
+	uint32_t expected[WIDTH * HEIGHT];
+	for (int y = 0; y < HEIGHT; y++) {
+		raw[y * STRIDE] = 0; // No filter
+		for (int x = 0; x < WIDTH; x++) {
+			uint8_t *p = raw + y * STRIDE + 1 + x * 4;
+			p[0] = (uint8_t)(x * 60 + 10);
+			p[1] = (uint8_t)(y * 100 + 20);
+			p[2] = (uint8_t)(200 - x * 30);
+			p[3] = 255;
+			expected[y * WIDTH + x] = 0xFF000000 |
+						  (uint32_t)p[0] << 16 |
+						  (uint32_t)p[1] << 8 | p[2];
+		}
+	}
+
+	int failures = 0;
+	buffer_t z;
+	buffer_t png;
+	deflate(&z, raw, sizeof(raw));
+	for (size_t split = 0; split <= z.size; split++) {
+		header(&png, 8, 6);
+		finish(&png, &z, split);
+		fbgl_tga_texture_t *texture =
+			fbgl_load_texture_memory(png.data, png.size);
+		if (!texture || memcmp(texture->data, expected,
+				       sizeof(expected)) != 0) {
+			printf("IDAT split at %zu: wrong image\n", split);
+			failures++;
+		}
+		fbgl_destroy_texture(texture);
+	}
+
+	// Indexed, two palette entries, and the last pixel uses index 2
+	uint8_t indexed[(1 + WIDTH) * HEIGHT] = { 0 };
+	indexed[sizeof(indexed) - 1] = 2;
+	static const uint8_t plte[6] = { 0, 0, 0, 255, 255, 255 };
+	deflate(&z, indexed, sizeof(indexed));
+	header(&png, 8, 3);
+	chunk(&png, "PLTE", plte, sizeof(plte));
+	finish(&png, &z, z.size / 2);
+	fbgl_tga_texture_t *texture =
+		fbgl_load_texture_memory(png.data, png.size);
+	if (texture) {
+		printf("Palette index past PLTE was accepted\n");
+		fbgl_destroy_texture(texture);
+		failures++;
+	}
+
+	printf("%s\n", failures ? "FAILED" : "All PNG checks passed");
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
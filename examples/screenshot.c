@@ -0,0 +1,53 @@
+#define FBGL_IMPLEMENTATION
+#define FBGL_THREADS
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Dump the visible framebuffer to a binary PPM: screenshot [out.ppm] [threads]
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : "screenshot.ppm";
+	const int32_t threads = argc > 2 ? atoi(argv[2]) : 1;
+
+	fbgl_t fb;
+	if (fbgl_init(NULL, &fb) != 0) {
+		return 1;
+	}
+	if (fbgl_threads_init(threads) != 0) {
+		fbgl_destroy(&fb);
+		return 1;
+	}
+
+	const size_t count = (size_t)fb.width * fb.height;
+	uint32_t *pixels = malloc(count * sizeof(*pixels));
+	uint8_t *rgb = malloc(count * 3);
+	fbgl_rect_t screen = { 0, 0, fb.width, fb.height };
+	int status = 1;
+
+	if (pixels && rgb &&
+	    fbgl_read_pixels(&fb, screen, pixels, fb.width * 4) == 0) {
+		for (size_t i = 0; i < count; i++) {
+			rgb[i * 3 + 0] = (pixels[i] >> 16) & 0xFF;
+			rgb[i * 3 + 1] = (pixels[i] >> 8) & 0xFF;
+			rgb[i * 3 + 2] = pixels[i] & 0xFF;
+		}
+
+		FILE *out = fopen(path, "wb");
+		if (out) {
+			fprintf(out, "P6\n%d %d\n255\n", fb.width, fb.height);
+			if (fwrite(rgb, 3, count, out) == count) {
+				status = 0;
+			}
+			fclose(out);
+		} else {
+			perror("Error opening output file");
+		}
+	}
+
+	free(rgb);
+	free(pixels);
+	fbgl_threads_destroy();
+	fbgl_destroy(&fb);
+	return status;
+}
@@ -0,0 +1,115 @@
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_ROUNDS 200
+#define ICON_COUNT 64
+#define ICON_SIZE 24
+#define SPRITE_COUNT 2000
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Round icon with a soft edge, premultiplied like loaded textures
+static int make_icon(fbgl_tga_texture_t *icon, int index)
+{
+	icon->width = ICON_SIZE;
+	icon->height = ICON_SIZE;
+	icon->data = malloc(ICON_SIZE * ICON_SIZE * sizeof(uint32_t));
+	if (!icon->data) {
+		return -1;
+	}
+	const int center = ICON_SIZE / 2;
+	const uint32_t color = FBGL_RGB((index * 37) & 0xFF,
+					(index * 91) & 0xFF, 0xC0);
+	for (int y = 0; y < ICON_SIZE; y++) {
+		for (int x = 0; x < ICON_SIZE; x++) {
+			const int dx = x - center;
+			const int dy = y - center;
+			const int edge = (center - 1) * (center - 1) -
+					 (dx * dx + dy * dy);
+			const uint32_t alpha = edge < 0 ? 0 :
+					       edge > 32 ? 255 :
+							   (uint32_t)edge * 8;
+			icon->data[y * ICON_SIZE + x] =
+				fbgl_premultiply(alpha << 24 | color);
+		}
+	}
+	return fbgl_texture_update_runs(icon);
+}
+
+// Draw a dashboard's worth of icons one texture at a time and as a batch
+int main(void)
+{
+	fbgl_t surface;
+	if (fbgl_init_surface(&surface, BENCH_WIDTH, BENCH_HEIGHT,
+			      FBGL_FORMAT_XRGB8888, FBGL_INIT_DEFAULT) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	fbgl_tga_texture_t icons[ICON_COUNT] = { 0 };
+	fbgl_tga_texture_t const *images[ICON_COUNT];
+	for (int i = 0; i < ICON_COUNT; i++) {
+		if (make_icon(&icons[i], i) != 0) {
+			fprintf(stderr, "Failed to create icon.\n");
+			return EXIT_FAILURE;
+		}
+		images[i] = &icons[i];
+	}
+	fbgl_atlas_t *atlas = fbgl_atlas_create(images, ICON_COUNT, 256);
+	if (!atlas) {
+		return EXIT_FAILURE;
+	}
+
+	static fbgl_sprite_t sprites[SPRITE_COUNT];
+	srand(1);
+	for (int i = 0; i < SPRITE_COUNT; i++) {
+		sprites[i].atlas = atlas;
+		sprites[i].rect = atlas->rects[rand() % ICON_COUNT];
+		sprites[i].x = rand() % (BENCH_WIDTH - ICON_SIZE);
+		sprites[i].y = rand() % (BENCH_HEIGHT - ICON_SIZE);
+	}
+
+	fbgl_set_bg(&surface, 0x00202830);
+	double start = now_seconds();
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		for (int i = 0; i < SPRITE_COUNT; i++) {
+			const int icon = (sprites[i].rect.x / ICON_SIZE) +
+					 (sprites[i].rect.y / ICON_SIZE) *
+						 (atlas->texture.width /
+						  ICON_SIZE);
+			fbgl_draw_texture(&surface, &icons[icon], sprites[i].x,
+					  sprites[i].y);
+		}
+	}
+	const double single = now_seconds() - start;
+
+	start = now_seconds();
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		fbgl_draw_sprites(&surface, sprites, SPRITE_COUNT);
+	}
+	const double batch = now_seconds() - start;
+
+	const double count = (double)SPRITE_COUNT * BENCH_ROUNDS;
+	printf("%d %dx%d icons from a %dx%d atlas, kernels: %s\n",
+	       SPRITE_COUNT, ICON_SIZE, ICON_SIZE, atlas->texture.width,
+	       atlas->texture.height, fbgl_simd_info());
+	printf("draw_texture   %8.2f Msprite/s\n", count / single / 1e6);
+	printf("draw_sprites   %8.2f Msprite/s\n", count / batch / 1e6);
+
+	fbgl_atlas_destroy(atlas);
+	for (int i = 0; i < ICON_COUNT; i++) {
+		free(icons[i].row_runs);
+		free(icons[i].data);
+	}
+	fbgl_destroy(&surface);
+	return EXIT_SUCCESS;
+}
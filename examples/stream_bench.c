@@ -0,0 +1,73 @@
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_WIDTH 3840
+#define BENCH_HEIGHT 2160
+#define BENCH_ROUNDS 50
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Time clears and full-surface blits, report bandwidth in GB/s
+static void bench(const char *name, uint32_t flags,
+		  fbgl_tga_texture_t const *texture)
+{
+	fbgl_t surface;
+	if (fbgl_init_surface(&surface, BENCH_WIDTH, BENCH_HEIGHT,
+			      FBGL_FORMAT_XRGB8888, flags) != 0) {
+		return;
+	}
+
+	const double bytes = (double)surface.page_size * BENCH_ROUNDS;
+
+	double start = now_seconds();
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		fbgl_set_bg(&surface, (uint32_t)i * 0x010101);
+	}
+	const double clear = now_seconds() - start;
+
+	start = now_seconds();
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		fbgl_draw_texture(&surface, texture, 0, 0);
+	}
+	const double blit = now_seconds() - start;
+
+	printf("%-10s clear %6.2f GB/s   blit %6.2f GB/s\n", name,
+	       bytes / clear / 1e9, bytes / blit / 1e9);
+
+	fbgl_destroy(&surface);
+}
+
+int main(void)
+{
+	// Opaque full-screen texture so every blit is one run per row
+	fbgl_tga_texture_t texture = { 0 };
+	texture.width = BENCH_WIDTH;
+	texture.height = BENCH_HEIGHT;
+	texture.data = malloc((size_t)BENCH_WIDTH * BENCH_HEIGHT *
+			      sizeof(uint32_t));
+	if (!texture.data) {
+		fprintf(stderr, "Failed to allocate texture.\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < (size_t)BENCH_WIDTH * BENCH_HEIGHT; i++) {
+		texture.data[i] = 0xFF000000 | (uint32_t)(i * 2654435761u);
+	}
+	fbgl_texture_update_runs(&texture);
+
+	printf("%dx%d XRGB8888, %d rounds, kernels: %s\n", BENCH_WIDTH,
+	       BENCH_HEIGHT, BENCH_ROUNDS, fbgl_simd_info());
+	bench("cached", FBGL_INIT_DEFAULT, &texture);
+	bench("streaming", FBGL_INIT_STREAM_STORES, &texture);
+
+	free(texture.row_runs);
+	free(texture.data);
+	return EXIT_SUCCESS;
+}
@@ -77,8 +77,10 @@ int main(int argc, char *argv[])
 	const char *text = "Hello, fbgl!";
 
 	// Calculate centered position
-	int x = (fb.width - 8) / 2;
-	int y = (fb.height - 16) / 2;
+	const fbgl_text_font_t text_font = { font, NULL };
+	const fbgl_text_size_t size = fbgl_text_measure(text_font, text);
+	int x = (fb.width - size.width) / 2;
+	int y = (fb.height - size.height) / 2;
 
 	// Render centered text
 	fbgl_render_psf1_text(&fb, font, text, x, y, 0xFF0000);
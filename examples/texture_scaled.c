@@ -0,0 +1,55 @@
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Zoom a texture in and out around the screen center:
+// texture_scaled <texture_path> [nearest]
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <texture_path> [nearest]\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+	fbgl_filter_t filter = FBGL_FILTER_BILINEAR;
+	if (argc > 2 && strcmp(argv[2], "nearest") == 0) {
+		filter = FBGL_FILTER_NEAREST;
+	}
+
+	fbgl_tga_texture_t *texture = fbgl_load_tga_texture(argv[1]);
+	if (!texture) {
+		fprintf(stderr, "Failed to load texture.\n");
+		return EXIT_FAILURE;
+	}
+
+	fbgl_t framebuffer;
+	if (fbgl_init(NULL, &framebuffer) != 0) {
+		fprintf(stderr, "Failed to initialize framebuffer.\n");
+		fbgl_destroy_texture(texture);
+		return EXIT_FAILURE;
+	}
+
+	// Scale from a quarter of the texture size up to the full screen
+	const int32_t frames = 300;
+	for (int32_t frame = 0; frame < frames; frame++) {
+		const int32_t t = frame < frames / 2 ? frame : frames - frame;
+		const int32_t width = texture->width / 4 +
+				      (framebuffer.width - texture->width / 4) *
+					      t / (frames / 2);
+		const int32_t height = width * texture->height / texture->width;
+		const fbgl_rect_t rect = { (framebuffer.width - width) / 2,
+					   (framebuffer.height - height) / 2,
+					   width, height };
+
+		fbgl_set_bg(&framebuffer, 0x000000);
+		fbgl_draw_texture_scaled(&framebuffer, texture, rect, filter);
+		nanosleep((struct timespec[]){ { 0, (int)16e6 } }, NULL);
+	}
+
+	fbgl_destroy_texture(texture);
+	fbgl_destroy(&framebuffer);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#define FBGL_IMPLEMENTATION
+#define FBGL_THREADS
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_FRAMES 30
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A busy frame: clear, overlapping shapes and a few thousand lines
+static void draw_frame(fbgl_t *fb, int frame)
+{
+	srand(frame);
+	fbgl_set_bg(fb, 0x101018);
+
+	for (int i = 0; i < 200; i++) {
+		const int x = rand() % BENCH_WIDTH;
+		const int y = rand() % BENCH_HEIGHT;
+		const uint32_t color = (uint32_t)rand() & 0xFFFFFF;
+		switch (i % 4) {
+		case 0:
+			fbgl_draw_rectangle_filled(
+				(fbgl_point_t){ x, y },
+				(fbgl_point_t){ x + 150, y + 100 }, color, fb);
+			break;
+		case 1:
+			fbgl_draw_circle_filled(x, y, 60, color, fb);
+			break;
+		case 2:
+			fbgl_draw_ellipse_filled(x, y, 120, 40, color, fb);
+			break;
+		default:
+			fbgl_draw_triangle_filled(
+				(fbgl_point_t){ x, y },
+				(fbgl_point_t){ x + 200, y + 30 },
+				(fbgl_point_t){ x + 60, y + 180 }, color, fb);
+			break;
+		}
+	}
+
+	for (int i = 0; i < 2000; i++) {
+		fbgl_draw_line((fbgl_point_t){ rand() % BENCH_WIDTH,
+					       rand() % BENCH_HEIGHT },
+			       (fbgl_point_t){ rand() % BENCH_WIDTH,
+					       rand() % BENCH_HEIGHT },
+			       0xFFFFFF, fb);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const int threads = argc > 1 ? atoi(argv[1]) : 4;
+
+	fbgl_t surface;
+	if (fbgl_init_surface(&surface, BENCH_WIDTH, BENCH_HEIGHT,
+			      FBGL_FORMAT_XRGB8888, 0) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	double start = now_seconds();
+	for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+		draw_frame(&surface, frame);
+	}
+	const double immediate = (now_seconds() - start) / BENCH_FRAMES;
+
+	if (fbgl_threads_init(threads) != 0) {
+		fbgl_destroy(&surface);
+		return EXIT_FAILURE;
+	}
+
+	start = now_seconds();
+	for (int frame = 0; frame < BENCH_FRAMES; frame++) {
+		fbgl_deferred_begin(&surface);
+		draw_frame(&surface, frame);
+		fbgl_deferred_end(&surface);
+	}
+	const double deferred = (now_seconds() - start) / BENCH_FRAMES;
+
+	printf("immediate          %7.2f ms/frame\n", immediate * 1e3);
+	printf("deferred, %2d threads %5.2f ms/frame\n", threads,
+	       deferred * 1e3);
+
+	fbgl_threads_destroy();
+	fbgl_destroy(&surface);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+#define FBGL_USE_FREETYPE
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+
+// Antialiased TrueType text at a few sizes, with a counter that only
+// reuses glyphs already in the atlas
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : DEFAULT_FONT;
+	fbgl_t fb;
+	if (fbgl_init(NULL, &fb) != 0) {
+		fprintf(stderr, "Failed to initialize framebuffer.\n");
+		return EXIT_FAILURE;
+	}
+
+	static const int sizes[] = { 12, 18, 28, 44 };
+	fbgl_ttf_font_t *fonts[4] = { NULL };
+	for (int i = 0; i < 4; i++) {
+		fonts[i] = fbgl_load_ttf_font(path, sizes[i]);
+		if (!fonts[i]) {
+			fprintf(stderr, "Usage: %s [font.ttf]\n", argv[0]);
+			for (int j = 0; j < i; j++) {
+				fbgl_destroy_ttf_font(fonts[j]);
+			}
+			fbgl_destroy(&fb);
+			return EXIT_FAILURE;
+		}
+	}
+
+	char counter[32];
+	for (int32_t frame = 0; frame < 300; frame++) {
+		fbgl_set_bg(&fb, 0x00202428);
+		int y = 20;
+		for (int i = 0; i < 4; i++) {
+			fbgl_render_ttf_text(&fb, fonts[i],
+					     "Sphinx of black quartz, judge my "
+					     "vow. AVATAR \xc3\xa9t\xc3\xa9 "
+					     "\xe2\x82\xac",
+					     20, y, 0xFFF0F0F0);
+			y += fbgl_ttf_line_height(fonts[i]) + 8;
+		}
+
+		snprintf(counter, sizeof(counter), "Frame %d", (int)frame);
+		fbgl_render_ttf_text(&fb, fonts[3], counter, 20, y + 20,
+				     0xC0FFB040);
+		nanosleep((struct timespec[]){ { 0, (int)16e6 } }, NULL);
+	}
+
+	for (int i = 0; i < 4; i++) {
+		const fbgl_ttf_stats_t stats = fbgl_ttf_font_stats(fonts[i]);
+		printf("%dpx: %d glyphs, %llu rasterized, %llu drawn from "
+		       "the atlas\n",
+		       sizes[i], (int)stats.glyphs,
+		       (unsigned long long)stats.rasterized,
+		       (unsigned long long)stats.hits);
+		fbgl_destroy_ttf_font(fonts[i]);
+	}
+	fbgl_destroy(&fb);
+	return EXIT_SUCCESS;
+}
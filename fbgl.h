@@ -30,6 +30,7 @@
 #define NAME "FBGL"
 #define DEFAULT_FB "/dev/fb0"
 
+#include <assert.h>
 #include <fcntl.h>
 #include <linux/fb.h>
 #include <math.h>
@@ -42,6 +43,7 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -49,16 +51,92 @@
 /**
  * Structs
  */
+#ifndef FBGL_MAX_DAMAGE_RECTS
+#define FBGL_MAX_DAMAGE_RECTS 16
+#endif
+
+#ifndef FBGL_CLIP_STACK_SIZE
+#define FBGL_CLIP_STACK_SIZE 8
+#endif
+
+#ifndef FBGL_TILE_SIZE
+#define FBGL_TILE_SIZE 64
+#endif
+
+typedef struct fbgl_rect {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+} fbgl_rect_t;
+
+// Regions of the back buffer changed since the last present
+typedef struct fbgl_damage {
+	fbgl_rect_t rects[FBGL_MAX_DAMAGE_RECTS];
+	int32_t count;
+} fbgl_damage_t;
+
+typedef enum fbgl_fill_rule {
+	FBGL_FILL_EVEN_ODD = 0,
+	FBGL_FILL_NONZERO,
+} fbgl_fill_rule_t;
+
+typedef enum fbgl_format {
+	FBGL_FORMAT_XRGB8888 = 0,
+	FBGL_FORMAT_RGB565,
+	FBGL_FORMAT_RGB888,
+} fbgl_format_t;
+
+// Span kernels for one pixel format, chosen once in fbgl_init.
+// Colors are given as XRGB8888 and converted with map_color.
+typedef struct fbgl_pixel_ops {
+	uint32_t bytes_per_pixel;
+	uint32_t (*map_color)(uint32_t color);
+	void (*fill)(uint8_t *dst, uint32_t native, int32_t count);
+	void (*blit)(uint8_t *dst, const uint32_t *src, int32_t count);
+	void (*glyph)(uint8_t *dst, const uint8_t *bits, int32_t col0,
+		      int32_t col1, uint32_t native);
+	void (*column)(uint8_t *dst, size_t pitch, uint32_t native,
+		       int32_t count);
+	// Bresenham run: count pixels, each advancing dst by step and by
+	// carry whenever rem += inc reaches den
+	void (*line)(uint8_t *dst, ptrdiff_t step, ptrdiff_t carry, int64_t rem,
+		     int64_t inc, int64_t den, int32_t count, uint32_t native);
+	void (*read)(uint32_t *dst, const uint8_t *src, int32_t count);
+} fbgl_pixel_ops_t;
+
 typedef struct fbgl {
 	int32_t width;
 	int32_t height;
 	int32_t fd;
 	uint32_t screen_size;
-	uint32_t *pixels;
+	uint32_t *pixels; // Draw target (back buffer when enabled)
 	struct fb_var_screeninfo vinfo; // Variable screen information
 	struct fb_fix_screeninfo finfo; // Fixed screen information
+	uint8_t *mapping; // mmap'd device memory
+	uint32_t *back_buffer; // System RAM back buffer, NULL when disabled
+	uint32_t flags; // FBGL_INIT_* flags
+	uint32_t page; // Page currently scanned out when panning
+	uint32_t page_size; // Bytes per visible page
+	bool can_pan; // Device has room for two pages and supports panning
+	fbgl_damage_t damage; // Changed since the last swap
+	fbgl_damage_t prev_damage; // Changed in the frame before (panning)
+	uint32_t pitch; // Bytes per row of the draw target
+	fbgl_format_t format; // Pixel format of device and back buffer
+	fbgl_pixel_ops_t ops; // Kernels for format
+	bool stream_stores; // Draw target is write-combined device memory
+	fbgl_rect_t clip; // Drawing is limited to this rect
+	fbgl_rect_t clip_stack[FBGL_CLIP_STACK_SIZE]; // Saved by fbgl_push_clip
+	int32_t clip_depth;
+	struct fbgl_deferred *deferred; // Recorded primitives when deferred
 } fbgl_t;
 
+typedef enum fbgl_init_flags {
+	FBGL_INIT_DEFAULT = 0,
+	FBGL_INIT_BACK_BUFFER = 1 << 0, // Draw into RAM, present with swap
+	FBGL_INIT_STREAM_STORES = 1 << 1, // Clear and blit with streaming stores
+} fbgl_init_flags_t;
+
 typedef struct fbgl_window {
 	int32_t x; // Top-left x-coordinate of the window
 	int32_t y; // Top-left y-coordinate of the window
@@ -72,21 +150,188 @@ typedef struct fbgl_point {
 	int32_t y;
 } fbgl_point_t;
 
+typedef enum fbgl_texture_run_kind {
+	FBGL_RUN_OPAQUE = 0, // Every texel has alpha 0xFF
+	FBGL_RUN_PARTIAL, // Translucent texels, drawn one at a time
+} fbgl_texture_run_kind_t;
+
+// Texels [start, end) of one row; fully transparent texels have no run
+typedef struct fbgl_texture_run {
+	uint16_t start;
+	uint16_t end;
+	uint8_t kind; // fbgl_texture_run_kind_t
+} fbgl_texture_run_t;
+
+typedef enum fbgl_texture_flags {
+	FBGL_TEXTURE_OPAQUE = 1 << 0, // No texel has alpha below 0xFF
+} fbgl_texture_flags_t;
+
+typedef enum fbgl_filter {
+	FBGL_FILTER_NEAREST = 0,
+	FBGL_FILTER_BILINEAR,
+} fbgl_filter_t;
+
+// x' = xx * x + xy * y + x0, y' = yx * x + yy * y + y0
+typedef struct fbgl_matrix {
+	float xx, xy, x0;
+	float yx, yy, y0;
+} fbgl_matrix_t;
+
 typedef struct fbgl_tga_texture {
 	uint16_t width;
 	uint16_t height;
 	uint32_t *data;
+	// Filled by fbgl_texture_update_runs, NULL to scan alpha while drawing
+	uint32_t *row_runs; // height + 1 indices into runs
+	fbgl_texture_run_t *runs;
+	uint32_t flags; // FBGL_TEXTURE_* flags
 } fbgl_tga_texture_t;
 
+// Several images packed into the rows of one texture
+typedef struct fbgl_atlas {
+	fbgl_tga_texture_t texture;
+	fbgl_rect_t *rects; // Where each image passed to fbgl_atlas_create went
+	int32_t count;
+} fbgl_atlas_t;
+
+typedef struct fbgl_sprite {
+	fbgl_atlas_t const *atlas;
+	fbgl_rect_t rect; // Source texels, usually one of atlas->rects
+	int32_t x, y; // Surface position of the rect's top left texel
+} fbgl_sprite_t;
+
+// Blocks of 256 codepoints covering Unicode, see fbgl_psf1_font_t.unicode
+#define FBGL_FONT_UNICODE_PAGES 0x1100
+
+// A PSF1 or PSF2 bitmap font
 typedef struct fbgl_psf1_font {
-	uint8_t magic[2]; // Magic number (0x36, 0x04 for PSF1)
-	uint8_t mode; // Mode (0 = 256 glyphs, 1 = 512 glyphs)
+	uint8_t magic[2]; // Magic number (0x36, 0x04 for PSF1, 0x72, 0xB5 PSF2)
+	uint8_t mode; // PSF1 mode (bit 0: 512 glyphs, bits 1-2: Unicode table)
 	uint8_t char_height; // Character height in pixels
-	uint8_t *glyphs; // Pointer to glyph data
-	uint16_t glyph_count; // Number of glyphs (calculated from mode)
+	uint8_t *glyphs; // char_height rows of (char_width + 7) / 8 bytes each
+	uint16_t glyph_count; // Number of glyphs
 	uint16_t char_width; // Character width in pixels (always 8 for PSF1)
+	// Unicode map, NULL if the font has none. Codepoint cp draws the glyph
+	// at FBGL_FONT_UNICODE_PAGES + unicode[cp >> 8] * 256 + (cp & 0xFF)
+	uint16_t *unicode;
+	uint32_t unicode_size; // Entries in unicode
 } fbgl_psf1_font_t;
 
+#ifdef FBGL_USE_FREETYPE
+// Largest pixel size fbgl_load_ttf_font accepts
+#define FBGL_TTF_MAX_SIZE 1024
+
+// A TrueType or other FreeType font at one pixel size
+typedef struct fbgl_ttf_font fbgl_ttf_font_t;
+
+typedef struct fbgl_ttf_stats {
+	uint64_t hits; // Glyphs drawn from the atlas
+	uint64_t rasterized; // Glyphs rendered by FreeType
+	uint64_t evictions; // Glyphs dropped from the atlas
+	int32_t glyphs; // Glyphs with cached metrics
+} fbgl_ttf_stats_t;
+#endif
+
+// Font to measure and lay out text with: psf, or with FBGL_USE_FREETYPE,
+// ttf when psf is NULL
+typedef struct fbgl_text_font {
+	fbgl_psf1_font_t *psf;
+	struct fbgl_ttf_font *ttf;
+} fbgl_text_font_t;
+
+typedef struct fbgl_text_size {
+	int32_t width, height;
+} fbgl_text_size_t;
+
+// One line of laid out text
+typedef struct fbgl_text_run {
+	int32_t start; // Byte offset into the layout's text
+	int32_t length; // Bytes, without the newline or wrapped spaces
+	int32_t x, y; // Offset from the layout origin
+	int32_t width; // Pixels the pen advances
+} fbgl_text_run_t;
+
+typedef struct fbgl_text_layout {
+	fbgl_text_font_t font;
+	char *text; // Copy of the laid out text
+	int32_t max_width; // Wrap width, 0 for none
+	fbgl_text_run_t *runs; // One per line
+	int32_t run_count;
+	int32_t width, height; // Size of all lines together
+} fbgl_text_layout_t;
+
+typedef struct fbgl_text_cache fbgl_text_cache_t;
+
+// Largest console width or height, in pixels
+#define FBGL_CONSOLE_MAX_SIZE 65536
+
+// Cell grid of text drawn with a PSF font, repainted where it changed
+typedef struct fbgl_console fbgl_console_t;
+
+// Asset pack file layout, little-endian. A fbgl_pack_header_t is followed
+// by entry_count entries sorted by name; every blob starts on a
+// FBGL_PACK_ALIGN boundary so views can point straight into the mapping.
+#define FBGL_PACK_MAGIC "FBGLPAK\0"
+#define FBGL_PACK_VERSION 1
+#define FBGL_PACK_ALIGN 64
+#define FBGL_PACK_NAME_SIZE 40
+
+typedef enum fbgl_pack_kind {
+	FBGL_PACK_TEXTURE = 1,
+	FBGL_PACK_ATLAS,
+	FBGL_PACK_FONT,
+} fbgl_pack_kind_t;
+
+typedef struct fbgl_pack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_count;
+	uint64_t entries; // Offset of the entry table
+} fbgl_pack_header_t;
+
+typedef struct fbgl_pack_entry {
+	char name[FBGL_PACK_NAME_SIZE]; // NUL terminated
+	uint32_t kind; // fbgl_pack_kind_t
+	uint32_t flags; // FBGL_TEXTURE_* flags of textures and atlases
+	uint16_t width; // Texels, or glyph width of fonts
+	uint16_t height; // Texels, or glyph height of fonts
+	uint32_t count; // Runs of textures and atlases, glyphs of fonts
+	uint64_t data; // Premultiplied ARGB8888 texels or glyph bitmaps
+	uint64_t runs; // height + 1 row indices, then count runs; 0 if none.
+		       // For fonts, the uint16_t Unicode map, if any
+	uint64_t rects; // fbgl_rect_t per atlas image
+	uint32_t rect_count; // Atlas images, or font Unicode map entries
+	uint32_t reserved;
+} fbgl_pack_entry_t;
+
+typedef struct fbgl_pack fbgl_pack_t;
+
+typedef enum fbgl_asset_kind {
+	FBGL_ASSET_TEXTURE = 1, // fbgl_tga_texture_t from a TGA, QOI or PNG
+	FBGL_ASSET_FONT, // fbgl_psf1_font_t from a PSF1 or PSF2 file
+} fbgl_asset_kind_t;
+
+typedef struct fbgl_asset_stats {
+	uint64_t hits; // Gets answered from the cache
+	uint64_t shared; // Hits on another path with the same contents
+	uint64_t misses; // Gets that decoded a file
+	uint64_t evictions;
+	size_t bytes; // Decoded size of all cached assets
+	size_t budget;
+	int32_t count; // Cached assets
+	int32_t in_use; // Cached assets with references
+} fbgl_asset_stats_t;
+
+typedef struct fbgl_asset_cache fbgl_asset_cache_t;
+
+typedef enum fbgl_load_status {
+	FBGL_LOAD_PENDING,
+	FBGL_LOAD_DONE,
+	FBGL_LOAD_FAILED,
+} fbgl_load_status_t;
+
+typedef struct fbgl_load_job fbgl_load_job_t;
+
 typedef enum fbgl_key {
 	FBGL_KEY_NONE = 0,
 	FBGL_KEY_UP,
@@ -122,18 +367,36 @@ extern "C" {
  */
 char const *fbgl_name_info(void);
 char const *fbgl_version_info(void);
+char const *fbgl_simd_info(void);
 float fbgl_get_fps(void);
 
 /*Create and destroy methods*/
 int fbgl_init(const char *device, fbgl_t *fb);
+int fbgl_init_ex(const char *device, fbgl_t *fb, uint32_t flags);
+int fbgl_init_surface(fbgl_t *fb, int32_t width, int32_t height,
+		      fbgl_format_t format, uint32_t flags);
 void fbgl_destroy(fbgl_t *fb);
+int fbgl_swap_buffers(fbgl_t *fb);
+void fbgl_add_damage(fbgl_t *fb, fbgl_rect_t rect);
+int fbgl_push_clip(fbgl_t *fb, fbgl_rect_t rect);
+void fbgl_pop_clip(fbgl_t *fb);
+fbgl_rect_t fbgl_get_clip(fbgl_t const *fb);
+int fbgl_deferred_begin(fbgl_t *fb);
+void fbgl_deferred_end(fbgl_t *fb);
+int fbgl_threads_init(int32_t count);
+void fbgl_threads_destroy(void);
 
 /**
  * Drawing functions
  */
 void fbgl_clear(uint32_t color);
+void fbgl_set_bg(fbgl_t *fb, uint32_t color);
 void fbgl_put_pixel(int x, int y, uint32_t color, fbgl_t *fb);
 void fbgl_draw_line(fbgl_point_t x, fbgl_point_t y, uint32_t color, fbgl_t *fb);
+void fbgl_draw_polyline(fbgl_point_t const *points, int32_t count, bool closed,
+			uint32_t color, fbgl_t *fb);
+void fbgl_draw_lines(fbgl_point_t const *points, int32_t count, uint32_t color,
+		     fbgl_t *fb);
 
 /**
  * Access framebuffer data methods
@@ -141,6 +404,9 @@ void fbgl_draw_line(fbgl_point_t x, fbgl_point_t y, uint32_t color, fbgl_t *fb);
 uint32_t *fb_get_data(fbgl_t const *fb);
 uint32_t fb_get_width(fbgl_t const *fb);
 uint32_t fb_get_height(fbgl_t const *fb);
+uint32_t fb_get_pitch(fbgl_t const *fb);
+int fbgl_read_pixels(fbgl_t const *fb, fbgl_rect_t rect, uint32_t *dst,
+		     size_t dst_pitch);
 
 /**
  * Shapes
@@ -151,26 +417,133 @@ void fbgl_draw_rectangle_outline(fbgl_point_t top_left,
 void fbgl_draw_rectangle_filled(fbgl_point_t top_left,
 				fbgl_point_t bottom_right, uint32_t color,
 				fbgl_t *fb);
+void fbgl_fill_rect_blend(fbgl_point_t top_left, fbgl_point_t bottom_right,
+			  uint32_t argb, fbgl_t *fb);
 void fbgl_draw_circle_outline(int x, int y, int radius, uint32_t color,
 			      fbgl_t *fb);
 void fbgl_draw_circle_filled(int x, int y, int radius, uint32_t color,
 			     fbgl_t *fb);
+void fbgl_draw_ellipse_filled(int x, int y, int rx, int ry, uint32_t color,
+			      fbgl_t *fb);
+void fbgl_draw_triangle_filled(fbgl_point_t a, fbgl_point_t b, fbgl_point_t c,
+			       uint32_t color, fbgl_t *fb);
+void fbgl_draw_polygon_filled(fbgl_point_t const *points, int32_t count,
+			      fbgl_fill_rule_t rule, uint32_t color,
+			      fbgl_t *fb);
 
 /**
  * texture
  */
 fbgl_tga_texture_t *fbgl_load_tga_texture(const char *path);
+fbgl_tga_texture_t *fbgl_load_tga_texture_memory(const void *data,
+						 size_t size);
+fbgl_tga_texture_t *fbgl_load_texture(const char *path);
+fbgl_tga_texture_t *fbgl_load_texture_memory(const void *data, size_t size);
 void fbgl_destroy_texture(fbgl_tga_texture_t *texture);
+int fbgl_texture_update_runs(fbgl_tga_texture_t *texture);
 void fbgl_draw_texture(fbgl_t *fb, fbgl_tga_texture_t const *texture, int32_t x,
 		       int32_t y);
+void fbgl_draw_texture_blend(fbgl_t *fb, fbgl_tga_texture_t const *texture,
+			     int32_t x, int32_t y, uint32_t opacity);
+void fbgl_draw_texture_scaled(fbgl_t *fb, fbgl_tga_texture_t const *texture,
+			      fbgl_rect_t rect, fbgl_filter_t filter);
+void fbgl_draw_texture_affine(fbgl_t *fb, fbgl_tga_texture_t const *texture,
+			      fbgl_matrix_t matrix);
+fbgl_matrix_t fbgl_matrix_identity(void);
+fbgl_matrix_t fbgl_matrix_translate(float x, float y);
+fbgl_matrix_t fbgl_matrix_scale(float sx, float sy);
+fbgl_matrix_t fbgl_matrix_rotate(float radians);
+fbgl_matrix_t fbgl_matrix_multiply(fbgl_matrix_t a, fbgl_matrix_t b);
+uint32_t fbgl_premultiply(uint32_t argb);
+fbgl_atlas_t *fbgl_atlas_create(fbgl_tga_texture_t const *const *images,
+				int32_t count, int32_t max_width);
+void fbgl_atlas_destroy(fbgl_atlas_t *atlas);
+void fbgl_draw_sprites(fbgl_t *fb, fbgl_sprite_t const *sprites,
+		       int32_t count);
+
+/**
+ * Asset packs
+ */
+fbgl_pack_t *fbgl_pack_open(const char *path);
+void fbgl_pack_close(fbgl_pack_t *pack);
+fbgl_tga_texture_t const *fbgl_pack_texture(fbgl_pack_t const *pack,
+					    const char *name);
+fbgl_atlas_t const *fbgl_pack_atlas(fbgl_pack_t const *pack,
+				    const char *name);
+fbgl_psf1_font_t *fbgl_pack_font(fbgl_pack_t const *pack, const char *name);
+
+/**
+ * Asset cache
+ */
+fbgl_asset_cache_t *fbgl_asset_cache_create(size_t budget);
+void fbgl_asset_cache_destroy(fbgl_asset_cache_t *cache);
+void fbgl_asset_cache_set_budget(fbgl_asset_cache_t *cache, size_t budget);
+fbgl_asset_stats_t fbgl_asset_cache_stats(fbgl_asset_cache_t const *cache);
+void *fbgl_asset_get(fbgl_asset_cache_t *cache, const char *path,
+		     fbgl_asset_kind_t kind);
+void fbgl_asset_release(fbgl_asset_cache_t *cache, const void *asset);
+
+/**
+ * Background loading
+ */
+fbgl_load_job_t *fbgl_load_tga_texture_async(const char *path);
+fbgl_load_job_t *fbgl_load_psf1_font_async(const char *path);
+fbgl_load_status_t fbgl_load_poll(fbgl_load_job_t const *job);
+void *fbgl_load_finish(fbgl_load_job_t *job);
 
 /**
 * Text
 */
+fbgl_psf1_font_t *fbgl_load_psf_font(const char *path);
 fbgl_psf1_font_t *fbgl_load_psf1_font(const char *path);
 void fbgl_destroy_psf1_font(fbgl_psf1_font_t *font);
 void fbgl_render_psf1_text(fbgl_t *fb, fbgl_psf1_font_t *font, const char *text,
 			   int x, int y, uint32_t color);
+#ifdef FBGL_USE_FREETYPE
+fbgl_ttf_font_t *fbgl_load_ttf_font(const char *path, int px);
+void fbgl_destroy_ttf_font(fbgl_ttf_font_t *font);
+int fbgl_ttf_line_height(fbgl_ttf_font_t const *font);
+fbgl_ttf_stats_t fbgl_ttf_font_stats(fbgl_ttf_font_t const *font);
+void fbgl_render_ttf_text(fbgl_t *fb, fbgl_ttf_font_t *font, const char *text,
+			  int x, int y, uint32_t color);
+#endif
+
+/**
+ * Text layout
+ */
+fbgl_text_size_t fbgl_text_measure(fbgl_text_font_t font, const char *text);
+fbgl_text_layout_t *fbgl_text_layout(fbgl_text_font_t font, const char *text,
+				     int32_t max_width);
+void fbgl_text_layout_destroy(fbgl_text_layout_t *layout);
+void fbgl_draw_text_layout(fbgl_t *fb, fbgl_text_layout_t const *layout,
+			   int x, int y, uint32_t color);
+fbgl_text_cache_t *fbgl_text_cache_create(int32_t capacity);
+void fbgl_text_cache_destroy(fbgl_text_cache_t *cache);
+fbgl_text_layout_t const *fbgl_text_cache_layout(fbgl_text_cache_t *cache,
+						 fbgl_text_font_t font,
+						 const char *text,
+						 int32_t max_width);
+
+/**
+ * Console
+ */
+fbgl_console_t *fbgl_console_create(fbgl_psf1_font_t const *font, int32_t x,
+				    int32_t y, int32_t cols, int32_t rows);
+void fbgl_console_destroy(fbgl_console_t *console);
+void fbgl_console_set_color(fbgl_console_t *console, uint32_t fg,
+			    uint32_t bg);
+void fbgl_console_set_cursor(fbgl_console_t *console, int32_t col,
+			     int32_t row);
+void fbgl_console_set_cell(fbgl_console_t *console, int32_t col, int32_t row,
+			   uint32_t cp, uint32_t fg, uint32_t bg);
+void fbgl_console_write(fbgl_console_t *console, int32_t col, int32_t row,
+			const char *text);
+void fbgl_console_print(fbgl_console_t *console, const char *text);
+void fbgl_console_clear(fbgl_console_t *console);
+void fbgl_console_scroll(fbgl_console_t *console, int32_t lines);
+void fbgl_console_invalidate(fbgl_console_t *console);
+int32_t fbgl_console_draw(fbgl_t *fb, fbgl_console_t *console);
+
 /**
  * Keyboard
  */
@@ -206,15 +579,48 @@ static void i_fbgl_enable_raw_mode();
 FBGL_INLINE int i_fbgl_abs_int(int x);
 
 FBGL_INLINE int i_fbgl_sqrt_int(int x);
+FBGL_INLINE int64_t i_fbgl_sqrt_int64(int64_t x);
+FBGL_INLINE int64_t i_fbgl_floor_div(int64_t a, int64_t b);
 
 FBGL_INLINE int i_fbgl_abs_int(int x)
 {
 	return x < 0 ? -x : x;
 }
 
+// Floor of the square root, 0 for negative input
+FBGL_INLINE int64_t i_fbgl_sqrt_int64(int64_t x)
+{
+	if (x <= 0) {
+		return 0;
+	}
+
+	uint64_t n = (uint64_t)x;
+	uint64_t root = 0;
+	uint64_t bit = (uint64_t)1 << 62;
+	while (bit > n) {
+		bit >>= 2;
+	}
+	while (bit) {
+		if (n >= root + bit) {
+			n -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (int64_t)root;
+}
+
 FBGL_INLINE int i_fbgl_sqrt_int(int x)
 {
-	return x * x;
+	return (int)i_fbgl_sqrt_int64(x);
+}
+
+// Division rounding toward negative infinity, b > 0
+FBGL_INLINE int64_t i_fbgl_floor_div(int64_t a, int64_t b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
 }
 
 static void i_fbgl_die(const char *s)
@@ -250,524 +656,8056 @@ static void i_fbgl_disable_raw_mode()
 
 #ifdef FBGL_IMPLEMENTATION
 
-char const *fbgl_name_info(void)
+// Vector kernels need GCC/Clang target attributes, FBGL_NO_SIMD opts out
+#if !defined(FBGL_NO_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#if defined(__x86_64__) || defined(__i386__)
+#define FBGL_SIMD_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define FBGL_SIMD_NEON
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#endif
+#endif
+
+#ifdef FBGL_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef FBGL_USE_FREETYPE
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#endif
+
+// fbgl_t.flags bit for contexts made by fbgl_init_surface
+#define I_FBGL_SURFACE_FLAG (1u << 31)
+
+// Runs rows [begin, end) of a parallel job
+typedef void (*i_fbgl_range_fn)(void *ctx, int32_t begin, int32_t end);
+
+static int i_fbgl_pan(fbgl_t *fb, uint32_t page);
+static void i_fbgl_deferred_free(fbgl_t *fb);
+static void i_fbgl_parallel_for(i_fbgl_range_fn fn, void *ctx, int32_t rows,
+				int32_t grain);
+static void i_fbgl_loader_stop(void);
+FBGL_INLINE int32_t i_fbgl_row_grain(size_t row_bytes);
+static void i_fbgl_damage(fbgl_t *fb, int32_t x0, int32_t y0, int32_t x1,
+			  int32_t y1);
+FBGL_INLINE void i_fbgl_put_pixel(int x, int y, uint32_t native, fbgl_t *fb);
+
+/**
+ * Pixel format kernels
+ *
+ * Each kernel is written once against a constant bytes-per-pixel and
+ * instantiated per format, so the per-pixel store is resolved at compile
+ * time and the format is only looked at when fbgl_init picks the table.
+ */
+FBGL_INLINE void i_fbgl_store(uint8_t *dst, uint32_t native, const int bpp)
 {
-	return NAME;
+	if (bpp == 4) {
+		memcpy(dst, &native, 4);
+	} else if (bpp == 2) {
+		const uint16_t v = (uint16_t)native;
+		memcpy(dst, &v, 2);
+	} else {
+		dst[0] = (uint8_t)native;
+		dst[1] = (uint8_t)(native >> 8);
+		dst[2] = (uint8_t)(native >> 16);
+	}
 }
 
-char const *fbgl_version_info(void)
+FBGL_INLINE uint32_t i_fbgl_map(uint32_t color, const int bpp)
 {
-	return VERSION;
+	if (bpp == 2) {
+		return ((color >> 8) & 0xF800) | ((color >> 5) & 0x07E0) |
+		       ((color >> 3) & 0x001F);
+	}
+	return color;
 }
 
-int fbgl_init(const char *device, fbgl_t *fb)
+/**
+ * Wide fill kernels
+ *
+ * Fill whole vectors of a repeating 32-bit pattern starting at a 32-byte
+ * aligned address and return the number of bytes written; the caller
+ * stores the unaligned head and the tail. One variant is selected at
+ * runtime by i_fbgl_select_simd().
+ */
+typedef size_t (*i_fbgl_wide_fill_fn)(uint8_t *dst, uint32_t pattern,
+				      size_t bytes);
+
+static size_t i_fbgl_wide_fill_scalar(uint8_t *dst, uint32_t pattern,
+				      size_t bytes)
 {
-	if (!fb) {
-		fprintf(stderr, "Error: fbgl_t pointer is NULL.");
-		return -1;
+	const uint64_t v = (uint64_t)pattern << 32 | pattern;
+	size_t done = 0;
+	for (; done + 8 <= bytes; done += 8) {
+		memcpy(dst + done, &v, 8);
 	}
+	return done;
+}
 
-	fb->fd = device == NULL ? open(DEFAULT_FB, O_RDWR) :
-				  open(device, O_RDWR);
-	if (fb->fd == -1) {
-		perror("Error openning framebuffer device");
-		return -1;
+#ifdef FBGL_SIMD_X86
+__attribute__((target("sse2"))) static size_t
+i_fbgl_wide_fill_sse2(uint8_t *dst, uint32_t pattern, size_t bytes)
+{
+	const __m128i v = _mm_set1_epi32((int)pattern);
+	size_t done = 0;
+	for (; done + 64 <= bytes; done += 64) {
+		_mm_store_si128((__m128i *)(dst + done), v);
+		_mm_store_si128((__m128i *)(dst + done + 16), v);
+		_mm_store_si128((__m128i *)(dst + done + 32), v);
+		_mm_store_si128((__m128i *)(dst + done + 48), v);
 	}
+	for (; done + 16 <= bytes; done += 16) {
+		_mm_store_si128((__m128i *)(dst + done), v);
+	}
+	return done;
+}
 
-	if (ioctl(fb->fd, FBIOGET_FSCREENINFO, &fb->finfo) == -1) {
-		perror("Error: Reading fixed information.");
-		close(fb->fd);
-		return -1;
+__attribute__((target("avx2"))) static size_t
+i_fbgl_wide_fill_avx2(uint8_t *dst, uint32_t pattern, size_t bytes)
+{
+	const __m256i v = _mm256_set1_epi32((int)pattern);
+	size_t done = 0;
+	for (; done + 128 <= bytes; done += 128) {
+		_mm256_store_si256((__m256i *)(dst + done), v);
+		_mm256_store_si256((__m256i *)(dst + done + 32), v);
+		_mm256_store_si256((__m256i *)(dst + done + 64), v);
+		_mm256_store_si256((__m256i *)(dst + done + 96), v);
 	}
-	if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &fb->vinfo) == -1) {
-		perror("Error reading variable information");
-		close(fb->fd);
-		return -1;
+	for (; done + 32 <= bytes; done += 32) {
+		_mm256_store_si256((__m256i *)(dst + done), v);
 	}
+	return done;
+}
+#endif // FBGL_SIMD_X86
 
-	fb->width = fb->vinfo.xres;
-	fb->height = fb->vinfo.yres;
-	fb->screen_size = fb->finfo.smem_len;
-
-	// Map framebuffer to memory
-	fb->pixels = (uint32_t *)mmap(NULL, fb->screen_size,
-				      PROT_READ | PROT_WRITE, MAP_SHARED,
-				      fb->fd, 0);
-	if (fb->pixels == MAP_FAILED) {
-		perror("Error mapping framebuffer device to memory");
-		close(fb->fd);
-		return -1;
+#ifdef FBGL_SIMD_NEON
+static size_t i_fbgl_wide_fill_neon(uint8_t *dst, uint32_t pattern,
+				    size_t bytes)
+{
+	const uint32x4_t v = vdupq_n_u32(pattern);
+	size_t done = 0;
+	for (; done + 64 <= bytes; done += 64) {
+		vst1q_u32((uint32_t *)(dst + done), v);
+		vst1q_u32((uint32_t *)(dst + done + 16), v);
+		vst1q_u32((uint32_t *)(dst + done + 32), v);
+		vst1q_u32((uint32_t *)(dst + done + 48), v);
+	}
+	for (; done + 16 <= bytes; done += 16) {
+		vst1q_u32((uint32_t *)(dst + done), v);
 	}
+	return done;
+}
+#endif // FBGL_SIMD_NEON
 
-	return 0;
+/**
+ * Streaming kernels
+ *
+ * Same contract as the wide fills, but with non-temporal stores that
+ * bypass the cache. Used when the draw target is the write-combined
+ * device mapping; callers finish a bulk operation with
+ * i_fbgl_stream_fence(). NEON has no streaming store intrinsic, and ARM
+ * maps framebuffers non-cacheable anyway, so it keeps regular stores.
+ */
+typedef void (*i_fbgl_stream_copy_fn)(uint8_t *dst, const uint8_t *src,
+				      size_t bytes);
+
+static void i_fbgl_stream_copy_scalar(uint8_t *dst, const uint8_t *src,
+				      size_t bytes)
+{
+	memcpy(dst, src, bytes);
 }
 
-void fbgl_destroy(fbgl_t *fb)
+#ifdef FBGL_SIMD_X86
+__attribute__((target("sse2"))) static size_t
+i_fbgl_wide_stream_sse2(uint8_t *dst, uint32_t pattern, size_t bytes)
 {
-	if (!fb || fb->fd == -1) {
-		fprintf(stderr,
-			"Error: framebuffer not initialized or already destroyed.\n");
-		return;
+	const __m128i v = _mm_set1_epi32((int)pattern);
+	size_t done = 0;
+	for (; done + 64 <= bytes; done += 64) {
+		_mm_stream_si128((__m128i *)(dst + done), v);
+		_mm_stream_si128((__m128i *)(dst + done + 16), v);
+		_mm_stream_si128((__m128i *)(dst + done + 32), v);
+		_mm_stream_si128((__m128i *)(dst + done + 48), v);
 	}
-
-	if (fb->pixels && fb->pixels != MAP_FAILED) {
-		munmap(fb->pixels, fb->screen_size);
+	for (; done + 16 <= bytes; done += 16) {
+		_mm_stream_si128((__m128i *)(dst + done), v);
 	}
+	return done;
+}
 
-	close(fb->fd);
-	fb->fd = -1;
+__attribute__((target("avx2"))) static size_t
+i_fbgl_wide_stream_avx2(uint8_t *dst, uint32_t pattern, size_t bytes)
+{
+	const __m256i v = _mm256_set1_epi32((int)pattern);
+	size_t done = 0;
+	for (; done + 128 <= bytes; done += 128) {
+		_mm256_stream_si256((__m256i *)(dst + done), v);
+		_mm256_stream_si256((__m256i *)(dst + done + 32), v);
+		_mm256_stream_si256((__m256i *)(dst + done + 64), v);
+		_mm256_stream_si256((__m256i *)(dst + done + 96), v);
+	}
+	for (; done + 32 <= bytes; done += 32) {
+		_mm256_stream_si256((__m256i *)(dst + done), v);
+	}
+	return done;
 }
 
-void fbgl_set_bg(fbgl_t *fb, uint32_t color)
+__attribute__((target("sse2"))) static void
+i_fbgl_stream_copy_sse2(uint8_t *dst, const uint8_t *src, size_t bytes)
 {
-#ifdef DEBUG
-	if (!fb || fb->fd == -1) {
-		fprintf(stderr, "Error: framebuffer not initialized.\n");
+	const size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+	if (bytes < head + 64) {
+		memcpy(dst, src, bytes);
 		return;
 	}
-#endif // DEBUG
-
-	// Fill the entire framebuffer with the specified color
-	for (int32_t i = 0; i < fb->width * fb->height; i++) {
-		fb->pixels[i] = color;
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	bytes -= head;
+
+	size_t done = 0;
+	for (; done + 64 <= bytes; done += 64) {
+		const __m128i a = _mm_loadu_si128((const __m128i *)(src + done));
+		const __m128i b =
+			_mm_loadu_si128((const __m128i *)(src + done + 16));
+		const __m128i c =
+			_mm_loadu_si128((const __m128i *)(src + done + 32));
+		const __m128i d =
+			_mm_loadu_si128((const __m128i *)(src + done + 48));
+		_mm_stream_si128((__m128i *)(dst + done), a);
+		_mm_stream_si128((__m128i *)(dst + done + 16), b);
+		_mm_stream_si128((__m128i *)(dst + done + 32), c);
+		_mm_stream_si128((__m128i *)(dst + done + 48), d);
 	}
+	memcpy(dst + done, src + done, bytes - done);
 }
 
-void fbgl_put_pixel(int x, int y, uint32_t color, fbgl_t *fb)
+__attribute__((target("avx2"))) static void
+i_fbgl_stream_copy_avx2(uint8_t *dst, const uint8_t *src, size_t bytes)
 {
-#ifdef FBGL_VALIDATE_PUT_PIXEL
-	if (!fb || !fb->pixels) {
-		fprintf(stderr, "Error: framebuffer not initialized.\n");
+	const size_t head = (32 - ((uintptr_t)dst & 31)) & 31;
+	if (bytes < head + 128) {
+		memcpy(dst, src, bytes);
 		return;
 	}
-
-	if (x < 0 || x >= fb->width || y < 0 || y >= fb->height) {
-		return; // Ignore out-of-bound coordinates
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	bytes -= head;
+
+	size_t done = 0;
+	for (; done + 128 <= bytes; done += 128) {
+		const __m256i a =
+			_mm256_loadu_si256((const __m256i *)(src + done));
+		const __m256i b =
+			_mm256_loadu_si256((const __m256i *)(src + done + 32));
+		const __m256i c =
+			_mm256_loadu_si256((const __m256i *)(src + done + 64));
+		const __m256i d =
+			_mm256_loadu_si256((const __m256i *)(src + done + 96));
+		_mm256_stream_si256((__m256i *)(dst + done), a);
+		_mm256_stream_si256((__m256i *)(dst + done + 32), b);
+		_mm256_stream_si256((__m256i *)(dst + done + 64), c);
+		_mm256_stream_si256((__m256i *)(dst + done + 96), d);
 	}
-#endif // FBGL_VALIDATE_PUT_PIXEL
+	memcpy(dst + done, src + done, bytes - done);
+}
+#endif // FBGL_SIMD_X86
 
-	const size_t index = y * fb->width + x;
-	fb->pixels[index] = color;
+static i_fbgl_wide_fill_fn i_fbgl_wide_stream = i_fbgl_wide_fill_scalar;
+static i_fbgl_stream_copy_fn i_fbgl_stream_copy = i_fbgl_stream_copy_scalar;
+
+// Order streaming stores before anything that follows, e.g. a pan
+FBGL_INLINE void i_fbgl_stream_fence(void)
+{
+#ifdef FBGL_SIMD_X86
+	__asm__ __volatile__("sfence" ::: "memory");
+#endif
 }
 
-void fbgl_draw_line(fbgl_point_t x, fbgl_point_t y, uint32_t color,
-		    fbgl_t *buffer)
+/**
+ * Blend kernels
+ *
+ * Source-over compositing of premultiplied ARGB8888 pixels:
+ * dst = src + dst * (255 - src alpha) / 255, with src first scaled by
+ * opacity. Every division by 255 is the exact rounding
+ * (x + 128 + ((x + 128) >> 8)) >> 8, and the final add saturates, so
+ * the scalar and vector kernels give identical results.
+ */
+typedef void (*i_fbgl_blend_fn)(uint32_t *dst, const uint32_t *src,
+				int32_t count, uint32_t opacity);
+
+// Multiply two channels held as 0x00XX00YY by k / 255
+FBGL_INLINE uint32_t i_fbgl_mul255_lanes(uint32_t lanes, uint32_t k)
 {
-	const int32_t dx = i_fbgl_abs_int(y.x - x.x);
-	const int32_t dy = i_fbgl_abs_int(y.y - x.y);
+	lanes = lanes * k + 0x00800080;
+	return ((lanes + ((lanes >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+}
 
-	const int32_t sx = (x.x < y.x) ? 1 : -1;
-	const int32_t sy = (x.y < y.y) ? 1 : -1;
+FBGL_INLINE uint32_t i_fbgl_add_sat_lanes(uint32_t a, uint32_t b)
+{
+	const uint32_t sum = a + b;
+	const uint32_t over = sum & 0x01000100;
+	return (sum | (over - (over >> 8))) & 0x00FF00FF;
+}
 
-	int32_t err = dx - dy;
+FBGL_INLINE uint32_t i_fbgl_scale_argb(uint32_t argb, uint32_t k)
+{
+	return i_fbgl_mul255_lanes(argb & 0x00FF00FF, k) |
+	       i_fbgl_mul255_lanes((argb >> 8) & 0x00FF00FF, k) << 8;
+}
 
-	while (1) {
-		// Set the pixel at the current position
-		fbgl_put_pixel(x.x, x.y, color, buffer);
+FBGL_INLINE uint32_t i_fbgl_over(uint32_t dst, uint32_t src)
+{
+	const uint32_t d = i_fbgl_scale_argb(dst, 255 - (src >> 24));
+	return i_fbgl_add_sat_lanes(src & 0x00FF00FF, d & 0x00FF00FF) |
+	       i_fbgl_add_sat_lanes((src >> 8) & 0x00FF00FF,
+				    (d >> 8) & 0x00FF00FF)
+		       << 8;
+}
 
-		// If we've reached the end point, break
-		if (x.x >= y.x && x.y >= y.y)
-			break;
+static void i_fbgl_blend_scalar(uint32_t *dst, const uint32_t *src,
+				int32_t count, uint32_t opacity)
+{
+	for (int32_t i = 0; i < count; i++) {
+		const uint32_t s = opacity == 255 ?
+					   src[i] :
+					   i_fbgl_scale_argb(src[i], opacity);
+		dst[i] = i_fbgl_over(dst[i], s);
+	}
+}
 
-		const int32_t e2 = 2 * err;
+#ifdef FBGL_SIMD_X86
+__attribute__((target("sse2"))) static inline __m128i
+i_fbgl_div255_sse2(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
 
-		if (e2 > -dy) {
-			err -= dy;
-			x.x += sx;
+__attribute__((target("sse2"))) static void
+i_fbgl_blend_sse2(uint32_t *dst, const uint32_t *src, int32_t count,
+		  uint32_t opacity)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i k = _mm_set1_epi16((short)opacity);
+	int32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		const __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i s_lo = _mm_unpacklo_epi8(s, zero);
+		__m128i s_hi = _mm_unpackhi_epi8(s, zero);
+		if (opacity != 255) {
+			s_lo = i_fbgl_div255_sse2(_mm_mullo_epi16(s_lo, k));
+			s_hi = i_fbgl_div255_sse2(_mm_mullo_epi16(s_hi, k));
+			s = _mm_packus_epi16(s_lo, s_hi);
 		}
 
-		if (e2 < dx) {
-			err += dx;
-			x.y += sy;
-		}
+		// 255 - alpha in every channel of its pixel
+		s_lo = _mm_shufflelo_epi16(s_lo, 0xFF);
+		s_hi = _mm_shufflelo_epi16(s_hi, 0xFF);
+		s_lo = _mm_shufflehi_epi16(s_lo, 0xFF);
+		s_hi = _mm_shufflehi_epi16(s_hi, 0xFF);
+		__m128i d_lo = _mm_unpacklo_epi8(d, zero);
+		__m128i d_hi = _mm_unpackhi_epi8(d, zero);
+		d_lo = _mm_mullo_epi16(d_lo, _mm_sub_epi16(full, s_lo));
+		d_hi = _mm_mullo_epi16(d_hi, _mm_sub_epi16(full, s_hi));
+		d_lo = i_fbgl_div255_sse2(d_lo);
+		d_hi = i_fbgl_div255_sse2(d_hi);
+		s = _mm_adds_epu8(s, _mm_packus_epi16(d_lo, d_hi));
+		_mm_storeu_si128((__m128i *)(dst + i), s);
 	}
+	i_fbgl_blend_scalar(dst + i, src + i, count - i, opacity);
 }
-void fbgl_draw_rectangle_outline(fbgl_point_t top_left,
-				 fbgl_point_t bottom_right, uint32_t color,
-				 fbgl_t *fb)
+
+__attribute__((target("avx2"))) static inline __m256i
+i_fbgl_div255_avx2(__m256i x)
 {
-	// Top horizontal line
-	for (int x = top_left.x; x < bottom_right.x; x++) {
-		fbgl_put_pixel(x, top_left.y, color, fb);
-	}
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)),
+				 8);
+}
 
-	// Bottom horizontal line
-	for (int x = top_left.x; x < bottom_right.x; x++) {
-		fbgl_put_pixel(x, bottom_right.y - 1, color, fb);
-	}
+__attribute__((target("avx2"))) static void
+i_fbgl_blend_avx2(uint32_t *dst, const uint32_t *src, int32_t count,
+		  uint32_t opacity)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i full = _mm256_set1_epi16(255);
+	const __m256i k = _mm256_set1_epi16((short)opacity);
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		const __m256i d =
+			_mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i s_lo = _mm256_unpacklo_epi8(s, zero);
+		__m256i s_hi = _mm256_unpackhi_epi8(s, zero);
+		if (opacity != 255) {
+			s_lo = i_fbgl_div255_avx2(_mm256_mullo_epi16(s_lo, k));
+			s_hi = i_fbgl_div255_avx2(_mm256_mullo_epi16(s_hi, k));
+			s = _mm256_packus_epi16(s_lo, s_hi);
+		}
 
-	// Left vertical line
-	for (int y = top_left.y; y < bottom_right.y; y++) {
-		fbgl_put_pixel(top_left.x, y, color, fb);
+		// 255 - alpha in every channel of its pixel
+		s_lo = _mm256_shufflelo_epi16(s_lo, 0xFF);
+		s_hi = _mm256_shufflelo_epi16(s_hi, 0xFF);
+		s_lo = _mm256_shufflehi_epi16(s_lo, 0xFF);
+		s_hi = _mm256_shufflehi_epi16(s_hi, 0xFF);
+		__m256i d_lo = _mm256_unpacklo_epi8(d, zero);
+		__m256i d_hi = _mm256_unpackhi_epi8(d, zero);
+		d_lo = _mm256_mullo_epi16(d_lo, _mm256_sub_epi16(full, s_lo));
+		d_hi = _mm256_mullo_epi16(d_hi, _mm256_sub_epi16(full, s_hi));
+		d_lo = i_fbgl_div255_avx2(d_lo);
+		d_hi = i_fbgl_div255_avx2(d_hi);
+		s = _mm256_adds_epu8(s, _mm256_packus_epi16(d_lo, d_hi));
+		_mm256_storeu_si256((__m256i *)(dst + i), s);
 	}
+	// The sibling call into SSE2 code skips the implicit vzeroupper
+	_mm256_zeroupper();
+	i_fbgl_blend_sse2(dst + i, src + i, count - i, opacity);
+}
+#endif // FBGL_SIMD_X86
 
-	// Right vertical line
-	for (int y = top_left.y; y < bottom_right.y; y++) {
-		fbgl_put_pixel(bottom_right.x - 1, y, color, fb);
-	}
+#ifdef FBGL_SIMD_NEON
+FBGL_INLINE uint8x8_t i_fbgl_div255_neon(uint16x8_t x)
+{
+	return vraddhn_u16(x, vrshrq_n_u16(x, 8));
 }
 
-void fbgl_draw_rectangle_filled(fbgl_point_t top_left,
-				fbgl_point_t bottom_right, uint32_t color,
-				fbgl_t *fb)
+// Eight pixels at a time, split into B, G, R and A planes by vld4
+static void i_fbgl_blend_neon(uint32_t *dst, const uint32_t *src,
+			      int32_t count, uint32_t opacity)
 {
-	for (int32_t y = top_left.y; y < bottom_right.y; y++) {
-		// Manually set each pixel in the row
-		for (int32_t x = top_left.x; x < bottom_right.x; x++) {
-			fbgl_put_pixel(x, y, color, fb);
+	const uint8x8_t k = vdup_n_u8((uint8_t)opacity);
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		uint8x8x4_t s = vld4_u8((const uint8_t *)(src + i));
+		uint8x8x4_t d = vld4_u8((const uint8_t *)(dst + i));
+		if (opacity != 255) {
+			for (int c = 0; c < 4; c++) {
+				const uint16x8_t t = vmull_u8(s.val[c], k);
+				s.val[c] = i_fbgl_div255_neon(t);
+			}
 		}
+		const uint8x8_t inv = vmvn_u8(s.val[3]);
+		for (int c = 0; c < 4; c++) {
+			d.val[c] = vqadd_u8(
+				s.val[c],
+				i_fbgl_div255_neon(vmull_u8(d.val[c], inv)));
+		}
+		vst4_u8((uint8_t *)(dst + i), d);
 	}
+	i_fbgl_blend_scalar(dst + i, src + i, count - i, opacity);
 }
+#endif // FBGL_SIMD_NEON
 
-void fbgl_draw_circle_outline(int x, int y, int radius, uint32_t color,
-			      fbgl_t *fb)
+/**
+ * Sampling kernels
+ *
+ * Produce one row of a scaled texture from precomputed source columns:
+ * ix0/ix1 are the left and right texel of each column and wx its 8-bit
+ * horizontal weight, stored twice as f | f << 16. A bilinear sample is
+ * lerp(a, b, f) = (a * (256 - f) + b * f) >> 8 per channel, first along
+ * each source row, then between the rows with fy. The sum stays below
+ * 65536, so vector kernels work in 16-bit lanes and match the scalar one.
+ */
+typedef void (*i_fbgl_nearest_fn)(uint32_t *dst, const uint32_t *row,
+				  const int32_t *ix, int32_t count);
+typedef void (*i_fbgl_bilinear_fn)(uint32_t *dst, const uint32_t *row0,
+				   const uint32_t *row1, const int32_t *ix0,
+				   const int32_t *ix1, const uint32_t *wx,
+				   uint32_t fy, int32_t count);
+
+static void i_fbgl_nearest_scalar(uint32_t *dst, const uint32_t *row,
+				  const int32_t *ix, int32_t count)
 {
-	int f = 1 - radius;
-	int ddF_x = 1;
-	int ddF_y = -2 * radius;
-	int xx = 0;
-	int yy = radius;
+	for (int32_t i = 0; i < count; i++) {
+		dst[i] = row[ix[i]];
+	}
+}
 
-	fbgl_put_pixel(x, y + radius, color, fb);
-	fbgl_put_pixel(x, y - radius, color, fb);
-	fbgl_put_pixel(x + radius, y, color, fb);
-	fbgl_put_pixel(x - radius, y, color, fb);
+// Lerp two channels held as 0x00XX00YY
+FBGL_INLINE uint32_t i_fbgl_lerp_lanes(uint32_t a, uint32_t b, uint32_t f)
+{
+	return ((a * (256 - f) + b * f) >> 8) & 0x00FF00FF;
+}
 
-	while (xx < yy) {
-		if (f >= 0) {
-			yy--;
-			ddF_y += 2;
-			f += ddF_y;
-		}
-		xx++;
-		ddF_x += 2;
-		f += ddF_x;
+FBGL_INLINE uint32_t i_fbgl_lerp_argb(uint32_t a, uint32_t b, uint32_t f)
+{
+	return i_fbgl_lerp_lanes(a & 0x00FF00FF, b & 0x00FF00FF, f) |
+	       i_fbgl_lerp_lanes((a >> 8) & 0x00FF00FF, (b >> 8) & 0x00FF00FF,
+				 f)
+		       << 8;
+}
 
-		fbgl_put_pixel(x + xx, y + yy, color, fb);
-		fbgl_put_pixel(x - xx, y + yy, color, fb);
-		fbgl_put_pixel(x + xx, y - yy, color, fb);
-		fbgl_put_pixel(x - xx, y - yy, color, fb);
-		fbgl_put_pixel(x + yy, y + xx, color, fb);
-		fbgl_put_pixel(x - yy, y + xx, color, fb);
-		fbgl_put_pixel(x + yy, y - xx, color, fb);
-		fbgl_put_pixel(x - yy, y - xx, color, fb);
+static void i_fbgl_bilinear_scalar(uint32_t *dst, const uint32_t *row0,
+				   const uint32_t *row1, const int32_t *ix0,
+				   const int32_t *ix1, const uint32_t *wx,
+				   uint32_t fy, int32_t count)
+{
+	for (int32_t i = 0; i < count; i++) {
+		const uint32_t fx = wx[i] & 0xFF;
+		const uint32_t top =
+			i_fbgl_lerp_argb(row0[ix0[i]], row0[ix1[i]], fx);
+		const uint32_t bottom =
+			i_fbgl_lerp_argb(row1[ix0[i]], row1[ix1[i]], fx);
+		dst[i] = i_fbgl_lerp_argb(top, bottom, fy);
 	}
 }
 
-void fbgl_draw_circle_filled(int x, int y, int radius, uint32_t color,
-			     fbgl_t *fb)
+#ifdef FBGL_SIMD_X86
+__attribute__((target("sse2"))) static inline __m128i
+i_fbgl_lerp_sse2(__m128i a, __m128i b, __m128i f)
 {
-	for (int yy = -radius; yy <= radius; ++yy) {
-		int half_width =
-			(int)i_fbgl_sqrt_int(radius * radius - yy * yy);
-
-		int row_start = x - half_width;
-		int row_end = x + half_width;
+	const __m128i g = _mm_sub_epi16(_mm_set1_epi16(256), f);
+	return _mm_srli_epi16(
+		_mm_add_epi16(_mm_mullo_epi16(a, g), _mm_mullo_epi16(b, f)), 8);
+}
 
-		if (y + yy < 0 || y + yy >= fb->height)
-			continue;
-		if (row_start < 0)
-			row_start = 0;
-		if (row_end >= fb->width)
-			row_end = fb->width - 1;
+// Lerp four pixel pairs, f holds each pixel's weight as f | f << 16
+__attribute__((target("sse2"))) static inline __m128i
+i_fbgl_lerp4_sse2(__m128i a, __m128i b, __m128i f)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo = i_fbgl_lerp_sse2(_mm_unpacklo_epi8(a, zero),
+					    _mm_unpacklo_epi8(b, zero),
+					    _mm_unpacklo_epi32(f, f));
+	const __m128i hi = i_fbgl_lerp_sse2(_mm_unpackhi_epi8(a, zero),
+					    _mm_unpackhi_epi8(b, zero),
+					    _mm_unpackhi_epi32(f, f));
+	return _mm_packus_epi16(lo, hi);
+}
 
-		int pixel_offset = (y + yy) * fb->width + row_start;
-		int num_pixels = row_end - row_start + 1;
+__attribute__((target("sse2"))) static inline __m128i
+i_fbgl_gather4_sse2(const uint32_t *row, const int32_t *ix)
+{
+	return _mm_set_epi32((int)row[ix[3]], (int)row[ix[2]], (int)row[ix[1]],
+			     (int)row[ix[0]]);
+}
 
-		uint32_t *row_start_ptr = fb->pixels + pixel_offset;
-		for (int i = 0; i < num_pixels; ++i) {
-			row_start_ptr[i] = color;
-		}
+__attribute__((target("sse2"))) static void
+i_fbgl_bilinear_sse2(uint32_t *dst, const uint32_t *row0, const uint32_t *row1,
+		     const int32_t *ix0, const int32_t *ix1, const uint32_t *wx,
+		     uint32_t fy, int32_t count)
+{
+	const __m128i wy = _mm_set1_epi32((int)(fy | fy << 16));
+	int32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128i a = i_fbgl_gather4_sse2(row0, ix0 + i);
+		const __m128i b = i_fbgl_gather4_sse2(row0, ix1 + i);
+		const __m128i c = i_fbgl_gather4_sse2(row1, ix0 + i);
+		const __m128i d = i_fbgl_gather4_sse2(row1, ix1 + i);
+		const __m128i fx = _mm_loadu_si128((const __m128i *)(wx + i));
+		const __m128i top = i_fbgl_lerp4_sse2(a, b, fx);
+		const __m128i bottom = i_fbgl_lerp4_sse2(c, d, fx);
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 i_fbgl_lerp4_sse2(top, bottom, wy));
 	}
+	i_fbgl_bilinear_scalar(dst + i, row0, row1, ix0 + i, ix1 + i, wx + i,
+			       fy, count - i);
 }
 
-fbgl_tga_texture_t *fbgl_load_tga_texture(const char *path)
+__attribute__((target("avx2"))) static void
+i_fbgl_nearest_avx2(uint32_t *dst, const uint32_t *row, const int32_t *ix,
+		    int32_t count)
 {
-	FILE *file = fopen(path, "rb");
-	if (!file) {
-		perror("Unable to open texture file");
-		return NULL;
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i index =
+			_mm256_loadu_si256((const __m256i *)(ix + i));
+		_mm256_storeu_si256(
+			(__m256i *)(dst + i),
+			_mm256_i32gather_epi32((const int *)row, index, 4));
 	}
+	_mm256_zeroupper();
+	i_fbgl_nearest_scalar(dst + i, row, ix + i, count - i);
+}
 
-	// TGA header structure
-	uint8_t header[18];
-	if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
-		perror("Error reading TGA header");
-		fclose(file);
-		return NULL;
-	}
+__attribute__((target("avx2"))) static inline __m256i
+i_fbgl_lerp_avx2(__m256i a, __m256i b, __m256i f)
+{
+	const __m256i g = _mm256_sub_epi16(_mm256_set1_epi16(256), f);
+	return _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(a, g),
+						  _mm256_mullo_epi16(b, f)),
+				 8);
+}
 
-	// Allocate texture structure
-	fbgl_tga_texture_t *texture =
-		(fbgl_tga_texture_t *)malloc(sizeof(fbgl_tga_texture_t));
-	if (!texture) {
-		perror("Failed to allocate texture structure");
-		fclose(file);
-		return NULL;
+__attribute__((target("avx2"))) static inline __m256i
+i_fbgl_lerp8_avx2(__m256i a, __m256i b, __m256i f)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i lo = i_fbgl_lerp_avx2(_mm256_unpacklo_epi8(a, zero),
+					    _mm256_unpacklo_epi8(b, zero),
+					    _mm256_unpacklo_epi32(f, f));
+	const __m256i hi = i_fbgl_lerp_avx2(_mm256_unpackhi_epi8(a, zero),
+					    _mm256_unpackhi_epi8(b, zero),
+					    _mm256_unpackhi_epi32(f, f));
+	return _mm256_packus_epi16(lo, hi);
+}
+
+__attribute__((target("avx2"))) static void
+i_fbgl_bilinear_avx2(uint32_t *dst, const uint32_t *row0, const uint32_t *row1,
+		     const int32_t *ix0, const int32_t *ix1, const uint32_t *wx,
+		     uint32_t fy, int32_t count)
+{
+	const __m256i wy = _mm256_set1_epi32((int)(fy | fy << 16));
+	const int *top_row = (const int *)row0;
+	const int *bottom_row = (const int *)row1;
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i l =
+			_mm256_loadu_si256((const __m256i *)(ix0 + i));
+		const __m256i r =
+			_mm256_loadu_si256((const __m256i *)(ix1 + i));
+		const __m256i a = _mm256_i32gather_epi32(top_row, l, 4);
+		const __m256i b = _mm256_i32gather_epi32(top_row, r, 4);
+		const __m256i c = _mm256_i32gather_epi32(bottom_row, l, 4);
+		const __m256i d = _mm256_i32gather_epi32(bottom_row, r, 4);
+		const __m256i fx =
+			_mm256_loadu_si256((const __m256i *)(wx + i));
+		const __m256i top = i_fbgl_lerp8_avx2(a, b, fx);
+		const __m256i bottom = i_fbgl_lerp8_avx2(c, d, fx);
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    i_fbgl_lerp8_avx2(top, bottom, wy));
 	}
+	_mm256_zeroupper();
+	i_fbgl_bilinear_scalar(dst + i, row0, row1, ix0 + i, ix1 + i, wx + i,
+			       fy, count - i);
+}
+#endif // FBGL_SIMD_X86
 
-	// Extract dimensions from header
-	texture->width = header[12] | (header[13] << 8);
-	texture->height = header[14] | (header[15] << 8);
-	uint8_t bits_per_pixel = header[16];
-	uint8_t image_descriptor = header[17];
+#ifdef FBGL_SIMD_NEON
+// a * (256 - f) + b * f, as a * 256 - a * f + b * f in wrapping u16
+FBGL_INLINE uint8x8_t i_fbgl_lerp_neon(uint8x8_t a, uint8x8_t b, uint8x8_t f)
+{
+	uint16x8_t t = vshll_n_u8(a, 8);
+	t = vmlsl_u8(t, a, f);
+	t = vmlal_u8(t, b, f);
+	return vshrn_n_u16(t, 8);
+}
 
-	// Verify format support
-	if (bits_per_pixel != 24 && bits_per_pixel != 32) {
-		fprintf(stderr,
-			"Unsupported TGA bit depth: %d (only 24 and 32-bit supported)\n",
-			bits_per_pixel);
-		free(texture);
-		fclose(file);
-		return NULL;
+// Eight samples at a time: gather, then lerp the B, G, R and A planes
+static void i_fbgl_bilinear_neon(uint32_t *dst, const uint32_t *row0,
+				 const uint32_t *row1, const int32_t *ix0,
+				 const int32_t *ix1, const uint32_t *wx,
+				 uint32_t fy, int32_t count)
+{
+	const uint8x8_t wy = vdup_n_u8((uint8_t)fy);
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		uint32_t texels[4][8];
+		for (int32_t k = 0; k < 8; k++) {
+			texels[0][k] = row0[ix0[i + k]];
+			texels[1][k] = row0[ix1[i + k]];
+			texels[2][k] = row1[ix0[i + k]];
+			texels[3][k] = row1[ix1[i + k]];
+		}
+		const uint8x8x4_t tl = vld4_u8((const uint8_t *)texels[0]);
+		const uint8x8x4_t tr = vld4_u8((const uint8_t *)texels[1]);
+		const uint8x8x4_t bl = vld4_u8((const uint8_t *)texels[2]);
+		const uint8x8x4_t br = vld4_u8((const uint8_t *)texels[3]);
+		const uint16x4_t w0 = vmovn_u32(vld1q_u32(wx + i));
+		const uint16x4_t w1 = vmovn_u32(vld1q_u32(wx + i + 4));
+		const uint8x8_t fx = vmovn_u16(vcombine_u16(w0, w1));
+		uint8x8x4_t out;
+		for (int c = 0; c < 4; c++) {
+			const uint8x8_t top =
+				i_fbgl_lerp_neon(tl.val[c], tr.val[c], fx);
+			const uint8x8_t bottom =
+				i_fbgl_lerp_neon(bl.val[c], br.val[c], fx);
+			out.val[c] = i_fbgl_lerp_neon(top, bottom, wy);
+		}
+		vst4_u8((uint8_t *)(dst + i), out);
 	}
+	i_fbgl_bilinear_scalar(dst + i, row0, row1, ix0 + i, ix1 + i, wx + i,
+			       fy, count - i);
+}
+#endif // FBGL_SIMD_NEON
+
+/**
+ * Affine kernels
+ *
+ * Walk a span of texels from 16.16 position (u, v) in steps of (du, dv).
+ * The caller has limited the span to the texture, so every position fits
+ * in 32 bits and wrapping adds land on the right value.
+ */
+typedef void (*i_fbgl_affine_fn)(uint32_t *dst, const uint32_t *data,
+				 uint32_t width, uint32_t u, uint32_t v,
+				 uint32_t du, uint32_t dv, int32_t count);
 
-	// Skip image ID field
-	if (header[0]) {
-		fseek(file, header[0], SEEK_CUR);
+static void i_fbgl_affine_scalar(uint32_t *dst, const uint32_t *data,
+				 uint32_t width, uint32_t u, uint32_t v,
+				 uint32_t du, uint32_t dv, int32_t count)
+{
+	for (int32_t i = 0; i < count; i++) {
+		dst[i] = data[(size_t)(v >> 16) * width + (u >> 16)];
+		u += du;
+		v += dv;
 	}
+}
 
-	// Allocate pixel data
-	size_t pixel_count = texture->width * texture->height;
-	texture->data = (uint32_t *)malloc(pixel_count * sizeof(uint32_t));
+#ifdef FBGL_SIMD_X86
+// Gather indices are signed, textures must stay below 2^31 texels
+__attribute__((target("avx2"))) static void
+i_fbgl_affine_avx2(uint32_t *dst, const uint32_t *data, uint32_t width,
+		   uint32_t u, uint32_t v, uint32_t du, uint32_t dv,
+		   int32_t count)
+{
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i w = _mm256_set1_epi32((int)width);
+	const __m256i du8 = _mm256_set1_epi32((int)(du * 8));
+	const __m256i dv8 = _mm256_set1_epi32((int)(dv * 8));
+	__m256i uu = _mm256_add_epi32(
+		_mm256_set1_epi32((int)u),
+		_mm256_mullo_epi32(lane, _mm256_set1_epi32((int)du)));
+	__m256i vv = _mm256_add_epi32(
+		_mm256_set1_epi32((int)v),
+		_mm256_mullo_epi32(lane, _mm256_set1_epi32((int)dv)));
+
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i row =
+			_mm256_mullo_epi32(_mm256_srli_epi32(vv, 16), w);
+		const __m256i index =
+			_mm256_add_epi32(row, _mm256_srli_epi32(uu, 16));
+		_mm256_storeu_si256(
+			(__m256i *)(dst + i),
+			_mm256_i32gather_epi32((const int *)data, index, 4));
+		uu = _mm256_add_epi32(uu, du8);
+		vv = _mm256_add_epi32(vv, dv8);
+	}
+	_mm256_zeroupper();
+	i_fbgl_affine_scalar(dst + i, data, width, u + (uint32_t)i * du,
+			     v + (uint32_t)i * dv, du, dv, count - i);
+}
+#endif // FBGL_SIMD_X86
+
+/**
+ * Conversion kernels
+ *
+ * Turn one row of TGA pixels into premultiplied ARGB8888. TGA stores
+ * B, G, R(, A) bytes, which is ARGB8888 in little-endian memory once the
+ * alpha byte is in place: 24-bit rows only need a byte shuffle, 32-bit
+ * rows only the premultiply, rounded like fbgl_premultiply().
+ */
+typedef void (*i_fbgl_convert_fn)(uint32_t *dst, const uint8_t *src,
+				  int32_t count);
+
+static void i_fbgl_gray_scalar(uint32_t *dst, const uint8_t *src,
+			       int32_t count)
+{
+	for (int32_t i = 0; i < count; i++) {
+		dst[i] = 0xFF000000 | src[i] * 0x010101u;
+	}
+}
+
+static void i_fbgl_bgr_scalar(uint32_t *dst, const uint8_t *src,
+			      int32_t count)
+{
+	for (int32_t i = 0; i < count; i++, src += 3) {
+		dst[i] = 0xFF000000 | (uint32_t)src[2] << 16 |
+			 (uint32_t)src[1] << 8 | src[0];
+	}
+}
+
+static void i_fbgl_bgra_scalar(uint32_t *dst, const uint8_t *src,
+			       int32_t count)
+{
+	for (int32_t i = 0; i < count; i++, src += 4) {
+		const uint32_t argb = (uint32_t)src[3] << 24 |
+				      (uint32_t)src[2] << 16 |
+				      (uint32_t)src[1] << 8 | src[0];
+		dst[i] = (argb & 0xFF000000) |
+			 (i_fbgl_scale_argb(argb, src[3]) & 0x00FFFFFF);
+	}
+}
+
+#ifdef FBGL_SIMD_X86
+// Sixteen pixels from three loads, spread to four lanes each by pshufb
+__attribute__((target("ssse3"))) static void
+i_fbgl_bgr_ssse3(uint32_t *dst, const uint8_t *src, int32_t count)
+{
+	const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7,
+					     8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	int32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const uint8_t *s = src + (size_t)i * 3;
+		const __m128i a = _mm_loadu_si128((const __m128i *)s);
+		const __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+		const __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+		const __m128i p0 = a;
+		const __m128i p1 = _mm_alignr_epi8(b, a, 12);
+		const __m128i p2 = _mm_alignr_epi8(c, b, 8);
+		const __m128i p3 = _mm_srli_si128(c, 4);
+		__m128i *d = (__m128i *)(dst + i);
+		_mm_storeu_si128(d, _mm_or_si128(_mm_shuffle_epi8(p0, spread),
+						 alpha));
+		_mm_storeu_si128(d + 1, _mm_or_si128(_mm_shuffle_epi8(p1,
+								       spread),
+						     alpha));
+		_mm_storeu_si128(d + 2, _mm_or_si128(_mm_shuffle_epi8(p2,
+								       spread),
+						     alpha));
+		_mm_storeu_si128(d + 3, _mm_or_si128(_mm_shuffle_epi8(p3,
+								       spread),
+						     alpha));
+	}
+	i_fbgl_bgr_scalar(dst + i, src + (size_t)i * 3, count - i);
+}
+
+__attribute__((target("sse2"))) static void
+i_fbgl_bgra_sse2(uint32_t *dst, const uint8_t *src, int32_t count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	int32_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128i s =
+			_mm_loadu_si128((const __m128i *)(src + (size_t)i * 4));
+		__m128i lo = _mm_unpacklo_epi8(s, zero);
+		__m128i hi = _mm_unpackhi_epi8(s, zero);
+		const __m128i a_lo = _mm_shufflehi_epi16(
+			_mm_shufflelo_epi16(lo, 0xFF), 0xFF);
+		const __m128i a_hi = _mm_shufflehi_epi16(
+			_mm_shufflelo_epi16(hi, 0xFF), 0xFF);
+		lo = i_fbgl_div255_sse2(_mm_mullo_epi16(lo, a_lo));
+		hi = i_fbgl_div255_sse2(_mm_mullo_epi16(hi, a_hi));
+		const __m128i rgb = _mm_andnot_si128(alpha,
+						     _mm_packus_epi16(lo, hi));
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_or_si128(rgb, _mm_and_si128(s, alpha)));
+	}
+	i_fbgl_bgra_scalar(dst + i, src + (size_t)i * 4, count - i);
+}
+
+__attribute__((target("avx2"))) static void
+i_fbgl_bgra_avx2(uint32_t *dst, const uint8_t *src, int32_t count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i s = _mm256_loadu_si256(
+			(const __m256i *)(src + (size_t)i * 4));
+		__m256i lo = _mm256_unpacklo_epi8(s, zero);
+		__m256i hi = _mm256_unpackhi_epi8(s, zero);
+		const __m256i a_lo = _mm256_shufflehi_epi16(
+			_mm256_shufflelo_epi16(lo, 0xFF), 0xFF);
+		const __m256i a_hi = _mm256_shufflehi_epi16(
+			_mm256_shufflelo_epi16(hi, 0xFF), 0xFF);
+		lo = i_fbgl_div255_avx2(_mm256_mullo_epi16(lo, a_lo));
+		hi = i_fbgl_div255_avx2(_mm256_mullo_epi16(hi, a_hi));
+		const __m256i rgb = _mm256_andnot_si256(
+			alpha, _mm256_packus_epi16(lo, hi));
+		_mm256_storeu_si256(
+			(__m256i *)(dst + i),
+			_mm256_or_si256(rgb, _mm256_and_si256(s, alpha)));
+	}
+	_mm256_zeroupper();
+	i_fbgl_bgra_sse2(dst + i, src + (size_t)i * 4, count - i);
+}
+#endif // FBGL_SIMD_X86
+
+#ifdef FBGL_SIMD_NEON
+// vld3 splits B, G and R into planes, vst4 interleaves them with alpha
+static void i_fbgl_bgr_neon(uint32_t *dst, const uint8_t *src,
+			    int32_t count)
+{
+	int32_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const uint8x16x3_t s = vld3q_u8(src + (size_t)i * 3);
+		const uint8x16x4_t d = { { s.val[0], s.val[1], s.val[2],
+					   vdupq_n_u8(0xFF) } };
+		vst4q_u8((uint8_t *)(dst + i), d);
+	}
+	i_fbgl_bgr_scalar(dst + i, src + (size_t)i * 3, count - i);
+}
+
+static void i_fbgl_bgra_neon(uint32_t *dst, const uint8_t *src,
+			     int32_t count)
+{
+	int32_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		uint8x8x4_t s = vld4_u8(src + (size_t)i * 4);
+		for (int c = 0; c < 3; c++) {
+			s.val[c] = i_fbgl_div255_neon(
+				vmull_u8(s.val[c], s.val[3]));
+		}
+		vst4_u8((uint8_t *)(dst + i), s);
+	}
+	i_fbgl_bgra_scalar(dst + i, src + (size_t)i * 4, count - i);
+}
+#endif // FBGL_SIMD_NEON
+
+/**
+ * Glyph kernels
+ *
+ * Draw one row of a 1-bit glyph in columns [col0, col1), dst pointing at
+ * column col0. Bits are taken eight columns at a time and each group
+ * indexes i_fbgl_glyph_masks, which expands it to eight all-ones or zero
+ * pixel lanes. Vector kernels select between the color and the pixels
+ * already there, and never store outside [col0, col1).
+ */
+typedef void (*i_fbgl_glyph_fn)(uint8_t *dst, const uint8_t *bits,
+				int32_t col0, int32_t col1, uint32_t native);
+
+static uint32_t i_fbgl_glyph_masks[256][8] __attribute__((aligned(32)));
+
+static void i_fbgl_glyph_masks_init(void)
+{
+	for (int32_t byte = 0; byte < 256; byte++) {
+		for (int32_t lane = 0; lane < 8; lane++) {
+			i_fbgl_glyph_masks[byte][lane] =
+				byte & (0x80 >> lane) ? 0xFFFFFFFF : 0;
+		}
+	}
+}
+
+// Bits of columns [col, col + 8), most significant first, none past col1
+FBGL_INLINE uint32_t i_fbgl_glyph_byte(const uint8_t *bits, int32_t col,
+				       int32_t col1)
+{
+	const int32_t shift = col & 7;
+	uint32_t byte = (uint32_t)bits[col >> 3] << shift;
+	if (shift && col + 8 - shift < col1) {
+		byte |= bits[(col >> 3) + 1] >> (8 - shift);
+	}
+	const int32_t n = col1 - col;
+	return byte & (n < 8 ? 0xFF00u >> n : 0xFFFFu) & 0xFF;
+}
+
+FBGL_INLINE void i_fbgl_glyph_bits(uint8_t *dst, const uint8_t *bits,
+				   int32_t col0, int32_t col1,
+				   uint32_t native, const int bpp)
+{
+	for (int32_t col = col0; col < col1; col += 8, dst += 8 * bpp) {
+		uint32_t byte = i_fbgl_glyph_byte(bits, col, col1);
+		while (byte) {
+			const int32_t lane = __builtin_clz(byte) - 24;
+			i_fbgl_store(dst + lane * bpp, native, bpp);
+			byte &= ~(0x80u >> lane);
+		}
+	}
+}
+
+static void i_fbgl_glyph32_scalar(uint8_t *dst, const uint8_t *bits,
+				  int32_t col0, int32_t col1, uint32_t native)
+{
+	i_fbgl_glyph_bits(dst, bits, col0, col1, native, 4);
+}
+
+static void i_fbgl_glyph16_scalar(uint8_t *dst, const uint8_t *bits,
+				  int32_t col0, int32_t col1, uint32_t native)
+{
+	i_fbgl_glyph_bits(dst, bits, col0, col1, native, 2);
+}
+
+#ifdef FBGL_SIMD_X86
+// Full groups select with a load and store, the clipped tail is scalar
+__attribute__((target("sse2"))) static void
+i_fbgl_glyph32_sse2(uint8_t *dst, const uint8_t *bits, int32_t col0,
+		    int32_t col1, uint32_t native)
+{
+	const __m128i color = _mm_set1_epi32((int)native);
+	int32_t col = col0;
+	for (; col + 8 <= col1; col += 8, dst += 32) {
+		const uint32_t byte = i_fbgl_glyph_byte(bits, col, col1);
+		if (!byte) {
+			continue;
+		}
+		const __m128i *m = (const __m128i *)i_fbgl_glyph_masks[byte];
+		for (int32_t half = 0; half < 2; half++) {
+			__m128i *p = (__m128i *)dst + half;
+			const __m128i mask = _mm_load_si128(m + half);
+			const __m128i old =
+				_mm_andnot_si128(mask, _mm_loadu_si128(p));
+			_mm_storeu_si128(p, _mm_or_si128(
+						    _mm_and_si128(mask, color),
+						    old));
+		}
+	}
+	i_fbgl_glyph_bits(dst, bits, col, col1, native, 4);
+}
+
+__attribute__((target("sse2"))) static void
+i_fbgl_glyph16_sse2(uint8_t *dst, const uint8_t *bits, int32_t col0,
+		    int32_t col1, uint32_t native)
+{
+	const __m128i color = _mm_set1_epi16((short)native);
+	int32_t col = col0;
+	for (; col + 8 <= col1; col += 8, dst += 16) {
+		const uint32_t byte = i_fbgl_glyph_byte(bits, col, col1);
+		if (!byte) {
+			continue;
+		}
+		const __m128i *m = (const __m128i *)i_fbgl_glyph_masks[byte];
+		const __m128i mask = _mm_packs_epi32(_mm_load_si128(m),
+						     _mm_load_si128(m + 1));
+		__m128i *p = (__m128i *)dst;
+		const __m128i old = _mm_andnot_si128(mask, _mm_loadu_si128(p));
+		_mm_storeu_si128(p,
+				 _mm_or_si128(_mm_and_si128(mask, color), old));
+	}
+	i_fbgl_glyph_bits(dst, bits, col, col1, native, 2);
+}
+
+// Masked stores only write the set lanes, clipped groups included
+__attribute__((target("avx2"))) static void
+i_fbgl_glyph32_avx2(uint8_t *dst, const uint8_t *bits, int32_t col0,
+		    int32_t col1, uint32_t native)
+{
+	const __m256i color = _mm256_set1_epi32((int)native);
+	for (int32_t col = col0; col < col1; col += 8, dst += 32) {
+		const uint32_t byte = i_fbgl_glyph_byte(bits, col, col1);
+		if (byte) {
+			const __m256i mask = _mm256_load_si256(
+				(const __m256i *)i_fbgl_glyph_masks[byte]);
+			_mm256_maskstore_epi32((int *)dst, mask, color);
+		}
+	}
+	_mm256_zeroupper();
+}
+#endif // FBGL_SIMD_X86
+
+#ifdef FBGL_SIMD_NEON
+static void i_fbgl_glyph32_neon(uint8_t *dst, const uint8_t *bits,
+				int32_t col0, int32_t col1, uint32_t native)
+{
+	const uint32x4_t color = vdupq_n_u32(native);
+	int32_t col = col0;
+	for (; col + 8 <= col1; col += 8, dst += 32) {
+		const uint32_t byte = i_fbgl_glyph_byte(bits, col, col1);
+		if (!byte) {
+			continue;
+		}
+		for (int32_t half = 0; half < 2; half++) {
+			uint32_t *p = (uint32_t *)dst + half * 4;
+			const uint32x4_t mask =
+				vld1q_u32(i_fbgl_glyph_masks[byte] + half * 4);
+			vst1q_u32(p, vbslq_u32(mask, color, vld1q_u32(p)));
+		}
+	}
+	i_fbgl_glyph_bits(dst, bits, col, col1, native, 4);
+}
+
+static void i_fbgl_glyph16_neon(uint8_t *dst, const uint8_t *bits,
+				int32_t col0, int32_t col1, uint32_t native)
+{
+	const uint16x8_t color = vdupq_n_u16((uint16_t)native);
+	int32_t col = col0;
+	for (; col + 8 <= col1; col += 8, dst += 16) {
+		const uint32_t byte = i_fbgl_glyph_byte(bits, col, col1);
+		if (!byte) {
+			continue;
+		}
+		const uint32_t *m = i_fbgl_glyph_masks[byte];
+		const uint16x4_t lo = vmovn_u32(vld1q_u32(m));
+		const uint16x4_t hi = vmovn_u32(vld1q_u32(m + 4));
+		const uint16x8_t mask = vcombine_u16(lo, hi);
+		uint16_t *p = (uint16_t *)dst;
+		vst1q_u16(p, vbslq_u16(mask, color, vld1q_u16(p)));
+	}
+	i_fbgl_glyph_bits(dst, bits, col, col1, native, 2);
+}
+#endif // FBGL_SIMD_NEON
+
+static i_fbgl_convert_fn i_fbgl_convert_bgr = i_fbgl_bgr_scalar;
+static i_fbgl_convert_fn i_fbgl_convert_bgra = i_fbgl_bgra_scalar;
+static i_fbgl_glyph_fn i_fbgl_glyph32 = i_fbgl_glyph32_scalar;
+static i_fbgl_glyph_fn i_fbgl_glyph16 = i_fbgl_glyph16_scalar;
+
+static i_fbgl_affine_fn i_fbgl_affine = i_fbgl_affine_scalar;
+static i_fbgl_nearest_fn i_fbgl_nearest = i_fbgl_nearest_scalar;
+static i_fbgl_bilinear_fn i_fbgl_bilinear = i_fbgl_bilinear_scalar;
+static i_fbgl_blend_fn i_fbgl_blend = i_fbgl_blend_scalar;
+
+static i_fbgl_wide_fill_fn i_fbgl_wide_fill = i_fbgl_wide_fill_scalar;
+static const char *i_fbgl_simd_name = "scalar";
+
+static void i_fbgl_select_kernels(void)
+{
+	i_fbgl_glyph_masks_init();
+
+#ifdef FBGL_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		i_fbgl_wide_fill = i_fbgl_wide_fill_avx2;
+		i_fbgl_wide_stream = i_fbgl_wide_stream_avx2;
+		i_fbgl_stream_copy = i_fbgl_stream_copy_avx2;
+		i_fbgl_blend = i_fbgl_blend_avx2;
+		i_fbgl_nearest = i_fbgl_nearest_avx2;
+		i_fbgl_bilinear = i_fbgl_bilinear_avx2;
+		i_fbgl_affine = i_fbgl_affine_avx2;
+		i_fbgl_convert_bgra = i_fbgl_bgra_avx2;
+		i_fbgl_glyph32 = i_fbgl_glyph32_avx2;
+		i_fbgl_glyph16 = i_fbgl_glyph16_sse2;
+		i_fbgl_simd_name = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		i_fbgl_wide_fill = i_fbgl_wide_fill_sse2;
+		i_fbgl_wide_stream = i_fbgl_wide_stream_sse2;
+		i_fbgl_stream_copy = i_fbgl_stream_copy_sse2;
+		i_fbgl_blend = i_fbgl_blend_sse2;
+		i_fbgl_bilinear = i_fbgl_bilinear_sse2;
+		i_fbgl_convert_bgra = i_fbgl_bgra_sse2;
+		i_fbgl_glyph32 = i_fbgl_glyph32_sse2;
+		i_fbgl_glyph16 = i_fbgl_glyph16_sse2;
+		i_fbgl_simd_name = "sse2";
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		i_fbgl_convert_bgr = i_fbgl_bgr_ssse3;
+	}
+#endif // FBGL_SIMD_X86
+
+#ifdef FBGL_SIMD_NEON
+#if defined(__aarch64__)
+	i_fbgl_wide_fill = i_fbgl_wide_fill_neon;
+	i_fbgl_wide_stream = i_fbgl_wide_fill_neon;
+	i_fbgl_blend = i_fbgl_blend_neon;
+	i_fbgl_bilinear = i_fbgl_bilinear_neon;
+	i_fbgl_convert_bgr = i_fbgl_bgr_neon;
+	i_fbgl_convert_bgra = i_fbgl_bgra_neon;
+	i_fbgl_glyph32 = i_fbgl_glyph32_neon;
+	i_fbgl_glyph16 = i_fbgl_glyph16_neon;
+	i_fbgl_simd_name = "neon";
+#else
+	if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+		i_fbgl_wide_fill = i_fbgl_wide_fill_neon;
+		i_fbgl_wide_stream = i_fbgl_wide_fill_neon;
+		i_fbgl_blend = i_fbgl_blend_neon;
+		i_fbgl_bilinear = i_fbgl_bilinear_neon;
+		i_fbgl_convert_bgr = i_fbgl_bgr_neon;
+		i_fbgl_convert_bgra = i_fbgl_bgra_neon;
+		i_fbgl_glyph32 = i_fbgl_glyph32_neon;
+		i_fbgl_glyph16 = i_fbgl_glyph16_neon;
+		i_fbgl_simd_name = "neon";
+	}
+#endif
+#endif // FBGL_SIMD_NEON
+}
+
+// Fill the mask table and pick kernels once. Threads loading assets can
+// get here together, so none may see the choice before it is complete.
+static void i_fbgl_select_simd(void)
+{
+#ifdef FBGL_THREADS
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, i_fbgl_select_kernels);
+#else
+	static bool selected = false;
+	if (!selected) {
+		i_fbgl_select_kernels();
+		selected = true;
+	}
+#endif
+}
+
+FBGL_INLINE void i_fbgl_fill_generic(uint8_t *dst, uint32_t native,
+				     int32_t count, const int bpp,
+				     i_fbgl_wide_fill_fn wide)
+{
+	if (bpp == 3) {
+		// No power-of-two pattern: seed one pixel and double it
+		if (count <= 0) {
+			return;
+		}
+		i_fbgl_store(dst, native, 3);
+		size_t done = 3;
+		const size_t bytes = (size_t)count * 3;
+		while (done < bytes) {
+			const size_t n = done < bytes - done ? done :
+							       bytes - done;
+			memcpy(dst + done, dst, n);
+			done += n;
+		}
+		return;
+	}
+
+	// Scalar head up to the alignment the wide kernels expect
+	while (count > 0 && ((uintptr_t)dst & 31)) {
+		i_fbgl_store(dst, native, bpp);
+		dst += bpp;
+		count--;
+	}
+
+	if (count >= 16) {
+		const uint32_t pattern =
+			bpp == 2 ? (native & 0xFFFF) * 0x10001u : native;
+		const size_t done = wide(dst, pattern, (size_t)count * bpp);
+		dst += done;
+		count -= (int32_t)(done / bpp);
+	}
+
+	for (; count > 0; count--, dst += bpp) {
+		i_fbgl_store(dst, native, bpp);
+	}
+}
+
+FBGL_INLINE void i_fbgl_blit_generic(uint8_t *dst, const uint32_t *src,
+				     int32_t count, const int bpp)
+{
+	if (bpp == 4) {
+		memcpy(dst, src, (size_t)count * 4);
+		return;
+	}
+	for (int32_t i = 0; i < count; i++, dst += bpp) {
+		i_fbgl_store(dst, i_fbgl_map(src[i], bpp), bpp);
+	}
+}
+
+FBGL_INLINE void i_fbgl_glyph_generic(uint8_t *dst, const uint8_t *bits,
+				      int32_t col0, int32_t col1,
+				      uint32_t native, const int bpp)
+{
+	if (bpp == 4) {
+		i_fbgl_glyph32(dst, bits, col0, col1, native);
+	} else if (bpp == 2) {
+		i_fbgl_glyph16(dst, bits, col0, col1, native);
+	} else {
+		i_fbgl_glyph_bits(dst, bits, col0, col1, native, bpp);
+	}
+}
+
+// Native pixel back to XRGB8888, low bits of RGB565 replicated
+FBGL_INLINE uint32_t i_fbgl_unmap(const uint8_t *src, const int bpp)
+{
+	if (bpp == 4) {
+		uint32_t v;
+		memcpy(&v, src, 4);
+		return v;
+	}
+	if (bpp == 2) {
+		uint16_t v;
+		memcpy(&v, src, 2);
+		const uint32_t r = (v >> 11) & 0x1F;
+		const uint32_t g = (v >> 5) & 0x3F;
+		const uint32_t b = v & 0x1F;
+		return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) |
+		       (b << 3 | b >> 2);
+	}
+	return (uint32_t)src[0] | (uint32_t)src[1] << 8 |
+	       (uint32_t)src[2] << 16;
+}
+
+FBGL_INLINE void i_fbgl_read_generic(uint32_t *dst, const uint8_t *src,
+				     int32_t count, const int bpp)
+{
+	if (bpp == 4) {
+		memcpy(dst, src, (size_t)count * 4);
+		return;
+	}
+	for (int32_t i = 0; i < count; i++, src += bpp) {
+		dst[i] = i_fbgl_unmap(src, bpp);
+	}
+}
+
+FBGL_INLINE void i_fbgl_column_generic(uint8_t *dst, size_t pitch,
+				       uint32_t native, int32_t count,
+				       const int bpp)
+{
+	for (int32_t i = 0; i < count; i++, dst += pitch) {
+		i_fbgl_store(dst, native, bpp);
+	}
+}
+
+FBGL_INLINE void i_fbgl_line_generic(uint8_t *dst, ptrdiff_t step,
+				     ptrdiff_t carry, int64_t rem, int64_t inc,
+				     int64_t den, int32_t count,
+				     uint32_t native, const int bpp)
+{
+	for (int32_t i = 0; i < count; i++) {
+		i_fbgl_store(dst, native, bpp);
+		dst += step;
+		rem += inc;
+		if (rem >= den) {
+			rem -= den;
+			dst += carry;
+		}
+	}
+}
+
+#define I_FBGL_DEFINE_KERNELS(name, bpp)                                      \
+	static uint32_t i_fbgl_map_##name(uint32_t color)                      \
+	{                                                                      \
+		return i_fbgl_map(color, bpp);                                 \
+	}                                                                      \
+	static void i_fbgl_fill_##name(uint8_t *dst, uint32_t native,          \
+				       int32_t count)                          \
+	{                                                                      \
+		i_fbgl_fill_generic(dst, native, count, bpp,                   \
+				    i_fbgl_wide_fill);                         \
+	}                                                                      \
+	static void i_fbgl_blit_##name(uint8_t *dst, const uint32_t *src,      \
+				       int32_t count)                          \
+	{                                                                      \
+		i_fbgl_blit_generic(dst, src, count, bpp);                     \
+	}                                                                      \
+	static void i_fbgl_glyph_##name(uint8_t *dst, const uint8_t *bits,     \
+					int32_t col0, int32_t col1,            \
+					uint32_t native)                       \
+	{                                                                      \
+		i_fbgl_glyph_generic(dst, bits, col0, col1, native, bpp);      \
+	}                                                                      \
+	static void i_fbgl_column_##name(uint8_t *dst, size_t pitch,           \
+					 uint32_t native, int32_t count)       \
+	{                                                                      \
+		i_fbgl_column_generic(dst, pitch, native, count, bpp);         \
+	}                                                                      \
+	static void i_fbgl_line_##name(uint8_t *dst, ptrdiff_t step,           \
+				       ptrdiff_t carry, int64_t rem,           \
+				       int64_t inc, int64_t den,               \
+				       int32_t count, uint32_t native)         \
+	{                                                                      \
+		i_fbgl_line_generic(dst, step, carry, rem, inc, den, count,    \
+				    native, bpp);                              \
+	}                                                                      \
+	static void i_fbgl_read_##name(uint32_t *dst, const uint8_t *src,      \
+				       int32_t count)                          \
+	{                                                                      \
+		i_fbgl_read_generic(dst, src, count, bpp);                     \
+	}
+
+I_FBGL_DEFINE_KERNELS(xrgb8888, 4)
+I_FBGL_DEFINE_KERNELS(rgb565, 2)
+I_FBGL_DEFINE_KERNELS(rgb888, 3)
+
+static void i_fbgl_set_format(fbgl_t *fb, fbgl_format_t format)
+{
+	i_fbgl_select_simd();
+
+	fb->format = format;
+	switch (format) {
+	case FBGL_FORMAT_XRGB8888:
+		fb->ops = (fbgl_pixel_ops_t){ 4, i_fbgl_map_xrgb8888,
+					      i_fbgl_fill_xrgb8888,
+					      i_fbgl_blit_xrgb8888,
+					      i_fbgl_glyph_xrgb8888,
+					      i_fbgl_column_xrgb8888,
+					      i_fbgl_line_xrgb8888,
+					      i_fbgl_read_xrgb8888 };
+		break;
+	case FBGL_FORMAT_RGB888:
+		fb->ops = (fbgl_pixel_ops_t){ 3, i_fbgl_map_rgb888,
+					      i_fbgl_fill_rgb888,
+					      i_fbgl_blit_rgb888,
+					      i_fbgl_glyph_rgb888,
+					      i_fbgl_column_rgb888,
+					      i_fbgl_line_rgb888,
+					      i_fbgl_read_rgb888 };
+		break;
+	case FBGL_FORMAT_RGB565:
+		fb->ops = (fbgl_pixel_ops_t){ 2, i_fbgl_map_rgb565,
+					      i_fbgl_fill_rgb565,
+					      i_fbgl_blit_rgb565,
+					      i_fbgl_glyph_rgb565,
+					      i_fbgl_column_rgb565,
+					      i_fbgl_line_rgb565,
+					      i_fbgl_read_rgb565 };
+		break;
+	}
+}
+
+static int i_fbgl_setup_format(fbgl_t *fb)
+{
+	switch (fb->vinfo.bits_per_pixel) {
+	case 32:
+		i_fbgl_set_format(fb, FBGL_FORMAT_XRGB8888);
+		return 0;
+	case 24:
+		i_fbgl_set_format(fb, FBGL_FORMAT_RGB888);
+		return 0;
+	case 16:
+		if (fb->vinfo.green.length != 6) {
+			break; // RGB555 and friends
+		}
+		i_fbgl_set_format(fb, FBGL_FORMAT_RGB565);
+		return 0;
+	}
+
+	fprintf(stderr, "Unsupported framebuffer format: %u bpp\n",
+		fb->vinfo.bits_per_pixel);
+	return -1;
+}
+
+static void i_fbgl_fill_cached(fbgl_t const *fb, uint8_t *dst,
+			       uint32_t native, int32_t count)
+{
+	fb->ops.fill(dst, native, count);
+}
+
+// Clear-sized fills into the device mapping bypass the cache
+static void i_fbgl_fill_stream(fbgl_t const *fb, uint8_t *dst,
+			       uint32_t native, int32_t count)
+{
+	switch (fb->ops.bytes_per_pixel) {
+	case 4:
+		i_fbgl_fill_generic(dst, native, count, 4, i_fbgl_wide_stream);
+		break;
+	case 2:
+		i_fbgl_fill_generic(dst, native, count, 2, i_fbgl_wide_stream);
+		break;
+	default:
+		fb->ops.fill(dst, native, count);
+		break;
+	}
+}
+
+FBGL_INLINE uint8_t *i_fbgl_pixel_addr(fbgl_t const *fb, int32_t x, int32_t y)
+{
+	return (uint8_t *)fb->pixels + (size_t)y * fb->pitch +
+	       (size_t)x * fb->ops.bytes_per_pixel;
+}
+
+FBGL_INLINE bool i_fbgl_in_clip(fbgl_t const *fb, int32_t x, int32_t y)
+{
+	return x >= fb->clip.x && y >= fb->clip.y &&
+	       x < fb->clip.x + fb->clip.width &&
+	       y < fb->clip.y + fb->clip.height;
+}
+
+// Intersect the box [x0, x1) x [y0, y1) with the clip rect.
+// Returns false when nothing is left to draw.
+FBGL_INLINE bool i_fbgl_clip_box(fbgl_t const *fb, int32_t *x0, int32_t *y0,
+				 int32_t *x1, int32_t *y1)
+{
+	const fbgl_rect_t *c = &fb->clip;
+	if (*x0 < c->x)
+		*x0 = c->x;
+	if (*y0 < c->y)
+		*y0 = c->y;
+	if (*x1 > c->x + c->width)
+		*x1 = c->x + c->width;
+	if (*y1 > c->y + c->height)
+		*y1 = c->y + c->height;
+	return *x0 < *x1 && *y0 < *y1;
+}
+
+// Fill pixels [x0, x1) of row y, clipped
+FBGL_INLINE void i_fbgl_hspan(fbgl_t *fb, int32_t y, int32_t x0, int32_t x1,
+			      uint32_t native)
+{
+	int32_t y1 = y + 1;
+	if (i_fbgl_clip_box(fb, &x0, &y, &x1, &y1)) {
+		fb->ops.fill(i_fbgl_pixel_addr(fb, x0, y), native, x1 - x0);
+	}
+}
+
+// Store an already mapped color, the format switch is well predicted
+FBGL_INLINE void i_fbgl_plot(fbgl_t *fb, int32_t x, int32_t y,
+			     uint32_t native)
+{
+	uint8_t *dst = i_fbgl_pixel_addr(fb, x, y);
+	switch (fb->ops.bytes_per_pixel) {
+	case 4:
+		i_fbgl_store(dst, native, 4);
+		break;
+	case 2:
+		i_fbgl_store(dst, native, 2);
+		break;
+	default:
+		i_fbgl_store(dst, native, 3);
+		break;
+	}
+}
+
+// Fill pixels [y0, y1) of column x, clipped
+FBGL_INLINE void i_fbgl_vspan(fbgl_t *fb, int32_t x, int32_t y0, int32_t y1,
+			      uint32_t native)
+{
+	int32_t x1 = x + 1;
+	if (i_fbgl_clip_box(fb, &x, &y0, &x1, &y1)) {
+		fb->ops.column(i_fbgl_pixel_addr(fb, x, y0), fb->pitch, native,
+			       y1 - y0);
+	}
+}
+
+char const *fbgl_name_info(void)
+{
+	return NAME;
+}
+
+char const *fbgl_version_info(void)
+{
+	return VERSION;
+}
+
+char const *fbgl_simd_info(void)
+{
+	i_fbgl_select_simd();
+	return i_fbgl_simd_name;
+}
+
+int fbgl_init(const char *device, fbgl_t *fb)
+{
+	return fbgl_init_ex(device, fb, FBGL_INIT_DEFAULT);
+}
+
+int fbgl_init_ex(const char *device, fbgl_t *fb, uint32_t flags)
+{
+	if (!fb) {
+		fprintf(stderr, "Error: fbgl_t pointer is NULL.");
+		return -1;
+	}
+
+	fb->mapping = NULL;
+	fb->back_buffer = NULL;
+	fb->flags = flags;
+	fb->page = 0;
+	fb->can_pan = false;
+	fb->damage.count = 0;
+	fb->prev_damage.count = 0;
+	fb->deferred = NULL;
+
+	fb->fd = device == NULL ? open(DEFAULT_FB, O_RDWR) :
+				  open(device, O_RDWR);
+	if (fb->fd == -1) {
+		perror("Error openning framebuffer device");
+		return -1;
+	}
+
+	if (ioctl(fb->fd, FBIOGET_FSCREENINFO, &fb->finfo) == -1) {
+		perror("Error: Reading fixed information.");
+		close(fb->fd);
+		return -1;
+	}
+	if (ioctl(fb->fd, FBIOGET_VSCREENINFO, &fb->vinfo) == -1) {
+		perror("Error reading variable information");
+		close(fb->fd);
+		return -1;
+	}
+	if (i_fbgl_setup_format(fb) == -1) {
+		close(fb->fd);
+		return -1;
+	}
+
+	fb->width = fb->vinfo.xres;
+	fb->height = fb->vinfo.yres;
+	fb->screen_size = fb->finfo.smem_len;
+	fb->pitch = fb->finfo.line_length;
+	fb->page_size = fb->pitch * fb->vinfo.yres;
+	fb->clip = (fbgl_rect_t){ 0, 0, fb->width, fb->height };
+	fb->clip_depth = 0;
+
+	// Map framebuffer to memory
+	fb->mapping = (uint8_t *)mmap(NULL, fb->screen_size,
+				      PROT_READ | PROT_WRITE, MAP_SHARED,
+				      fb->fd, 0);
+	if (fb->mapping == MAP_FAILED) {
+		perror("Error mapping framebuffer device to memory");
+		close(fb->fd);
+		return -1;
+	}
+	fb->pixels = (uint32_t *)fb->mapping;
+
+	if (flags & FBGL_INIT_BACK_BUFFER) {
+		fb->back_buffer = (uint32_t *)calloc(1, fb->page_size);
+		if (!fb->back_buffer) {
+			perror("Failed to allocate back buffer");
+			munmap(fb->mapping, fb->screen_size);
+			close(fb->fd);
+			return -1;
+		}
+		fb->pixels = fb->back_buffer;
+
+		// Whatever the device shows now is not ours
+		i_fbgl_damage(fb, 0, 0, fb->width, fb->height);
+		fb->prev_damage = fb->damage;
+
+		// Two pages fit in video memory: present by panning instead
+		// of overwriting the page that is being scanned out.
+		fb->can_pan = fb->finfo.ypanstep != 0 &&
+			      fb->vinfo.yres_virtual >= 2 * fb->vinfo.yres &&
+			      fb->screen_size >= 2 * fb->page_size &&
+			      fb->vinfo.yres % fb->finfo.ypanstep == 0;
+		if (fb->can_pan && fb->vinfo.yoffset != 0 &&
+		    i_fbgl_pan(fb, 0) == -1) {
+			fb->can_pan = false;
+		}
+	}
+
+	// Without a back buffer every draw lands in device memory
+	fb->stream_stores = (flags & FBGL_INIT_STREAM_STORES) ||
+			    !fb->back_buffer;
+
+	return 0;
+}
+
+int fbgl_init_surface(fbgl_t *fb, int32_t width, int32_t height,
+		      fbgl_format_t format, uint32_t flags)
+{
+	if (!fb || width <= 0 || height <= 0) {
+		fprintf(stderr, "Error: invalid surface parameters.\n");
+		return -1;
+	}
+
+	memset(fb, 0, sizeof(*fb));
+	fb->fd = -1;
+	fb->width = width;
+	fb->height = height;
+	fb->clip = (fbgl_rect_t){ 0, 0, width, height };
+	fb->flags = (flags & FBGL_INIT_STREAM_STORES) | I_FBGL_SURFACE_FLAG;
+	fb->stream_stores = (flags & FBGL_INIT_STREAM_STORES) != 0;
+	i_fbgl_set_format(fb, format);
+
+	fb->pitch = (uint32_t)width * fb->ops.bytes_per_pixel;
+	fb->page_size = fb->pitch * (uint32_t)height;
+	fb->screen_size = fb->page_size;
+	fb->vinfo.xres = fb->vinfo.xres_virtual = (uint32_t)width;
+	fb->vinfo.yres = fb->vinfo.yres_virtual = (uint32_t)height;
+	fb->vinfo.bits_per_pixel = fb->ops.bytes_per_pixel * 8;
+	fb->finfo.line_length = fb->pitch;
+
+	void *memory = NULL;
+	if (posix_memalign(&memory, 64, fb->page_size) != 0) {
+		perror("Failed to allocate surface");
+		return -1;
+	}
+	memset(memory, 0, fb->page_size);
+	fb->pixels = (uint32_t *)memory;
+
+	return 0;
+}
+
+void fbgl_destroy(fbgl_t *fb)
+{
+	if (fb && (fb->flags & I_FBGL_SURFACE_FLAG)) {
+		i_fbgl_deferred_free(fb);
+		free(fb->pixels);
+		fb->pixels = NULL;
+		fb->flags = 0;
+		return;
+	}
+
+	if (!fb || fb->fd == -1) {
+		fprintf(stderr,
+			"Error: framebuffer not initialized or already destroyed.\n");
+		return;
+	}
+
+	// Leave the console on the page it expects
+	if (fb->can_pan && fb->page != 0) {
+		if (fb->back_buffer) {
+			memcpy(fb->mapping, fb->back_buffer, fb->page_size);
+		}
+		i_fbgl_pan(fb, 0);
+	}
+
+	i_fbgl_deferred_free(fb);
+	free(fb->back_buffer);
+	fb->back_buffer = NULL;
+
+	if (fb->mapping && fb->mapping != MAP_FAILED) {
+		munmap(fb->mapping, fb->screen_size);
+	}
+	fb->mapping = NULL;
+	fb->pixels = NULL;
+
+	close(fb->fd);
+	fb->fd = -1;
+}
+
+static int i_fbgl_pan(fbgl_t *fb, uint32_t page)
+{
+	struct fb_var_screeninfo var = fb->vinfo;
+	var.xoffset = 0;
+	var.yoffset = page * fb->vinfo.yres;
+
+	if (ioctl(fb->fd, FBIOPAN_DISPLAY, &var) == -1) {
+		perror("Error panning framebuffer display");
+		return -1;
+	}
+
+	fb->vinfo.xoffset = var.xoffset;
+	fb->vinfo.yoffset = var.yoffset;
+	fb->page = page;
+	return 0;
+}
+
+static void i_fbgl_damage(fbgl_t *fb, int32_t x0, int32_t y0, int32_t x1,
+			  int32_t y1)
+{
+	// Only a back buffer is presented selectively
+	if (!fb->back_buffer) {
+		return;
+	}
+
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+	if (x1 > fb->width)
+		x1 = fb->width;
+	if (y1 > fb->height)
+		y1 = fb->height;
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+
+	fbgl_damage_t *damage = &fb->damage;
+
+	// Absorb every rect that overlaps or touches the new one. The grown
+	// rect can reach rects that were skipped already, so rescan.
+	for (int32_t i = 0; i < damage->count;) {
+		fbgl_rect_t *r = &damage->rects[i];
+		const int32_t rx1 = r->x + r->width;
+		const int32_t ry1 = r->y + r->height;
+
+		if (r->x > x1 || rx1 < x0 || r->y > y1 || ry1 < y0) {
+			i++;
+			continue;
+		}
+		if (r->x <= x0 && r->y <= y0 && rx1 >= x1 && ry1 >= y1) {
+			return; // Already covered
+		}
+
+		x0 = r->x < x0 ? r->x : x0;
+		y0 = r->y < y0 ? r->y : y0;
+		x1 = rx1 > x1 ? rx1 : x1;
+		y1 = ry1 > y1 ? ry1 : y1;
+		*r = damage->rects[--damage->count];
+		i = 0;
+	}
+
+	if (damage->count == FBGL_MAX_DAMAGE_RECTS) {
+		// List is full: fold the new rect into the one it grows least
+		int32_t best = 0;
+		int64_t best_growth = INT64_MAX;
+		for (int32_t i = 0; i < damage->count; i++) {
+			const fbgl_rect_t *r = &damage->rects[i];
+			const int32_t ux0 = r->x < x0 ? r->x : x0;
+			const int32_t uy0 = r->y < y0 ? r->y : y0;
+			const int32_t ux1 = r->x + r->width > x1 ?
+						    r->x + r->width :
+						    x1;
+			const int32_t uy1 = r->y + r->height > y1 ?
+						    r->y + r->height :
+						    y1;
+			const int64_t growth =
+				(int64_t)(ux1 - ux0) * (uy1 - uy0) -
+				(int64_t)r->width * r->height;
+			if (growth < best_growth) {
+				best_growth = growth;
+				best = i;
+			}
+		}
+
+		const fbgl_rect_t r = damage->rects[best];
+		damage->rects[best] = damage->rects[--damage->count];
+		i_fbgl_damage(fb, r.x < x0 ? r.x : x0, r.y < y0 ? r.y : y0,
+			      r.x + r.width > x1 ? r.x + r.width : x1,
+			      r.y + r.height > y1 ? r.y + r.height : y1);
+		return;
+	}
+
+	damage->rects[damage->count++] =
+		(fbgl_rect_t){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+void fbgl_add_damage(fbgl_t *fb, fbgl_rect_t rect)
+{
+	if (!fb) {
+		return;
+	}
+
+	i_fbgl_damage(fb, rect.x, rect.y, rect.x + rect.width,
+		      rect.y + rect.height);
+}
+
+int fbgl_push_clip(fbgl_t *fb, fbgl_rect_t rect)
+{
+	if (!fb) {
+		return -1;
+	}
+	if (fb->clip_depth == FBGL_CLIP_STACK_SIZE) {
+		fprintf(stderr, "Error: clip stack overflow.\n");
+		return -1;
+	}
+
+	int32_t x0 = rect.x;
+	int32_t y0 = rect.y;
+	int32_t x1 = rect.x + rect.width;
+	int32_t y1 = rect.y + rect.height;
+
+	// Nested clips can only shrink, an empty result draws nothing
+	fb->clip_stack[fb->clip_depth++] = fb->clip;
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		x1 = x0;
+		y1 = y0;
+	}
+	fb->clip = (fbgl_rect_t){ x0, y0, x1 - x0, y1 - y0 };
+
+	return 0;
+}
+
+void fbgl_pop_clip(fbgl_t *fb)
+{
+	if (fb && fb->clip_depth > 0) {
+		fb->clip = fb->clip_stack[--fb->clip_depth];
+	}
+}
+
+fbgl_rect_t fbgl_get_clip(fbgl_t const *fb)
+{
+	return fb->clip;
+}
+
+typedef struct i_fbgl_copy_job {
+	fbgl_t const *fb;
+	uint8_t *dst;
+	const uint8_t *src;
+	fbgl_rect_t rect;
+} i_fbgl_copy_job_t;
+
+static void i_fbgl_present_rows(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_copy_job_t *job = (const i_fbgl_copy_job_t *)ctx;
+	const size_t pitch = job->fb->pitch;
+	const size_t bytes_per_pixel = job->fb->ops.bytes_per_pixel;
+	const fbgl_rect_t *r = &job->rect;
+	const size_t offset =
+		(r->y + begin) * pitch + r->x * bytes_per_pixel;
+	const size_t row_bytes = r->width * bytes_per_pixel;
+
+	// Full-width rects are contiguous in both buffers
+	if (row_bytes == pitch) {
+		i_fbgl_stream_copy(job->dst + offset, job->src + offset,
+				   (end - begin) * pitch);
+	} else {
+		for (int32_t y = 0; y < end - begin; y++) {
+			i_fbgl_stream_copy(job->dst + offset + y * pitch,
+					   job->src + offset + y * pitch,
+					   row_bytes);
+		}
+	}
+	i_fbgl_stream_fence();
+}
+
+static void i_fbgl_present_damage(fbgl_t const *fb, uint8_t *page,
+				  fbgl_damage_t const *damage)
+{
+	for (int32_t i = 0; i < damage->count; i++) {
+		i_fbgl_copy_job_t job = { fb, page,
+					  (const uint8_t *)fb->back_buffer,
+					  damage->rects[i] };
+		i_fbgl_parallel_for(i_fbgl_present_rows, &job, job.rect.height,
+				    i_fbgl_row_grain(job.rect.width *
+						     fb->ops.bytes_per_pixel));
+	}
+}
+
+int fbgl_swap_buffers(fbgl_t *fb)
+{
+	if (fb && (fb->flags & I_FBGL_SURFACE_FLAG)) {
+		return 0;
+	}
+	if (!fb || fb->fd == -1) {
+		return -1;
+	}
+
+	// Drawing goes straight to the device, nothing to present
+	if (!fb->back_buffer) {
+		return 0;
+	}
+
+	if (!fb->can_pan) {
+		i_fbgl_present_damage(fb, fb->mapping, &fb->damage);
+		fb->damage.count = 0;
+		return 0;
+	}
+
+	// The hidden page still holds the frame before last, so it needs
+	// both this frame's and the previous frame's damage.
+	const uint32_t next = fb->page ^ 1;
+	uint8_t *page = fb->mapping + (size_t)next * fb->page_size;
+	i_fbgl_present_damage(fb, page, &fb->prev_damage);
+	i_fbgl_present_damage(fb, page, &fb->damage);
+	fb->prev_damage = fb->damage;
+	fb->damage.count = 0;
+	return i_fbgl_pan(fb, next);
+}
+
+/**
+ * Threads
+ */
+// Chunks smaller than this are not worth handing to another core
+#define I_FBGL_PARALLEL_MIN_BYTES (64 * 1024)
+
+#ifdef FBGL_THREADS
+// Each participant owns a contiguous range of rows, packed as begin and
+// end into one 64-bit word. It takes grain rows at a time from the front
+// of its own range and, once that is empty, steals the back half of
+// another participant's range, both with a single compare-and-swap.
+typedef struct i_fbgl_range_slot {
+	uint64_t range;
+	char pad[56]; // One cache line per slot
+} i_fbgl_range_slot_t;
+
+// Workers sleep until a new generation of work is posted. The caller
+// takes part as the last participant and returns once every worker has
+// left the job.
+static struct {
+	pthread_t *threads;
+	int32_t count; // Worker threads, not counting the caller
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	uint32_t generation;
+	int32_t busy;
+	bool quit;
+	bool active; // A job is running, nested and concurrent jobs run inline
+	i_fbgl_range_fn fn;
+	void *ctx;
+	int32_t grain;
+	i_fbgl_range_slot_t *slots; // count + 1 participants
+} i_fbgl_pool = { .lock = PTHREAD_MUTEX_INITIALIZER,
+		  .wake = PTHREAD_COND_INITIALIZER,
+		  .done = PTHREAD_COND_INITIALIZER };
+
+FBGL_INLINE uint64_t i_fbgl_range_pack(uint32_t begin, uint32_t end)
+{
+	return (uint64_t)begin << 32 | end;
+}
+
+// Claim up to max rows from the front (or back) of slot, false if empty
+static bool i_fbgl_range_claim(i_fbgl_range_slot_t *slot, int32_t max,
+			       bool back, int32_t *begin, int32_t *end)
+{
+	uint64_t range = __atomic_load_n(&slot->range, __ATOMIC_ACQUIRE);
+	for (;;) {
+		const int32_t b = (int32_t)(range >> 32);
+		const int32_t e = (int32_t)(uint32_t)range;
+		if (b >= e) {
+			return false;
+		}
+
+		const int32_t n = e - b < max ? e - b : max;
+		const uint64_t left = back ? i_fbgl_range_pack(b, e - n) :
+					     i_fbgl_range_pack(b + n, e);
+		if (__atomic_compare_exchange_n(&slot->range, &range, left,
+						true, __ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			*begin = back ? e - n : b;
+			*end = back ? e : b + n;
+			return true;
+		}
+	}
+}
+
+static void i_fbgl_pool_work(int32_t self)
+{
+	const int32_t participants = i_fbgl_pool.count + 1;
+	i_fbgl_range_slot_t *own = &i_fbgl_pool.slots[self];
+	int32_t begin;
+	int32_t end;
+
+	for (;;) {
+		if (i_fbgl_range_claim(own, i_fbgl_pool.grain, false, &begin,
+				       &end)) {
+			i_fbgl_pool.fn(i_fbgl_pool.ctx, begin, end);
+			continue;
+		}
+
+		// Own range is done: steal half of the first busy victim
+		bool stolen = false;
+		for (int32_t i = 1; i < participants && !stolen; i++) {
+			i_fbgl_range_slot_t *victim =
+				&i_fbgl_pool.slots[(self + i) % participants];
+			const uint64_t range = __atomic_load_n(
+				&victim->range, __ATOMIC_ACQUIRE);
+			const int32_t left = (int32_t)(uint32_t)range -
+					     (int32_t)(range >> 32);
+			const int32_t half = left > i_fbgl_pool.grain ?
+						     (left + 1) / 2 :
+						     left;
+			stolen = left > 0 && i_fbgl_range_claim(victim, half,
+								true, &begin,
+								&end);
+		}
+		if (!stolen) {
+			return;
+		}
+		__atomic_store_n(&own->range, i_fbgl_range_pack(begin, end),
+				 __ATOMIC_RELEASE);
+	}
+}
+
+static void *i_fbgl_worker(void *arg)
+{
+	const int32_t self = (int32_t)(intptr_t)arg;
+	uint32_t seen = 0;
+
+	pthread_mutex_lock(&i_fbgl_pool.lock);
+	for (;;) {
+		while (!i_fbgl_pool.quit && i_fbgl_pool.generation == seen) {
+			pthread_cond_wait(&i_fbgl_pool.wake, &i_fbgl_pool.lock);
+		}
+		if (i_fbgl_pool.quit) {
+			break;
+		}
+		seen = i_fbgl_pool.generation;
+		pthread_mutex_unlock(&i_fbgl_pool.lock);
+
+		i_fbgl_pool_work(self);
+
+		pthread_mutex_lock(&i_fbgl_pool.lock);
+		assert(i_fbgl_pool.busy > 0);
+		if (--i_fbgl_pool.busy == 0) {
+			pthread_cond_signal(&i_fbgl_pool.done);
+		}
+	}
+	pthread_mutex_unlock(&i_fbgl_pool.lock);
+	return NULL;
+}
+#endif // FBGL_THREADS
+
+// Run fn over rows [0, rows) in chunks of at least grain rows, spread over
+// the pool when there is one. Calls from inside a job, or from another
+// thread while the pool is taken, run inline.
+static void i_fbgl_parallel_for(i_fbgl_range_fn fn, void *ctx, int32_t rows,
+				int32_t grain)
+{
+	grain = grain < 1 ? 1 : grain;
+
+#ifdef FBGL_THREADS
+	bool idle = false;
+	if (i_fbgl_pool.count > 0 && rows > grain &&
+	    __atomic_compare_exchange_n(&i_fbgl_pool.active, &idle, true,
+					false, __ATOMIC_ACQ_REL,
+					__ATOMIC_ACQUIRE)) {
+		const int32_t participants = i_fbgl_pool.count + 1;
+
+		pthread_mutex_lock(&i_fbgl_pool.lock);
+		i_fbgl_pool.fn = fn;
+		i_fbgl_pool.ctx = ctx;
+		i_fbgl_pool.grain = grain;
+		for (int32_t p = 0; p < participants; p++) {
+			i_fbgl_pool.slots[p].range = i_fbgl_range_pack(
+				(int64_t)rows * p / participants,
+				(int64_t)rows * (p + 1) / participants);
+		}
+		i_fbgl_pool.busy = i_fbgl_pool.count;
+		i_fbgl_pool.generation++;
+		pthread_cond_broadcast(&i_fbgl_pool.wake);
+		pthread_mutex_unlock(&i_fbgl_pool.lock);
+
+		i_fbgl_pool_work(i_fbgl_pool.count);
+
+		pthread_mutex_lock(&i_fbgl_pool.lock);
+		while (i_fbgl_pool.busy > 0) {
+			pthread_cond_wait(&i_fbgl_pool.done, &i_fbgl_pool.lock);
+		}
+		__atomic_store_n(&i_fbgl_pool.active, false, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&i_fbgl_pool.lock);
+		return;
+	}
+#endif // FBGL_THREADS
+
+	fn(ctx, 0, rows);
+}
+
+// Rows per chunk so that a chunk moves at least I_FBGL_PARALLEL_MIN_BYTES
+FBGL_INLINE int32_t i_fbgl_row_grain(size_t row_bytes)
+{
+	if (row_bytes == 0) {
+		return 1;
+	}
+	return (int32_t)(I_FBGL_PARALLEL_MIN_BYTES / row_bytes) + 1;
+}
+
+int fbgl_threads_init(int32_t count)
+{
+	fbgl_threads_destroy();
+	if (count <= 1) {
+		return 0;
+	}
+
+#ifdef FBGL_THREADS
+	i_fbgl_pool.threads =
+		(pthread_t *)calloc(count - 1, sizeof(*i_fbgl_pool.threads));
+	i_fbgl_pool.slots = (i_fbgl_range_slot_t *)calloc(
+		count, sizeof(*i_fbgl_pool.slots));
+	if (!i_fbgl_pool.threads || !i_fbgl_pool.slots) {
+		perror("Failed to allocate worker threads");
+		fbgl_threads_destroy();
+		return -1;
+	}
+
+	for (int32_t i = 0; i < count - 1; i++) {
+		if (pthread_create(&i_fbgl_pool.threads[i], NULL,
+				   i_fbgl_worker, (void *)(intptr_t)i) != 0) {
+			fprintf(stderr, "Error: failed to start worker %d.\n",
+				i);
+			i_fbgl_pool.count = i;
+			fbgl_threads_destroy();
+			return -1;
+		}
+	}
+	i_fbgl_pool.count = count - 1;
+	return 0;
+#else
+	fprintf(stderr, "Error: fbgl was built without FBGL_THREADS.\n");
+	return -1;
+#endif // FBGL_THREADS
+}
+
+void fbgl_threads_destroy(void)
+{
+	i_fbgl_loader_stop();
+
+#ifdef FBGL_THREADS
+	pthread_mutex_lock(&i_fbgl_pool.lock);
+	i_fbgl_pool.quit = true;
+	pthread_cond_broadcast(&i_fbgl_pool.wake);
+	pthread_mutex_unlock(&i_fbgl_pool.lock);
+
+	for (int32_t i = 0; i < i_fbgl_pool.count; i++) {
+		pthread_join(i_fbgl_pool.threads[i], NULL);
+	}
+	free(i_fbgl_pool.threads);
+	free(i_fbgl_pool.slots);
+	i_fbgl_pool.threads = NULL;
+	i_fbgl_pool.slots = NULL;
+	i_fbgl_pool.count = 0;
+
+	// New workers start out having seen generation 0
+	pthread_mutex_lock(&i_fbgl_pool.lock);
+	i_fbgl_pool.quit = false;
+	i_fbgl_pool.generation = 0;
+	i_fbgl_pool.busy = 0;
+	pthread_mutex_unlock(&i_fbgl_pool.lock);
+#endif // FBGL_THREADS
+}
+
+/**
+ * Deferred rendering
+ */
+// Between fbgl_deferred_begin and fbgl_deferred_end primitives are only
+// recorded, together with their clip rect and clipped bounds. The end call
+// bins them into FBGL_TILE_SIZE tiles and replays each tile's list through
+// the regular drawing functions, clipped to the tile, so the result is the
+// same pixels immediate mode would draw. Tiles are independent and run
+// on the thread pool.
+enum {
+	I_FBGL_CMD_CLEAR,
+	I_FBGL_CMD_PIXEL,
+	I_FBGL_CMD_LINE,
+	I_FBGL_CMD_RECT,
+	I_FBGL_CMD_RECT_FILLED,
+	I_FBGL_CMD_RECT_BLEND,
+	I_FBGL_CMD_CIRCLE,
+	I_FBGL_CMD_CIRCLE_FILLED,
+	I_FBGL_CMD_ELLIPSE_FILLED,
+	I_FBGL_CMD_TRIANGLE,
+	I_FBGL_CMD_POLYGON,
+	I_FBGL_CMD_TEXTURE,
+	I_FBGL_CMD_TEXTURE_SCALED,
+	I_FBGL_CMD_TEXTURE_AFFINE,
+	I_FBGL_CMD_SPRITE,
+	I_FBGL_CMD_TEXT,
+};
+
+typedef struct i_fbgl_cmd {
+	int32_t kind;
+	int32_t x0, y0, x1, y1; // Clipped bounds
+	fbgl_rect_t clip; // Clip rect when recorded
+	uint32_t color;
+	int32_t args[6]; // Coordinates, counts and flags of the primitive
+	const void *ref; // Texture or font, must outlive fbgl_deferred_end
+	size_t data; // Arena offset of copied points or text
+} i_fbgl_cmd_t;
+
+struct fbgl_deferred {
+	bool recording;
+	fbgl_t const *fb;
+	i_fbgl_cmd_t *cmds;
+	int32_t cmd_count;
+	int32_t cmd_capacity;
+	uint8_t *arena;
+	size_t arena_size;
+	size_t arena_capacity;
+	int32_t tiles_x;
+	int32_t tiles_y;
+	size_t *bin_start; // Per tile offset into bin_cmds, plus one
+	size_t *bin_fill;
+	int32_t *bin_cmds;
+	size_t bin_capacity;
+};
+
+FBGL_INLINE bool i_fbgl_deferring(fbgl_t const *fb)
+{
+	return fb && fb->deferred && fb->deferred->recording;
+}
+
+static void i_fbgl_deferred_flush(fbgl_t *fb);
+
+static bool i_fbgl_grow(void **buffer, size_t *capacity, size_t needed,
+			size_t size)
+{
+	if (needed <= *capacity) {
+		return true;
+	}
+	size_t capacity_new = *capacity ? *capacity * 2 : 256;
+	while (capacity_new < needed) {
+		capacity_new *= 2;
+	}
+	void *grown = realloc(*buffer, capacity_new * size);
+	if (!grown) {
+		perror("Failed to grow deferred command buffer");
+		return false;
+	}
+	*buffer = grown;
+	*capacity = capacity_new;
+	return true;
+}
+
+// Queue a primitive covering [x0, x1) x [y0, y1). Returns false if it
+// could not be queued; everything queued so far has been drawn by then,
+// so the caller draws it right away.
+static bool i_fbgl_record(fbgl_t *fb, int32_t kind, int32_t x0, int32_t y0,
+			  int32_t x1, int32_t y1, uint32_t color,
+			  const int32_t *args, int32_t arg_count,
+			  const void *ref, const void *data, size_t data_size)
+{
+	struct fbgl_deferred *d = fb->deferred;
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return true; // Nothing visible
+	}
+
+	size_t cmd_capacity = d->cmd_capacity;
+	const size_t offset = (d->arena_size + 7) & ~(size_t)7;
+	if (!i_fbgl_grow((void **)&d->cmds, &cmd_capacity, d->cmd_count + 1,
+			 sizeof(*d->cmds)) ||
+	    !i_fbgl_grow((void **)&d->arena, &d->arena_capacity,
+			 offset + data_size, 1)) {
+		d->cmd_capacity = (int32_t)cmd_capacity;
+		i_fbgl_deferred_flush(fb);
+		return false;
+	}
+	d->cmd_capacity = (int32_t)cmd_capacity;
+
+	i_fbgl_cmd_t *cmd = &d->cmds[d->cmd_count++];
+	cmd->kind = kind;
+	cmd->x0 = x0;
+	cmd->y0 = y0;
+	cmd->x1 = x1;
+	cmd->y1 = y1;
+	cmd->clip = fb->clip;
+	cmd->color = color;
+	memset(cmd->args, 0, sizeof(cmd->args));
+	if (arg_count) {
+		memcpy(cmd->args, args, arg_count * sizeof(*args));
+	}
+	cmd->ref = ref;
+	cmd->data = offset;
+	if (data_size) {
+		memcpy(d->arena + offset, data, data_size);
+		d->arena_size = offset + data_size;
+	}
+
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+	return true;
+}
+
+static void i_fbgl_draw_texture_rect(fbgl_t *fb,
+				     fbgl_tga_texture_t const *texture,
+				     fbgl_rect_t src, int32_t x, int32_t y,
+				     uint32_t opacity);
+
+static void i_fbgl_render_psf(fbgl_t *fb, fbgl_psf1_font_t const *font,
+			      const char *text, size_t length, int x, int y,
+			      uint32_t color);
+
+static void i_fbgl_replay(fbgl_t *fb, i_fbgl_cmd_t const *cmd,
+			  uint8_t const *arena)
+{
+	const int32_t *a = cmd->args;
+	const fbgl_point_t *points = (const fbgl_point_t *)(arena + cmd->data);
+	const fbgl_point_t p0 = { a[0], a[1] };
+	const fbgl_point_t p1 = { a[2], a[3] };
+	const fbgl_point_t p2 = { a[4], a[5] };
+
+	switch (cmd->kind) {
+	case I_FBGL_CMD_CLEAR:
+		fbgl_set_bg(fb, cmd->color);
+		break;
+	case I_FBGL_CMD_PIXEL:
+		fbgl_put_pixel(a[0], a[1], cmd->color, fb);
+		break;
+	case I_FBGL_CMD_LINE:
+		fbgl_draw_line(p0, p1, cmd->color, fb);
+		break;
+	case I_FBGL_CMD_RECT:
+		fbgl_draw_rectangle_outline(p0, p1, cmd->color, fb);
+		break;
+	case I_FBGL_CMD_RECT_FILLED:
+		fbgl_draw_rectangle_filled(p0, p1, cmd->color, fb);
+		break;
+	case I_FBGL_CMD_RECT_BLEND:
+		fbgl_fill_rect_blend(p0, p1, cmd->color, fb);
+		break;
+	case I_FBGL_CMD_CIRCLE:
+		fbgl_draw_circle_outline(a[0], a[1], a[2], cmd->color, fb);
+		break;
+	case I_FBGL_CMD_CIRCLE_FILLED:
+		fbgl_draw_circle_filled(a[0], a[1], a[2], cmd->color, fb);
+		break;
+	case I_FBGL_CMD_ELLIPSE_FILLED:
+		fbgl_draw_ellipse_filled(a[0], a[1], a[2], a[3], cmd->color,
+					 fb);
+		break;
+	case I_FBGL_CMD_TRIANGLE:
+		fbgl_draw_triangle_filled(p0, p1, p2, cmd->color, fb);
+		break;
+	case I_FBGL_CMD_POLYGON:
+		fbgl_draw_polygon_filled(points, a[0], (fbgl_fill_rule_t)a[1],
+					 cmd->color, fb);
+		break;
+	case I_FBGL_CMD_TEXTURE:
+		fbgl_draw_texture_blend(fb,
+					(fbgl_tga_texture_t const *)cmd->ref,
+					a[0], a[1], (uint32_t)a[2]);
+		break;
+	case I_FBGL_CMD_TEXTURE_SCALED: {
+		const fbgl_rect_t rect = { a[0], a[1], a[2], a[3] };
+		fbgl_draw_texture_scaled(fb,
+					 (fbgl_tga_texture_t const *)cmd->ref,
+					 rect, (fbgl_filter_t)a[4]);
+		break;
+	}
+	case I_FBGL_CMD_TEXTURE_AFFINE:
+		fbgl_draw_texture_affine(fb,
+					 (fbgl_tga_texture_t const *)cmd->ref,
+					 *(const fbgl_matrix_t *)(arena +
+								  cmd->data));
+		break;
+	case I_FBGL_CMD_SPRITE: {
+		const fbgl_rect_t src = { a[2], a[3], a[4], a[5] };
+		i_fbgl_draw_texture_rect(fb,
+					 (fbgl_tga_texture_t const *)cmd->ref,
+					 src, a[0], a[1], 255);
+		break;
+	}
+	case I_FBGL_CMD_TEXT:
+		i_fbgl_render_psf(fb, (fbgl_psf1_font_t const *)cmd->ref,
+				  (const char *)(arena + cmd->data),
+				  (size_t)a[2], a[0], a[1], cmd->color);
+		break;
+	}
+}
+
+static void i_fbgl_replay_tile(struct fbgl_deferred const *d, int32_t index)
+{
+	const int32_t tx0 = (index % d->tiles_x) * FBGL_TILE_SIZE;
+	const int32_t ty0 = (index / d->tiles_x) * FBGL_TILE_SIZE;
+	const int32_t tx1 = tx0 + FBGL_TILE_SIZE < d->fb->width ?
+				    tx0 + FBGL_TILE_SIZE :
+				    d->fb->width;
+	const int32_t ty1 = ty0 + FBGL_TILE_SIZE < d->fb->height ?
+				    ty0 + FBGL_TILE_SIZE :
+				    d->fb->height;
+	const int32_t *list = d->bin_cmds + d->bin_start[index];
+	const int32_t count =
+		(int32_t)(d->bin_start[index + 1] - d->bin_start[index]);
+
+	// Everything before the last clear or fill covering the tile is
+	// painted over anyway
+	int32_t first = 0;
+	for (int32_t i = count - 1; i > 0; i--) {
+		i_fbgl_cmd_t const *cmd = &d->cmds[list[i]];
+		if ((cmd->kind == I_FBGL_CMD_CLEAR ||
+		     cmd->kind == I_FBGL_CMD_RECT_FILLED) &&
+		    cmd->x0 <= tx0 && cmd->y0 <= ty0 && cmd->x1 >= tx1 &&
+		    cmd->y1 >= ty1) {
+			first = i;
+			break;
+		}
+	}
+
+	// Draw on a copy clipped to the tile, damage is already recorded
+	fbgl_t tile = *d->fb;
+	tile.deferred = NULL;
+	tile.back_buffer = NULL;
+	tile.clip_depth = 0;
+
+	for (int32_t i = first; i < count; i++) {
+		i_fbgl_cmd_t const *cmd = &d->cmds[list[i]];
+		int32_t x0 = tx0;
+		int32_t y0 = ty0;
+		int32_t x1 = tx1;
+		int32_t y1 = ty1;
+		tile.clip = cmd->clip;
+		if (i_fbgl_clip_box(&tile, &x0, &y0, &x1, &y1)) {
+			tile.clip = (fbgl_rect_t){ x0, y0, x1 - x0, y1 - y0 };
+			i_fbgl_replay(&tile, cmd, d->arena);
+		}
+	}
+}
+
+// Count command c in, or with place set add it to, the bins of every tile
+// it may touch. A line only visits the tiles along its path: on a row of
+// tiles its pixels stay within a pixel of where the ideal line crosses the
+// rows just above and below.
+static void i_fbgl_bin(struct fbgl_deferred *d, int32_t c, bool place)
+{
+	i_fbgl_cmd_t const *cmd = &d->cmds[c];
+	const int32_t *a = cmd->args;
+
+	for (int32_t ty = cmd->y0 / FBGL_TILE_SIZE;
+	     ty <= (cmd->y1 - 1) / FBGL_TILE_SIZE; ty++) {
+		int32_t x0 = cmd->x0;
+		int32_t x1 = cmd->x1;
+		if (cmd->kind == I_FBGL_CMD_LINE && a[1] != a[3]) {
+			// Walk the line downwards
+			const bool down = a[3] > a[1];
+			const int64_t ax = down ? a[0] : a[2];
+			const int64_t ay = down ? a[1] : a[3];
+			const int64_t dx = down ? a[2] - a[0] : a[0] - a[2];
+			const int64_t dy = down ? a[3] - a[1] : a[1] - a[3];
+			const int64_t ya = ty * FBGL_TILE_SIZE - 1 - ay;
+			const int64_t yb = (ty + 1) * FBGL_TILE_SIZE - ay;
+			const int64_t xa = ax + i_fbgl_floor_div(ya * dx, dy);
+			const int64_t xb = ax + i_fbgl_floor_div(yb * dx, dy);
+			const int64_t lo = (xa < xb ? xa : xb) - 1;
+			const int64_t hi = (xa < xb ? xb : xa) + 2;
+			x0 = lo > x0 ? (int32_t)lo : x0;
+			x1 = hi < x1 ? (int32_t)hi : x1;
+		}
+
+		for (int32_t tx = x0 / FBGL_TILE_SIZE;
+		     x0 < x1 && tx <= (x1 - 1) / FBGL_TILE_SIZE; tx++) {
+			const int32_t t = ty * d->tiles_x + tx;
+			if (place) {
+				d->bin_cmds[d->bin_fill[t]++] = c;
+			} else {
+				d->bin_start[t + 1]++;
+			}
+		}
+	}
+}
+
+static void i_fbgl_replay_tiles(void *ctx, int32_t begin, int32_t end)
+{
+	for (int32_t index = begin; index < end; index++) {
+		i_fbgl_replay_tile((struct fbgl_deferred const *)ctx, index);
+	}
+}
+
+static void i_fbgl_deferred_flush(fbgl_t *fb)
+{
+	struct fbgl_deferred *d = fb->deferred;
+	if (d->cmd_count == 0) {
+		return;
+	}
+
+	d->fb = fb;
+	d->tiles_x = (fb->width + FBGL_TILE_SIZE - 1) / FBGL_TILE_SIZE;
+	d->tiles_y = (fb->height + FBGL_TILE_SIZE - 1) / FBGL_TILE_SIZE;
+	const int32_t tiles = d->tiles_x * d->tiles_y;
+
+	size_t *start = (size_t *)realloc(d->bin_start,
+					  (tiles + 1) * sizeof(*start));
+	if (start) {
+		d->bin_start = start;
+	}
+	size_t *fill = (size_t *)realloc(d->bin_fill, tiles * sizeof(*fill));
+	if (fill) {
+		d->bin_fill = fill;
+	}
+	if (!start || !fill) {
+		perror("Failed to allocate tile bins");
+		d->cmd_count = 0;
+		d->arena_size = 0;
+		return;
+	}
+
+	// Count, then place, the commands touching each tile
+	memset(d->bin_start, 0, (tiles + 1) * sizeof(*d->bin_start));
+	for (int32_t c = 0; c < d->cmd_count; c++) {
+		i_fbgl_bin(d, c, false);
+	}
+	for (int32_t t = 0; t < tiles; t++) {
+		d->bin_start[t + 1] += d->bin_start[t];
+		d->bin_fill[t] = d->bin_start[t];
+	}
+
+	if (!i_fbgl_grow((void **)&d->bin_cmds, &d->bin_capacity,
+			 d->bin_start[tiles], sizeof(*d->bin_cmds))) {
+		d->cmd_count = 0;
+		d->arena_size = 0;
+		return;
+	}
+	for (int32_t c = 0; c < d->cmd_count; c++) {
+		i_fbgl_bin(d, c, true);
+	}
+
+	i_fbgl_parallel_for(i_fbgl_replay_tiles, d, tiles, 1);
+
+	d->cmd_count = 0;
+	d->arena_size = 0;
+}
+
+int fbgl_deferred_begin(fbgl_t *fb)
+{
+	if (!fb) {
+		return -1;
+	}
+	if (!fb->deferred) {
+		fb->deferred = (struct fbgl_deferred *)calloc(
+			1, sizeof(*fb->deferred));
+		if (!fb->deferred) {
+			perror("Failed to allocate deferred state");
+			return -1;
+		}
+	}
+	fb->deferred->recording = true;
+	return 0;
+}
+
+void fbgl_deferred_end(fbgl_t *fb)
+{
+	if (!i_fbgl_deferring(fb)) {
+		return;
+	}
+	fb->deferred->recording = false;
+	i_fbgl_deferred_flush(fb);
+}
+
+static void i_fbgl_deferred_free(fbgl_t *fb)
+{
+	struct fbgl_deferred *d = fb->deferred;
+	if (!d) {
+		return;
+	}
+	free(d->cmds);
+	free(d->arena);
+	free(d->bin_start);
+	free(d->bin_fill);
+	free(d->bin_cmds);
+	free(d);
+	fb->deferred = NULL;
+}
+
+typedef struct i_fbgl_clear_job {
+	fbgl_t const *fb;
+	uint32_t native;
+} i_fbgl_clear_job_t;
+
+// Fill rows [begin, end) of the clip rect
+static void i_fbgl_clear_rows(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_clear_job_t *job = (const i_fbgl_clear_job_t *)ctx;
+	fbgl_t const *fb = job->fb;
+	const fbgl_rect_t *c = &fb->clip;
+	const size_t row_bytes = (size_t)c->width * fb->ops.bytes_per_pixel;
+
+	void (*fill)(fbgl_t const *, uint8_t *, uint32_t, int32_t) =
+		fb->stream_stores ? i_fbgl_fill_stream : i_fbgl_fill_cached;
+
+	if (row_bytes == fb->pitch) {
+		fill(fb, i_fbgl_pixel_addr(fb, 0, c->y + begin), job->native,
+		     c->width * (end - begin));
+	} else {
+		for (int32_t y = c->y + begin; y < c->y + end; y++) {
+			fill(fb, i_fbgl_pixel_addr(fb, c->x, y), job->native,
+			     c->width);
+		}
+	}
+	if (fb->stream_stores) {
+		i_fbgl_stream_fence();
+	}
+}
+
+void fbgl_set_bg(fbgl_t *fb, uint32_t color)
+{
+#ifdef DEBUG
+	if (!fb || !fb->pixels) {
+		fprintf(stderr, "Error: framebuffer not initialized.\n");
+		return;
+	}
+#endif // DEBUG
+
+	const fbgl_rect_t *c = &fb->clip;
+	if (i_fbgl_deferring(fb) &&
+	    i_fbgl_record(fb, I_FBGL_CMD_CLEAR, c->x, c->y, c->x + c->width,
+			  c->y + c->height, color, NULL, 0, NULL, NULL, 0)) {
+		return;
+	}
+
+	// Fill the clip rect, the whole framebuffer unless clipped
+	i_fbgl_clear_job_t job = { fb, fb->ops.map_color(color) };
+	i_fbgl_parallel_for(i_fbgl_clear_rows, &job, c->height,
+			    i_fbgl_row_grain((size_t)c->width *
+					     fb->ops.bytes_per_pixel));
+	i_fbgl_damage(fb, c->x, c->y, c->x + c->width, c->y + c->height);
+}
+
+FBGL_INLINE void i_fbgl_put_pixel(int x, int y, uint32_t native, fbgl_t *fb)
+{
+#ifdef FBGL_VALIDATE_PUT_PIXEL
+	if (!fb || !fb->pixels) {
+		fprintf(stderr, "Error: framebuffer not initialized.\n");
+		return;
+	}
+
+	if (x < 0 || x >= fb->width || y < 0 || y >= fb->height) {
+		return; // Ignore out-of-bound coordinates
+	}
+#endif // FBGL_VALIDATE_PUT_PIXEL
+
+	i_fbgl_plot(fb, x, y, native);
+}
+
+void fbgl_put_pixel(int x, int y, uint32_t color, fbgl_t *fb)
+{
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[2] = { x, y };
+		if (i_fbgl_record(fb, I_FBGL_CMD_PIXEL, x, y, x + 1, y + 1,
+				  color, args, 2, NULL, NULL, 0)) {
+			return;
+		}
+	}
+
+	if (!i_fbgl_in_clip(fb, x, y)) {
+		return;
+	}
+	i_fbgl_put_pixel(x, y, fb->ops.map_color(color), fb);
+	i_fbgl_damage(fb, x, y, x + 1, y + 1);
+}
+
+// Cohen-Sutherland outcode of a point against the clip rect
+enum {
+	I_FBGL_OUT_LEFT = 1,
+	I_FBGL_OUT_RIGHT = 2,
+	I_FBGL_OUT_TOP = 4,
+	I_FBGL_OUT_BOTTOM = 8,
+};
+
+FBGL_INLINE int i_fbgl_outcode(fbgl_t const *fb, int32_t x, int32_t y)
+{
+	const fbgl_rect_t *c = &fb->clip;
+	int code = 0;
+	if (x < c->x)
+		code |= I_FBGL_OUT_LEFT;
+	else if (x >= c->x + c->width)
+		code |= I_FBGL_OUT_RIGHT;
+	if (y < c->y)
+		code |= I_FBGL_OUT_TOP;
+	else if (y >= c->y + c->height)
+		code |= I_FBGL_OUT_BOTTOM;
+	return code;
+}
+
+// Draw the Bresenham line (x0, y0)-(x1, y1), endpoints included.
+// Along the major axis a, step i lands on minor offset
+// q(i) = floor((2 * i * db + da) / (2 * da)), so the steps inside the clip
+// rect are found exactly up front and the loop itself never tests bounds.
+static void i_fbgl_line(fbgl_t *fb, int32_t x0, int32_t y0, int32_t x1,
+			int32_t y1, uint32_t native)
+{
+	// Axis-aligned lines are spans and columns
+	if (y0 == y1) {
+		i_fbgl_hspan(fb, y0, x0 < x1 ? x0 : x1, (x0 < x1 ? x1 : x0) + 1,
+			     native);
+		return;
+	}
+	if (x0 == x1) {
+		i_fbgl_vspan(fb, x0, y0 < y1 ? y0 : y1, (y0 < y1 ? y1 : y0) + 1,
+			     native);
+		return;
+	}
+
+	const int code0 = i_fbgl_outcode(fb, x0, y0);
+	const int code1 = i_fbgl_outcode(fb, x1, y1);
+	if (code0 & code1) {
+		return; // Both ends beyond the same edge
+	}
+
+	const bool steep = i_fbgl_abs_int(y1 - y0) > i_fbgl_abs_int(x1 - x0);
+	const int32_t a0 = steep ? y0 : x0;
+	const int32_t b0 = steep ? x0 : y0;
+	const int32_t a1 = steep ? y1 : x1;
+	const int32_t b1 = steep ? x1 : y1;
+	const int64_t da = i_fbgl_abs_int(a1 - a0);
+	const int64_t db = i_fbgl_abs_int(b1 - b0);
+	const int32_t sa = a0 < a1 ? 1 : -1;
+	const int32_t sb = b0 < b1 ? 1 : -1;
+
+	if (da == 0) {
+		if (!code0) {
+			i_fbgl_plot(fb, x0, y0, native);
+		}
+		return;
+	}
+
+	int64_t i0 = 0;
+	int64_t i1 = da;
+	if (code0 | code1) {
+		const fbgl_rect_t *c = &fb->clip;
+		const int32_t amin = steep ? c->y : c->x;
+		const int32_t amax = amin + (steep ? c->height : c->width) - 1;
+		const int32_t bmin = steep ? c->x : c->y;
+		const int32_t bmax = bmin + (steep ? c->width : c->height) - 1;
+
+		// Steps whose major coordinate is inside
+		const int64_t alo = sa > 0 ? amin - a0 : a0 - amax;
+		const int64_t ahi = sa > 0 ? amax - a0 : a0 - amin;
+		i0 = alo > i0 ? alo : i0;
+		i1 = ahi < i1 ? ahi : i1;
+
+		// Steps whose minor offset q(i) is inside [qlo, qhi]
+		const int64_t qlo = sb > 0 ? bmin - b0 : b0 - bmax;
+		const int64_t qhi = sb > 0 ? bmax - b0 : b0 - bmin;
+		if (db == 0) {
+			if (qlo > 0 || qhi < 0) {
+				return;
+			}
+		} else {
+			const int64_t lo =
+				-i_fbgl_floor_div(da - 2 * qlo * da, 2 * db);
+			const int64_t hi = i_fbgl_floor_div(
+				2 * (qhi + 1) * da - da - 1, 2 * db);
+			i0 = lo > i0 ? lo : i0;
+			i1 = hi < i1 ? hi : i1;
+		}
+		if (i0 > i1) {
+			return;
+		}
+	}
+
+	// Resume the error term at step i0
+	const int64_t n = 2 * i0 * db + da;
+	const int64_t q = i_fbgl_floor_div(n, 2 * da);
+	const int32_t a = a0 + sa * (int32_t)i0;
+	const int32_t b = b0 + sb * (int32_t)q;
+
+	const ptrdiff_t pitch = fb->pitch;
+	const ptrdiff_t bpp = fb->ops.bytes_per_pixel;
+	fb->ops.line(steep ? i_fbgl_pixel_addr(fb, b, a) :
+			     i_fbgl_pixel_addr(fb, a, b),
+		     steep ? sa * pitch : sa * bpp,
+		     steep ? sb * bpp : sb * pitch, n - q * 2 * da, 2 * db,
+		     2 * da, (int32_t)(i1 - i0 + 1), native);
+}
+
+// Pixel bounds [x0, x1) x [y0, y1) of count > 0 points
+static void i_fbgl_points_box(fbgl_point_t const *points, int32_t count,
+			      int32_t *x0, int32_t *y0, int32_t *x1,
+			      int32_t *y1)
+{
+	*x0 = *x1 = points[0].x;
+	*y0 = *y1 = points[0].y;
+	for (int32_t i = 1; i < count; i++) {
+		*x0 = points[i].x < *x0 ? points[i].x : *x0;
+		*y0 = points[i].y < *y0 ? points[i].y : *y0;
+		*x1 = points[i].x > *x1 ? points[i].x : *x1;
+		*y1 = points[i].y > *y1 ? points[i].y : *y1;
+	}
+	++*x1;
+	++*y1;
+}
+
+// Damage the clipped bounding box of points, false if it is empty
+static bool i_fbgl_damage_points(fbgl_t *fb, fbgl_point_t const *points,
+				 int32_t count)
+{
+	int32_t x0, y0, x1, y1;
+	i_fbgl_points_box(points, count, &x0, &y0, &x1, &y1);
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return false;
+	}
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+	return true;
+}
+
+void fbgl_draw_line(fbgl_point_t x, fbgl_point_t y, uint32_t color,
+		    fbgl_t *buffer)
+{
+	if (i_fbgl_deferring(buffer)) {
+		const int32_t args[4] = { x.x, x.y, y.x, y.y };
+		const fbgl_point_t ends[2] = { x, y };
+		int32_t x0, y0, x1, y1;
+		i_fbgl_points_box(ends, 2, &x0, &y0, &x1, &y1);
+		if (i_fbgl_record(buffer, I_FBGL_CMD_LINE, x0, y0, x1, y1,
+				  color, args, 4, NULL, NULL, 0)) {
+			return;
+		}
+	}
+
+	const fbgl_point_t ends[2] = { x, y };
+	if (!i_fbgl_damage_points(buffer, ends, 2)) {
+		return;
+	}
+
+	i_fbgl_line(buffer, x.x, x.y, y.x, y.y,
+		    buffer->ops.map_color(color));
+}
+
+// Batches map the color and record damage once for all segments
+void fbgl_draw_polyline(fbgl_point_t const *points, int32_t count, bool closed,
+			uint32_t color, fbgl_t *fb)
+{
+	// Deferred segments are binned one by one
+	if (i_fbgl_deferring(fb) && points && count > 0) {
+		if (count == 1) {
+			fbgl_draw_line(points[0], points[0], color, fb);
+		}
+		for (int32_t i = 0; i + 1 < count; i++) {
+			fbgl_draw_line(points[i], points[i + 1], color, fb);
+		}
+		if (closed && count > 2) {
+			fbgl_draw_line(points[count - 1], points[0], color, fb);
+		}
+		return;
+	}
+
+	if (!fb || !points || count < 1 ||
+	    !i_fbgl_damage_points(fb, points, count)) {
+		return;
+	}
+
+	const uint32_t native = fb->ops.map_color(color);
+	if (count == 1) {
+		i_fbgl_line(fb, points[0].x, points[0].y, points[0].x,
+			    points[0].y, native);
+		return;
+	}
+	for (int32_t i = 0; i + 1 < count; i++) {
+		i_fbgl_line(fb, points[i].x, points[i].y, points[i + 1].x,
+			    points[i + 1].y, native);
+	}
+	if (closed && count > 2) {
+		i_fbgl_line(fb, points[count - 1].x, points[count - 1].y,
+			    points[0].x, points[0].y, native);
+	}
+}
+
+void fbgl_draw_lines(fbgl_point_t const *points, int32_t count, uint32_t color,
+		     fbgl_t *fb)
+{
+	count &= ~1;
+	if (i_fbgl_deferring(fb) && points) {
+		for (int32_t i = 0; i < count; i += 2) {
+			fbgl_draw_line(points[i], points[i + 1], color, fb);
+		}
+		return;
+	}
+	if (!fb || !points || count < 2 ||
+	    !i_fbgl_damage_points(fb, points, count)) {
+		return;
+	}
+
+	const uint32_t native = fb->ops.map_color(color);
+	for (int32_t i = 0; i < count; i += 2) {
+		i_fbgl_line(fb, points[i].x, points[i].y, points[i + 1].x,
+			    points[i + 1].y, native);
+	}
+}
+
+void fbgl_draw_rectangle_outline(fbgl_point_t top_left,
+				 fbgl_point_t bottom_right, uint32_t color,
+				 fbgl_t *fb)
+{
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[4] = { top_left.x, top_left.y,
+					  bottom_right.x, bottom_right.y };
+		if (i_fbgl_record(fb, I_FBGL_CMD_RECT, top_left.x, top_left.y,
+				  bottom_right.x, bottom_right.y, color, args,
+				  4, NULL, NULL, 0)) {
+			return;
+		}
+	}
+
+	int32_t x0 = top_left.x;
+	int32_t y0 = top_left.y;
+	int32_t x1 = bottom_right.x;
+	int32_t y1 = bottom_right.y;
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+
+	const uint32_t native = fb->ops.map_color(color);
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+
+	// Top and bottom horizontal lines
+	i_fbgl_hspan(fb, top_left.y, top_left.x, bottom_right.x, native);
+	i_fbgl_hspan(fb, bottom_right.y - 1, top_left.x, bottom_right.x,
+		     native);
+
+	// Left and right vertical lines
+	i_fbgl_vspan(fb, top_left.x, top_left.y, bottom_right.y, native);
+	i_fbgl_vspan(fb, bottom_right.x - 1, top_left.y, bottom_right.y,
+		     native);
+}
+
+void fbgl_draw_rectangle_filled(fbgl_point_t top_left,
+				fbgl_point_t bottom_right, uint32_t color,
+				fbgl_t *fb)
+{
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[4] = { top_left.x, top_left.y,
+					  bottom_right.x, bottom_right.y };
+		if (i_fbgl_record(fb, I_FBGL_CMD_RECT_FILLED, top_left.x,
+				  top_left.y, bottom_right.x, bottom_right.y,
+				  color, args, 4, NULL, NULL, 0)) {
+			return;
+		}
+	}
+
+	int32_t x0 = top_left.x;
+	int32_t y0 = top_left.y;
+	int32_t x1 = bottom_right.x;
+	int32_t y1 = bottom_right.y;
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+
+	const uint32_t native = fb->ops.map_color(color);
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+
+	for (int32_t y = y0; y < y1; y++) {
+		fb->ops.fill(i_fbgl_pixel_addr(fb, x0, y), native, x1 - x0);
+	}
+}
+
+#define I_FBGL_BLEND_CHUNK 64
+
+// Composite count premultiplied pixels over the draw target at dst.
+// Other formats are converted through a small XRGB8888 buffer, and so is
+// device memory, which is slow to read in small pieces.
+static void i_fbgl_blend_pixels(fbgl_t const *fb, uint8_t *dst,
+				const uint32_t *src, int32_t count,
+				uint32_t opacity)
+{
+	if (fb->format == FBGL_FORMAT_XRGB8888 && !fb->stream_stores) {
+		i_fbgl_blend((uint32_t *)dst, src, count, opacity);
+		return;
+	}
+
+	const bool stream = fb->stream_stores &&
+			    fb->format == FBGL_FORMAT_XRGB8888;
+	uint32_t buffer[I_FBGL_BLEND_CHUNK];
+	while (count > 0) {
+		const int32_t n = count < I_FBGL_BLEND_CHUNK ?
+					  count :
+					  I_FBGL_BLEND_CHUNK;
+		fb->ops.read(buffer, dst, n);
+		i_fbgl_blend(buffer, src, n, opacity);
+		if (stream) {
+			i_fbgl_stream_copy(dst, (const uint8_t *)buffer,
+					   (size_t)n * 4);
+		} else {
+			fb->ops.blit(dst, buffer, n);
+		}
+		dst += (size_t)n * fb->ops.bytes_per_pixel;
+		src += n;
+		count -= n;
+	}
+}
+
+typedef struct i_fbgl_blend_job {
+	fbgl_t const *fb;
+	int32_t x0, y0, x1;
+	uint32_t color[I_FBGL_BLEND_CHUNK]; // Premultiplied
+} i_fbgl_blend_job_t;
+
+static void i_fbgl_blend_rows(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_blend_job_t *job = (const i_fbgl_blend_job_t *)ctx;
+	fbgl_t const *fb = job->fb;
+	const size_t chunk_bytes =
+		(size_t)I_FBGL_BLEND_CHUNK * fb->ops.bytes_per_pixel;
+
+	for (int32_t y = job->y0 + begin; y < job->y0 + end; y++) {
+		uint8_t *dst = i_fbgl_pixel_addr(fb, job->x0, y);
+		for (int32_t x = job->x0; x < job->x1;
+		     x += I_FBGL_BLEND_CHUNK) {
+			const int32_t n = job->x1 - x < I_FBGL_BLEND_CHUNK ?
+						  job->x1 - x :
+						  I_FBGL_BLEND_CHUNK;
+			i_fbgl_blend_pixels(fb, dst, job->color, n, 255);
+			dst += chunk_bytes;
+		}
+	}
+	if (fb->stream_stores) {
+		i_fbgl_stream_fence();
+	}
+}
+
+void fbgl_fill_rect_blend(fbgl_point_t top_left, fbgl_point_t bottom_right,
+			  uint32_t argb, fbgl_t *fb)
+{
+	if ((argb >> 24) == 0xFF) {
+		fbgl_draw_rectangle_filled(top_left, bottom_right, argb, fb);
+		return;
+	}
+	if ((argb >> 24) == 0) {
+		return;
+	}
+
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[4] = { top_left.x, top_left.y,
+					  bottom_right.x, bottom_right.y };
+		if (i_fbgl_record(fb, I_FBGL_CMD_RECT_BLEND, top_left.x,
+				  top_left.y, bottom_right.x, bottom_right.y,
+				  argb, args, 4, NULL, NULL, 0)) {
+			return;
+		}
+	}
+
+	i_fbgl_blend_job_t job = { fb, top_left.x, top_left.y, bottom_right.x,
+				   { 0 } };
+	int32_t y1 = bottom_right.y;
+	if (!i_fbgl_clip_box(fb, &job.x0, &job.y0, &job.x1, &y1)) {
+		return;
+	}
+	const uint32_t color = fbgl_premultiply(argb);
+	for (int32_t i = 0; i < I_FBGL_BLEND_CHUNK; i++) {
+		job.color[i] = color;
+	}
+
+	i_fbgl_damage(fb, job.x0, job.y0, job.x1, y1);
+	i_fbgl_parallel_for(i_fbgl_blend_rows, &job, y1 - job.y0,
+			    i_fbgl_row_grain((size_t)(job.x1 - job.x0) * 4));
+}
+
+// Plot the eight symmetric points of a circle octant step
+FBGL_INLINE void i_fbgl_circle_points(fbgl_t *fb, int x, int y, int xx, int yy,
+				      uint32_t native, const bool clipped)
+{
+	const int32_t px[8] = { x + xx, x - xx, x + xx, x - xx,
+				x + yy, x - yy, x + yy, x - yy };
+	const int32_t py[8] = { y + yy, y + yy, y - yy, y - yy,
+				y + xx, y + xx, y - xx, y - xx };
+	for (int i = 0; i < 8; i++) {
+		if (!clipped || i_fbgl_in_clip(fb, px[i], py[i])) {
+			i_fbgl_plot(fb, px[i], py[i], native);
+		}
+	}
+}
+
+void fbgl_draw_circle_outline(int x, int y, int radius, uint32_t color,
+			      fbgl_t *fb)
+{
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[3] = { x, y, radius };
+		if (i_fbgl_record(fb, I_FBGL_CMD_CIRCLE, x - radius, y - radius,
+				  x + radius + 1, y + radius + 1, color, args,
+				  3, NULL, NULL, 0)) {
+			return;
+		}
+	}
+
+	int f = 1 - radius;
+	int ddF_x = 1;
+	int ddF_y = -2 * radius;
+	int xx = 0;
+	int yy = radius;
+	const uint32_t native = fb->ops.map_color(color);
+
+	int32_t x0 = x - radius;
+	int32_t y0 = y - radius;
+	int32_t x1 = x + radius + 1;
+	int32_t y1 = y + radius + 1;
+	if (radius < 0 || !i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+
+	// Only circles that cross the clip edge test each point
+	const bool clipped = x0 != x - radius || y0 != y - radius ||
+			     x1 != x + radius + 1 || y1 != y + radius + 1;
+
+	i_fbgl_circle_points(fb, x, y, 0, radius, native, clipped);
+
+	while (xx < yy) {
+		if (f >= 0) {
+			yy--;
+			ddF_y += 2;
+			f += ddF_y;
+		}
+		xx++;
+		ddF_x += 2;
+		f += ddF_x;
+
+		i_fbgl_circle_points(fb, x, y, xx, yy, native, clipped);
+	}
+}
+
+/**
+ * Span rasterizer
+ */
+// Emit one clipped span per row of the ellipse
+// x^2 * ry^2 + dy^2 * rx^2 <= rx^2 * ry^2 + rx * ry * (rx + ry) / 2,
+// which for rx == ry is the usual x^2 + dy^2 <= r^2 + r circle. The half
+// width is seeded once at the first visible row and then only nudged as
+// dy changes, so rows cost no square roots.
+static void i_fbgl_ellipse_spans(fbgl_t *fb, int x, int y, int rx, int ry,
+				 uint32_t native)
+{
+	int32_t x0 = x - rx;
+	int32_t y0 = y - ry;
+	int32_t x1 = x + rx + 1;
+	int32_t y1 = y + ry + 1;
+	if (rx < 0 || ry < 0 || !i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+
+	// limit stays below 1.5 * (rx * ry)^2, which int64 holds while
+	// rx * ry <= 2^31. Larger ellipses are solved per row in long double,
+	// where the last bit of rounding cannot be seen.
+	if ((int64_t)rx * ry > (int64_t)1 << 31) {
+		const long double wx2 = (long double)rx * rx;
+		const long double wy2 = (long double)ry * ry;
+		const long double wlimit =
+			wx2 * wy2 +
+			(long double)rx * ry * ((long double)rx + ry) / 2;
+		for (int32_t row = y0; row < y1; row++) {
+			const long double dy = (long double)row - y;
+			const long double rest = wlimit - dy * dy * wx2;
+			long double half = floorl(sqrtl(rest / wy2));
+			half = half > rx ? rx : half;
+			i_fbgl_hspan(fb, row, x - (int32_t)half,
+				     x + (int32_t)half + 1, native);
+		}
+		return;
+	}
+
+	const int64_t rx2 = (int64_t)rx * rx;
+	const int64_t ry2 = (int64_t)ry * ry;
+	const int64_t limit =
+		rx2 * ry2 + (int64_t)rx * ry * ((int64_t)rx + ry) / 2;
+
+	// The rounding slack must not widen flat ellipses past rx
+	int64_t dy = y0 - y;
+	int64_t half = rx;
+	if (ry != 0) {
+		half = i_fbgl_sqrt_int64((limit - dy * dy * rx2) / ry2);
+		half = half > rx ? rx : half;
+	}
+
+	for (int32_t row = y0; row < y1; row++, dy++) {
+		const int64_t rest = limit - dy * dy * rx2;
+		while (ry && half < rx &&
+		       (half + 1) * (half + 1) * ry2 <= rest) {
+			half++;
+		}
+		while (ry && half * half * ry2 > rest) {
+			half--;
+		}
+		i_fbgl_hspan(fb, row, x - (int32_t)half, x + (int32_t)half + 1,
+			     native);
+	}
+}
+
+// Polygon edge, walked one row at a time. Pixels are sampled at their
+// centers: the edge crosses row r at x(r) and a span starting or ending
+// there covers pixels from ceil(x(r) - 0.5). That value is kept exactly as
+// floor(n / den) + rem / den and advanced with integer adds.
+typedef struct i_fbgl_edge {
+	int32_t y0; // First row whose center the edge crosses
+	int32_t y1; // One past the last row
+	int32_t winding; // +1 going down, -1 going up
+	int64_t x; // floor of the crossing
+	int64_t rem; // Remainder in [0, den)
+	int64_t den;
+	int64_t step_x;
+	int64_t step_rem;
+} i_fbgl_edge_t;
+
+// Set up the edge from a to b, false if it crosses no row center
+static bool i_fbgl_edge_init(i_fbgl_edge_t *e, fbgl_point_t a, fbgl_point_t b)
+{
+	e->winding = 1;
+	if (a.y > b.y) {
+		const fbgl_point_t t = a;
+		a = b;
+		b = t;
+		e->winding = -1;
+	}
+	if (a.y == b.y) {
+		return false;
+	}
+
+	// Vertices are integers, so rows a.y .. b.y - 1 have their centers
+	// inside the edge's y extent
+	e->y0 = a.y;
+	e->y1 = b.y;
+	e->den = 2 * (int64_t)(b.y - a.y);
+
+	const int64_t dx2 = 2 * (int64_t)(b.x - a.x);
+	e->step_x = i_fbgl_floor_div(dx2, e->den);
+	e->step_rem = dx2 - e->step_x * e->den;
+
+	// den * (x(r) - 0.5) at the first row
+	const int64_t n = (int64_t)a.x * e->den + (dx2 - e->den) / 2;
+	e->x = i_fbgl_floor_div(n, e->den);
+	e->rem = n - e->x * e->den;
+	return true;
+}
+
+FBGL_INLINE void i_fbgl_edge_step(i_fbgl_edge_t *e)
+{
+	e->x += e->step_x;
+	e->rem += e->step_rem;
+	if (e->rem >= e->den) {
+		e->rem -= e->den;
+		e->x++;
+	}
+}
+
+// Move the edge down to row, used when the clip rect cuts its top off
+static void i_fbgl_edge_seek(i_fbgl_edge_t *e, int32_t row)
+{
+	if (row <= e->y0) {
+		return;
+	}
+	const int64_t rows = row - e->y0;
+	const int64_t rem = e->rem + rows * e->step_rem;
+	e->x += rows * e->step_x + i_fbgl_floor_div(rem, e->den);
+	e->rem = rem - i_fbgl_floor_div(rem, e->den) * e->den;
+	e->y0 = row;
+}
+
+// First pixel at or right of the crossing
+FBGL_INLINE int32_t i_fbgl_edge_pixel(i_fbgl_edge_t const *e)
+{
+	const int64_t x = e->x + (e->rem != 0);
+	return x < INT32_MIN ? INT32_MIN : x > INT32_MAX ? INT32_MAX :
+							  (int32_t)x;
+}
+
+void fbgl_draw_circle_filled(int x, int y, int radius, uint32_t color,
+			     fbgl_t *fb)
+{
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[3] = { x, y, radius };
+		if (i_fbgl_record(fb, I_FBGL_CMD_CIRCLE_FILLED, x - radius,
+				  y - radius, x + radius + 1, y + radius + 1,
+				  color, args, 3, NULL, NULL, 0)) {
+			return;
+		}
+	}
+
+	i_fbgl_ellipse_spans(fb, x, y, radius, radius,
+			     fb->ops.map_color(color));
+}
+
+void fbgl_draw_ellipse_filled(int x, int y, int rx, int ry, uint32_t color,
+			      fbgl_t *fb)
+{
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[4] = { x, y, rx, ry };
+		if (i_fbgl_record(fb, I_FBGL_CMD_ELLIPSE_FILLED, x - rx, y - ry,
+				  x + rx + 1, y + ry + 1, color, args, 4, NULL,
+				  NULL, 0)) {
+			return;
+		}
+	}
+
+	i_fbgl_ellipse_spans(fb, x, y, rx, ry, fb->ops.map_color(color));
+}
+
+void fbgl_draw_triangle_filled(fbgl_point_t a, fbgl_point_t b, fbgl_point_t c,
+			       uint32_t color, fbgl_t *fb)
+{
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[6] = { a.x, a.y, b.x, b.y, c.x, c.y };
+		const fbgl_point_t corners[3] = { a, b, c };
+		int32_t x0, y0, x1, y1;
+		i_fbgl_points_box(corners, 3, &x0, &y0, &x1, &y1);
+		if (i_fbgl_record(fb, I_FBGL_CMD_TRIANGLE, x0, y0, x1, y1,
+				  color, args, 6, NULL, NULL, 0)) {
+			return;
+		}
+	}
+
+	// Sort by y: a on top, c at the bottom
+	fbgl_point_t t;
+	if (a.y > b.y) {
+		t = a, a = b, b = t;
+	}
+	if (b.y > c.y) {
+		t = b, b = c, c = t;
+	}
+	if (a.y > b.y) {
+		t = a, a = b, b = t;
+	}
+
+	const int32_t minx = a.x < b.x ? (a.x < c.x ? a.x : c.x) :
+					 (b.x < c.x ? b.x : c.x);
+	const int32_t maxx = a.x > b.x ? (a.x > c.x ? a.x : c.x) :
+					 (b.x > c.x ? b.x : c.x);
+	int32_t x0 = minx;
+	int32_t y0 = a.y;
+	int32_t x1 = maxx;
+	int32_t y1 = c.y;
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+
+	const uint32_t native = fb->ops.map_color(color);
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+
+	// The long edge a-c spans all rows, the short ones meet at b
+	i_fbgl_edge_t ac, ab, bc;
+	i_fbgl_edge_init(&ac, a, c);
+	i_fbgl_edge_seek(&ac, y0);
+	const bool upper = i_fbgl_edge_init(&ab, a, b);
+	const bool lower = i_fbgl_edge_init(&bc, b, c);
+
+	for (int pass = 0; pass < 2; pass++) {
+		i_fbgl_edge_t *e = pass == 0 ? &ab : &bc;
+		if (!(pass == 0 ? upper : lower)) {
+			continue;
+		}
+
+		const int32_t top = e->y0 > y0 ? e->y0 : y0;
+		const int32_t bottom = e->y1 < y1 ? e->y1 : y1;
+		i_fbgl_edge_seek(e, top);
+
+		for (int32_t row = top; row < bottom; row++) {
+			const int32_t xa = i_fbgl_edge_pixel(&ac);
+			const int32_t xb = i_fbgl_edge_pixel(e);
+			i_fbgl_hspan(fb, row, xa < xb ? xa : xb,
+				     xa < xb ? xb : xa, native);
+			i_fbgl_edge_step(&ac);
+			i_fbgl_edge_step(e);
+		}
+	}
+}
+
+// Scanline fill with an active edge table. Edges are sorted by their
+// first row and enter the active list as the scan reaches them; the active
+// list is kept sorted by crossing with an insertion sort, which is close
+// to linear since crossings rarely swap between rows.
+void fbgl_draw_polygon_filled(fbgl_point_t const *points, int32_t count,
+			      fbgl_fill_rule_t rule, uint32_t color,
+			      fbgl_t *fb)
+{
+	if (!fb || !points || count < 3) {
+		return;
+	}
+
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[2] = { count, rule };
+		int32_t x0, y0, x1, y1;
+		i_fbgl_points_box(points, count, &x0, &y0, &x1, &y1);
+		if (i_fbgl_record(fb, I_FBGL_CMD_POLYGON, x0, y0, x1, y1, color,
+				  args, 2, NULL, points,
+				  count * sizeof(*points))) {
+			return;
+		}
+	}
+
+	int32_t x0 = points[0].x;
+	int32_t y0 = points[0].y;
+	int32_t x1 = points[0].x;
+	int32_t y1 = points[0].y;
+	for (int32_t i = 1; i < count; i++) {
+		x0 = points[i].x < x0 ? points[i].x : x0;
+		y0 = points[i].y < y0 ? points[i].y : y0;
+		x1 = points[i].x > x1 ? points[i].x : x1;
+		y1 = points[i].y > y1 ? points[i].y : y1;
+	}
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+
+	// Small polygons keep their edges on the stack
+	i_fbgl_edge_t stack_edges[32];
+	i_fbgl_edge_t *stack_active[32];
+	i_fbgl_edge_t *edges = stack_edges;
+	i_fbgl_edge_t **active = stack_active;
+	if (count > 32) {
+		edges = (i_fbgl_edge_t *)malloc(count * sizeof(*edges));
+		active = (i_fbgl_edge_t **)malloc(count * sizeof(*active));
+		if (!edges || !active) {
+			perror("Failed to allocate polygon edges");
+			free(edges);
+			free(active);
+			return;
+		}
+	}
+
+	// Edge table sorted by first row, edges above the clip rect dropped
+	int32_t edge_count = 0;
+	for (int32_t i = 0; i < count; i++) {
+		i_fbgl_edge_t e;
+		if (!i_fbgl_edge_init(&e, points[i], points[(i + 1) % count]) ||
+		    e.y1 <= y0) {
+			continue;
+		}
+		i_fbgl_edge_seek(&e, y0);
+
+		int32_t j = edge_count++;
+		for (; j > 0 && edges[j - 1].y0 > e.y0; j--) {
+			edges[j] = edges[j - 1];
+		}
+		edges[j] = e;
+	}
+
+	const uint32_t native = fb->ops.map_color(color);
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+
+	int32_t next = 0;
+	int32_t active_count = 0;
+	for (int32_t row = y0; row < y1; row++) {
+		// Retire finished edges, admit the ones starting here
+		int32_t kept = 0;
+		for (int32_t i = 0; i < active_count; i++) {
+			if (active[i]->y1 > row) {
+				active[kept++] = active[i];
+			}
+		}
+		active_count = kept;
+		while (next < edge_count && edges[next].y0 <= row) {
+			active[active_count++] = &edges[next++];
+		}
+
+		for (int32_t i = 1; i < active_count; i++) {
+			i_fbgl_edge_t *e = active[i];
+			const int32_t x = i_fbgl_edge_pixel(e);
+			int32_t j = i;
+			for (; j > 0 && i_fbgl_edge_pixel(active[j - 1]) > x;
+			     j--) {
+				active[j] = active[j - 1];
+			}
+			active[j] = e;
+		}
+
+		int32_t winding = 0;
+		for (int32_t i = 0; i + 1 < active_count; i++) {
+			winding += rule == FBGL_FILL_NONZERO ?
+					   active[i]->winding :
+					   1;
+			const bool inside = rule == FBGL_FILL_NONZERO ?
+						    winding != 0 :
+						    (winding & 1) != 0;
+			if (inside) {
+				i_fbgl_hspan(fb, row,
+					     i_fbgl_edge_pixel(active[i]),
+					     i_fbgl_edge_pixel(active[i + 1]),
+					     native);
+			}
+		}
+
+		for (int32_t i = 0; i < active_count; i++) {
+			i_fbgl_edge_step(active[i]);
+		}
+	}
+
+	if (edges != stack_edges) {
+		free(edges);
+		free(active);
+	}
+}
+
+// A whole file in memory: mapped when possible, read otherwise
+typedef struct i_fbgl_file {
+	const uint8_t *data;
+	size_t size;
+	bool mapped;
+} i_fbgl_file_t;
+
+static int i_fbgl_file_open(i_fbgl_file_t *file, const char *path)
+{
+	file->data = NULL;
+	file->size = 0;
+	file->mapped = false;
+
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror("Unable to open file");
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, (size_t)st.st_size, PROT_READ,
+				 MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			posix_madvise(map, (size_t)st.st_size,
+				      POSIX_MADV_SEQUENTIAL);
+			close(fd);
+			file->data = (const uint8_t *)map;
+			file->size = (size_t)st.st_size;
+			file->mapped = true;
+			return 0;
+		}
+	}
+
+	// Pipes and filesystems without mmap: read it all
+	uint8_t *buffer = NULL;
+	size_t capacity = 0;
+	for (;;) {
+		if (file->size == capacity) {
+			capacity = capacity ? capacity * 2 : 65536;
+			uint8_t *grown = (uint8_t *)realloc(buffer, capacity);
+			if (!grown) {
+				perror("Failed to allocate file buffer");
+				free(buffer);
+				close(fd);
+				return -1;
+			}
+			buffer = grown;
+		}
+		const ssize_t n =
+			read(fd, buffer + file->size, capacity - file->size);
+		if (n < 0) {
+			perror("Error reading file");
+			free(buffer);
+			close(fd);
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		file->size += (size_t)n;
+	}
+	close(fd);
+	file->data = buffer;
+	return 0;
+}
+
+static void i_fbgl_file_close(i_fbgl_file_t *file)
+{
+	if (file->mapped) {
+		munmap((void *)file->data, file->size);
+	} else {
+		free((void *)file->data);
+	}
+	file->data = NULL;
+}
+
+// Expand RLE packets into count pixels of bpp bytes each. Returns false
+// if the data ends first.
+static bool i_fbgl_tga_unrle(uint8_t *dst, size_t count, size_t bpp,
+			     const uint8_t *src, size_t size)
+{
+	size_t pos = 0;
+	while (count > 0) {
+		if (pos >= size) {
+			return false;
+		}
+		const uint8_t packet = src[pos++];
+		const size_t n = (size_t)(packet & 0x7F) + 1;
+		const size_t fill = n < count ? n : count;
+		if (packet & 0x80) {
+			if (size - pos < bpp) {
+				return false;
+			}
+			// Store the pixel once, then double what is stored
+			memcpy(dst, src + pos, bpp);
+			for (size_t done = 1; done < fill; done *= 2) {
+				const size_t copy =
+					done < fill - done ? done : fill - done;
+				memcpy(dst + done * bpp, dst, copy * bpp);
+			}
+			pos += bpp;
+		} else {
+			if (size - pos < n * bpp) {
+				return false;
+			}
+			memcpy(dst, src + pos, fill * bpp);
+			pos += n * bpp;
+		}
+		dst += fill * bpp;
+		count -= fill;
+	}
+	return true;
+}
+
+typedef struct i_fbgl_tga_job {
+	uint32_t *data;
+	const uint8_t *pixels; // Rows in file order
+	int32_t width;
+	int32_t height;
+	int32_t bpp; // Bytes per stored pixel
+	bool bottom_up;
+	bool right_to_left;
+} i_fbgl_tga_job_t;
+
+static void i_fbgl_tga_rows(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_tga_job_t *job = (const i_fbgl_tga_job_t *)ctx;
+	const i_fbgl_convert_fn convert = job->bpp == 1 ? i_fbgl_gray_scalar :
+					  job->bpp == 3 ? i_fbgl_convert_bgr :
+							  i_fbgl_convert_bgra;
+	const size_t row_bytes = (size_t)job->width * job->bpp;
+
+	for (int32_t y = begin; y < end; y++) {
+		const int32_t ty = job->bottom_up ? job->height - 1 - y : y;
+		uint32_t *row = job->data + (size_t)ty * job->width;
+		convert(row, job->pixels + (size_t)y * row_bytes, job->width);
+		if (job->right_to_left) {
+			for (int32_t a = 0, b = job->width - 1; a < b;
+			     a++, b--) {
+				const uint32_t t = row[a];
+				row[a] = row[b];
+				row[b] = t;
+			}
+		}
+	}
+}
+
+// Decode a TGA image, spreading the conversion over the pool if parallel
+static fbgl_tga_texture_t *i_fbgl_tga_decode(const void *data, size_t size,
+					     bool parallel)
+{
+	const uint8_t *header = (const uint8_t *)data;
+	if (!data || size < 18) {
+		fprintf(stderr, "Error: TGA data too short for a header.\n");
+		return NULL;
+	}
+
+	const uint8_t image_type = header[2];
+	const int32_t width = header[12] | (header[13] << 8);
+	const int32_t height = header[14] | (header[15] << 8);
+	const uint8_t bits_per_pixel = header[16];
+	const uint8_t image_descriptor = header[17];
+
+	// Truecolor (2) and grayscale (3) images, raw or RLE (+8)
+	const bool rle = image_type == 10 || image_type == 11;
+	const bool gray = image_type == 3 || image_type == 11;
+	if (image_type != 2 && image_type != 3 && !rle) {
+		fprintf(stderr, "Unsupported TGA image type: %d\n",
+			image_type);
+		return NULL;
+	}
+	if (gray ? bits_per_pixel != 8 :
+		   bits_per_pixel != 24 && bits_per_pixel != 32) {
+		fprintf(stderr, "Unsupported TGA bit depth for type %d: %d\n",
+			image_type, bits_per_pixel);
+		return NULL;
+	}
+	if (width == 0 || height == 0) {
+		fprintf(stderr, "Error: TGA image is empty.\n");
+		return NULL;
+	}
+
+	// Skip the image ID and any color map, which truecolor ignores
+	const size_t color_map = header[1] ? (size_t)(header[5] |
+						      (header[6] << 8)) *
+						     ((header[7] + 7) / 8) :
+					     0;
+	const size_t offset = 18 + header[0] + color_map;
+	const size_t bpp = bits_per_pixel / 8;
+	const size_t pixel_count = (size_t)width * height;
+	if (offset > size || (!rle && size - offset < pixel_count * bpp)) {
+		fprintf(stderr, "Error: TGA pixel data is truncated.\n");
+		return NULL;
+	}
+
+	fbgl_tga_texture_t *texture =
+		(fbgl_tga_texture_t *)calloc(1, sizeof(fbgl_tga_texture_t));
+	if (!texture) {
+		perror("Failed to allocate texture structure");
+		return NULL;
+	}
+	texture->width = (uint16_t)width;
+	texture->height = (uint16_t)height;
+	texture->data = (uint32_t *)malloc(pixel_count * sizeof(uint32_t));
+	if (!texture->data) {
+		perror("Failed to allocate pixel data");
+		free(texture);
+		return NULL;
+	}
+
+	const uint8_t *pixels = header + offset;
+	uint8_t *expanded = NULL;
+	if (rle) {
+		expanded = (uint8_t *)malloc(pixel_count * bpp);
+		if (!expanded) {
+			perror("Failed to allocate RLE buffer");
+			fbgl_destroy_texture(texture);
+			return NULL;
+		}
+		if (!i_fbgl_tga_unrle(expanded, pixel_count, bpp, pixels,
+				      size - offset)) {
+			fprintf(stderr, "Error: TGA RLE data is truncated.\n");
+			free(expanded);
+			fbgl_destroy_texture(texture);
+			return NULL;
+		}
+		pixels = expanded;
+	}
+
+	// Convert whole rows, writing bottom-up images from the last row
+	i_fbgl_select_simd();
+	i_fbgl_tga_job_t job = { texture->data,
+				 pixels,
+				 width,
+				 height,
+				 (int32_t)bpp,
+				 !(image_descriptor & 0x20),
+				 (image_descriptor & 0x10) != 0 };
+	i_fbgl_parallel_for(i_fbgl_tga_rows, &job, height,
+			    parallel ? i_fbgl_row_grain((size_t)width * 4) :
+				       height);
+	free(expanded);
+
+	// Without runs the texture still draws, only slower
+	fbgl_texture_update_runs(texture);
+	return texture;
+}
+
+fbgl_tga_texture_t *fbgl_load_tga_texture_memory(const void *data,
+						 size_t size)
+{
+	return i_fbgl_tga_decode(data, size, true);
+}
+
+fbgl_tga_texture_t *fbgl_load_tga_texture(const char *path)
+{
+	i_fbgl_file_t file;
+	if (i_fbgl_file_open(&file, path) != 0) {
+		return NULL;
+	}
+	fbgl_tga_texture_t *texture =
+		fbgl_load_tga_texture_memory(file.data, file.size);
+	i_fbgl_file_close(&file);
+	return texture;
+}
+
+/**
+ * QOI and PNG
+ *
+ * Both decode front to back straight into the texture rows. PNG rows
+ * are inflated one at a time, so beside the texture the decoder holds
+ * only the 32 KiB deflate window and two rows: the one being unfiltered
+ * and the one above it. Checksums are not verified, but palette indices
+ * past the PLTE entries are rejected as corrupt.
+ */
+FBGL_INLINE uint32_t i_fbgl_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	       (uint32_t)p[2] << 8 | p[3];
+}
+
+static fbgl_tga_texture_t *i_fbgl_texture_alloc(uint32_t width,
+						uint32_t height)
+{
+	if (width == 0 || height == 0 || width > UINT16_MAX ||
+	    height > UINT16_MAX) {
+		fprintf(stderr, "Unsupported texture size: %ux%u\n", width,
+			height);
+		return NULL;
+	}
+	fbgl_tga_texture_t *texture =
+		(fbgl_tga_texture_t *)calloc(1, sizeof(fbgl_tga_texture_t));
+	if (!texture) {
+		perror("Failed to allocate texture structure");
+		return NULL;
+	}
+	texture->width = (uint16_t)width;
+	texture->height = (uint16_t)height;
+	texture->data = (uint32_t *)malloc((size_t)width * height *
+					   sizeof(uint32_t));
 	if (!texture->data) {
 		perror("Failed to allocate pixel data");
 		free(texture);
-		fclose(file);
 		return NULL;
 	}
-
-	// Read pixel data
-	uint8_t *pixel_buffer = (uint8_t *)malloc(bits_per_pixel / 8);
-	if (!pixel_buffer) {
-		perror("Failed to allocate pixel buffer");
-		free(texture->data);
-		free(texture);
-		fclose(file);
+	return texture;
+}
+
+static fbgl_tga_texture_t *i_fbgl_qoi_decode(const uint8_t *data,
+					     size_t size)
+{
+	if (size < 14 || memcmp(data, "qoif", 4) != 0 ||
+	    (data[12] != 3 && data[12] != 4)) {
+		fprintf(stderr, "Error: invalid QOI header.\n");
+		return NULL;
+	}
+	fbgl_tga_texture_t *texture = i_fbgl_texture_alloc(
+		i_fbgl_be32(data + 4), i_fbgl_be32(data + 8));
+	if (!texture) {
+		return NULL;
+	}
+
+	// The current pixel stays straight alpha, as the ops are defined on it
+	uint32_t index[64] = { 0 };
+	uint8_t r = 0, g = 0, b = 0, a = 255;
+	uint32_t out = 0xFF000000;
+	uint32_t *dst = texture->data;
+	uint32_t *const end = dst + (size_t)texture->width * texture->height;
+	size_t pos = 14;
+	while (dst < end) {
+		if (pos >= size) {
+			fprintf(stderr, "Error: QOI data is truncated.\n");
+			fbgl_destroy_texture(texture);
+			return NULL;
+		}
+		const uint8_t op = data[pos++];
+		size_t run = 1;
+		if (op == 0xFE || op == 0xFF) {
+			const size_t n = op == 0xFE ? 3 : 4;
+			if (size - pos < n) {
+				pos = size;
+				continue;
+			}
+			r = data[pos];
+			g = data[pos + 1];
+			b = data[pos + 2];
+			a = op == 0xFF ? data[pos + 3] : a;
+			pos += n;
+		} else if (op >> 6 == 0) {
+			const uint32_t px = index[op];
+			a = (uint8_t)(px >> 24);
+			r = (uint8_t)(px >> 16);
+			g = (uint8_t)(px >> 8);
+			b = (uint8_t)px;
+		} else if (op >> 6 == 1) {
+			r += ((op >> 4) & 3) - 2;
+			g += ((op >> 2) & 3) - 2;
+			b += (op & 3) - 2;
+		} else if (op >> 6 == 2) {
+			if (pos == size) {
+				continue;
+			}
+			const uint8_t next = data[pos++];
+			const int32_t dg = (op & 0x3F) - 32;
+			r += dg - 8 + (next >> 4);
+			g += dg;
+			b += dg - 8 + (next & 0x0F);
+		} else {
+			run = (size_t)(op & 0x3F) + 1;
+		}
+
+		const uint32_t px = (uint32_t)a << 24 | (uint32_t)r << 16 |
+				    (uint32_t)g << 8 | b;
+		index[(r * 3 + g * 5 + b * 7 + a * 11) % 64] = px;
+		out = a == 255 ? px : fbgl_premultiply(px);
+		run = run < (size_t)(end - dst) ? run : (size_t)(end - dst);
+		for (size_t i = 0; i < run; i++) {
+			dst[i] = out;
+		}
+		dst += run;
+	}
+
+	fbgl_texture_update_runs(texture);
+	return texture;
+}
+
+#define I_FBGL_HUFFMAN_FAST 9
+#define I_FBGL_WINDOW_SIZE 32768
+
+// Canonical Huffman code. fast maps the next I_FBGL_HUFFMAN_FAST input
+// bits to symbol << 4 | length, or 0 when the code is longer.
+typedef struct i_fbgl_huffman {
+	uint16_t fast[1 << I_FBGL_HUFFMAN_FAST];
+	uint16_t count[16]; // Codes per length
+	uint16_t symbol[288]; // Ordered by code
+} i_fbgl_huffman_t;
+
+enum { I_FBGL_BLOCK_NONE, I_FBGL_BLOCK_STORED, I_FBGL_BLOCK_HUFFMAN };
+
+// Inflates the zlib stream spread over a PNG's IDAT chunks on demand
+typedef struct i_fbgl_inflate {
+	const uint8_t *data; // The whole PNG
+	size_t size;
+	size_t pos; // Next byte to load
+	size_t end; // End of the current chunk's data
+	uint64_t bits;
+	int32_t count; // Bits held
+	int32_t pad; // Zero bytes loaded past the IDAT data
+	int32_t block;
+	bool last; // The current block is the final one
+	bool error;
+	uint32_t left; // Bytes left in a stored block
+	uint32_t length; // Bytes left of a match
+	uint32_t distance;
+	size_t written; // Total output, also the window position
+	i_fbgl_huffman_t lit;
+	i_fbgl_huffman_t dist;
+	uint8_t window[I_FBGL_WINDOW_SIZE];
+} i_fbgl_inflate_t;
+
+static uint32_t i_fbgl_inflate_next_chunk(i_fbgl_inflate_t *z)
+{
+	// Skip the CRC; only a directly following IDAT continues the stream.
+	// Empty IDAT chunks are valid and are stepped over.
+	while (z->pos == z->end) {
+		const size_t next = z->end + 4;
+		if (next > z->size || z->size - next < 8 ||
+		    memcmp(z->data + next + 4, "IDAT", 4) != 0 ||
+		    i_fbgl_be32(z->data + next) > z->size - next - 8) {
+			z->pad++;
+			return 0;
+		}
+		z->pos = next + 8;
+		z->end = z->pos + i_fbgl_be32(z->data + next);
+	}
+	return z->data[z->pos++];
+}
+
+FBGL_INLINE void i_fbgl_inflate_need(i_fbgl_inflate_t *z, int32_t n)
+{
+	while (z->count < n) {
+		uint32_t byte;
+		if (z->pos < z->end) {
+			byte = z->data[z->pos++];
+		} else {
+			byte = i_fbgl_inflate_next_chunk(z);
+		}
+		z->bits |= (uint64_t)byte << z->count;
+		z->count += 8;
+	}
+}
+
+FBGL_INLINE uint32_t i_fbgl_inflate_bits(i_fbgl_inflate_t *z, int32_t n)
+{
+	i_fbgl_inflate_need(z, n);
+	const uint32_t value = (uint32_t)(z->bits & ((1ull << n) - 1));
+	z->bits >>= n;
+	z->count -= n;
+	return value;
+}
+
+static bool i_fbgl_huffman_build(i_fbgl_huffman_t *h, const uint8_t *lengths,
+				 int32_t n)
+{
+	uint16_t offset[16];
+	memset(h->count, 0, sizeof(h->count));
+	for (int32_t i = 0; i < n; i++) {
+		h->count[lengths[i]]++;
+	}
+	h->count[0] = 0;
+
+	// Reject over-subscribed codes; incomplete ones fail when decoded
+	int32_t left = 1;
+	offset[1] = 0;
+	for (int32_t len = 1; len < 16; len++) {
+		left = (left << 1) - h->count[len];
+		if (left < 0) {
+			return false;
+		}
+		if (len < 15) {
+			offset[len + 1] = offset[len] + h->count[len];
+		}
+	}
+	for (int32_t i = 0; i < n; i++) {
+		if (lengths[i]) {
+			h->symbol[offset[lengths[i]]++] = (uint16_t)i;
+		}
+	}
+
+	// Codes arrive least significant bit first, so index by the reverse
+	memset(h->fast, 0, sizeof(h->fast));
+	uint32_t code = 0;
+	int32_t index = 0;
+	for (int32_t len = 1; len <= I_FBGL_HUFFMAN_FAST; len++) {
+		for (int32_t k = 0; k < h->count[len]; k++, code++, index++) {
+			uint32_t reversed = 0;
+			for (int32_t bit = 0; bit < len; bit++) {
+				reversed = reversed << 1 | ((code >> bit) & 1);
+			}
+			const uint16_t entry =
+				(uint16_t)(h->symbol[index] << 4 | len);
+			for (uint32_t r = reversed;
+			     r < (1u << I_FBGL_HUFFMAN_FAST); r += 1u << len) {
+				h->fast[r] = entry;
+			}
+		}
+		code <<= 1;
+	}
+	return true;
+}
+
+static int32_t i_fbgl_huffman_decode(i_fbgl_inflate_t *z,
+				     const i_fbgl_huffman_t *h)
+{
+	i_fbgl_inflate_need(z, 15);
+	const uint16_t entry =
+		h->fast[z->bits & ((1u << I_FBGL_HUFFMAN_FAST) - 1)];
+	if (entry) {
+		z->bits >>= entry & 15;
+		z->count -= entry & 15;
+		return entry >> 4;
+	}
+
+	// Longer codes a bit at a time, counting codes of each length
+	int32_t code = 0;
+	int32_t first = 0;
+	int32_t index = 0;
+	for (int32_t len = 1; len < 16; len++) {
+		code |= (int32_t)(z->bits & 1);
+		z->bits >>= 1;
+		z->count--;
+		if (code - first < h->count[len]) {
+			return h->symbol[index + code - first];
+		}
+		index += h->count[len];
+		first = (first + h->count[len]) << 1;
+		code <<= 1;
+	}
+	z->error = true;
+	return 0;
+}
+
+static bool i_fbgl_inflate_tables(i_fbgl_inflate_t *z)
+{
+	static const uint8_t order[19] = { 16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+					   11, 4,  12, 3, 13, 2, 14, 1, 15 };
+	uint8_t lengths[320];
+	const int32_t lit = (int32_t)i_fbgl_inflate_bits(z, 5) + 257;
+	const int32_t dist = (int32_t)i_fbgl_inflate_bits(z, 5) + 1;
+	const int32_t codes = (int32_t)i_fbgl_inflate_bits(z, 4) + 4;
+	if (lit > 286 || dist > 30) {
+		return false;
+	}
+
+	memset(lengths, 0, 19);
+	for (int32_t i = 0; i < codes; i++) {
+		lengths[order[i]] = (uint8_t)i_fbgl_inflate_bits(z, 3);
+	}
+	i_fbgl_huffman_t *lencode = &z->dist;
+	if (!i_fbgl_huffman_build(lencode, lengths, 19)) {
+		return false;
+	}
+
+	for (int32_t i = 0; i < lit + dist && !z->error;) {
+		const int32_t symbol = i_fbgl_huffman_decode(z, lencode);
+		if (symbol < 16) {
+			lengths[i++] = (uint8_t)symbol;
+			continue;
+		}
+		uint8_t value = 0;
+		int32_t repeat;
+		if (symbol == 16) {
+			if (i == 0) {
+				return false;
+			}
+			value = lengths[i - 1];
+			repeat = 3 + (int32_t)i_fbgl_inflate_bits(z, 2);
+		} else if (symbol == 17) {
+			repeat = 3 + (int32_t)i_fbgl_inflate_bits(z, 3);
+		} else {
+			repeat = 11 + (int32_t)i_fbgl_inflate_bits(z, 7);
+		}
+		if (repeat > lit + dist - i) {
+			return false;
+		}
+		memset(lengths + i, value, repeat);
+		i += repeat;
+	}
+	return !z->error && lengths[256] != 0 &&
+	       i_fbgl_huffman_build(&z->lit, lengths, lit) &&
+	       i_fbgl_huffman_build(&z->dist, lengths + lit, dist);
+}
+
+static bool i_fbgl_inflate_block(i_fbgl_inflate_t *z)
+{
+	if (z->last) {
+		return false;
+	}
+	z->last = i_fbgl_inflate_bits(z, 1);
+	const uint32_t type = i_fbgl_inflate_bits(z, 2);
+	if (type == 0) {
+		i_fbgl_inflate_bits(z, z->count & 7);
+		const uint32_t length = i_fbgl_inflate_bits(z, 16);
+		if (i_fbgl_inflate_bits(z, 16) != (~length & 0xFFFF)) {
+			return false;
+		}
+		z->left = length;
+		z->block = I_FBGL_BLOCK_STORED;
+		return true;
+	}
+	if (type == 1) {
+		uint8_t lengths[288];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		i_fbgl_huffman_build(&z->lit, lengths, 288);
+		memset(lengths, 5, 30);
+		i_fbgl_huffman_build(&z->dist, lengths, 30);
+	} else if (type != 2 || !i_fbgl_inflate_tables(z)) {
+		return false;
+	}
+	z->block = I_FBGL_BLOCK_HUFFMAN;
+	return true;
+}
+
+// Inflate exactly size bytes into out, false on corrupt or short data
+static bool i_fbgl_inflate_read(i_fbgl_inflate_t *z, uint8_t *out,
+				size_t size)
+{
+	static const uint16_t length_base[29] = {
+		3,  4,	5,  6,	7,  8,	9,  10,	 11,  13,  15,	17,  19,  23,
+		27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227,
+		258
+	};
+	static const uint8_t length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0,
+						  1, 1, 1, 1, 2, 2, 2, 2,
+						  3, 3, 3, 3, 4, 4, 4, 4,
+						  5, 5, 5, 5, 0 };
+	static const uint16_t distance_base[30] = {
+		1,    2,    3,	  4,	5,    7,     9,	    13,	   17,	  25,
+		33,   49,   65,	  97,	129,  193,   257,   385,   513,	  769,
+		1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+	};
+	static const uint8_t distance_extra[30] = { 0, 0, 0,  0,  1,  1,
+						    2, 2, 3,  3,  4,  4,
+						    5, 5, 6,  6,  7,  7,
+						    8, 8, 9,  9,  10, 10,
+						    11, 11, 12, 12, 13, 13 };
+	const size_t mask = I_FBGL_WINDOW_SIZE - 1;
+	uint8_t *window = z->window;
+	size_t written = z->written; // Kept local, as out may alias z
+
+	while (size > 0 && !z->error) {
+		if (z->length) {
+			const size_t from = written - z->distance;
+			const uint32_t n =
+				z->length < size ? z->length : (uint32_t)size;
+			for (uint32_t i = 0; i < n; i++) {
+				const uint8_t byte = window[(from + i) & mask];
+				window[(written + i) & mask] = byte;
+				out[i] = byte;
+			}
+			written += n;
+			out += n;
+			z->length -= n;
+			size -= n;
+		} else if (z->block == I_FBGL_BLOCK_STORED && z->left) {
+			const uint8_t byte = (uint8_t)i_fbgl_inflate_bits(z, 8);
+			window[written++ & mask] = byte;
+			*out++ = byte;
+			z->left--;
+			size--;
+		} else if (z->block == I_FBGL_BLOCK_HUFFMAN) {
+			int32_t symbol = i_fbgl_huffman_decode(z, &z->lit);
+			if (symbol < 256) {
+				window[written++ & mask] = (uint8_t)symbol;
+				*out++ = (uint8_t)symbol;
+				size--;
+				continue;
+			}
+			if (symbol == 256) {
+				z->block = I_FBGL_BLOCK_NONE;
+				continue;
+			}
+			symbol -= 257;
+			if (symbol >= 29) {
+				z->error = true;
+				break;
+			}
+			const uint8_t extra = length_extra[symbol];
+			z->length = length_base[symbol] +
+				    i_fbgl_inflate_bits(z, extra);
+			symbol = i_fbgl_huffman_decode(z, &z->dist);
+			if (symbol >= 30) {
+				z->error = true;
+				break;
+			}
+			z->distance =
+				distance_base[symbol] +
+				i_fbgl_inflate_bits(z, distance_extra[symbol]);
+			z->error = z->distance > written;
+		} else {
+			z->error = !i_fbgl_inflate_block(z);
+		}
+	}
+	z->written = written;
+	z->error |= z->pad > 8;
+	return !z->error;
+}
+
+typedef struct i_fbgl_png {
+	uint32_t width;
+	uint8_t depth;
+	uint8_t color; // PNG color type
+	bool keyed; // tRNS gives a transparent color
+	uint16_t key[3]; // Gray, or red, green and blue
+	uint32_t colors; // PLTE entries
+	uint32_t palette[256]; // Premultiplied
+} i_fbgl_png_t;
+
+// Sample index of a row, at most 16 bits
+FBGL_INLINE uint32_t i_fbgl_png_sample(const uint8_t *row, size_t index,
+				       uint8_t depth)
+{
+	if (depth == 8) {
+		return row[index];
+	}
+	if (depth == 16) {
+		return (uint32_t)row[index * 2] << 8 | row[index * 2 + 1];
+	}
+	const size_t bit = index * depth;
+	return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+}
+
+// Scale a sample to 8 bits
+FBGL_INLINE uint32_t i_fbgl_png_8bit(uint32_t value, uint8_t depth)
+{
+	if (depth >= 8) {
+		return value >> (depth - 8);
+	}
+	return value * 255 / ((1u << depth) - 1);
+}
+
+// Convert a row to premultiplied ARGB, false if it indexes past the palette
+static bool i_fbgl_png_row(const i_fbgl_png_t *png, const uint8_t *row,
+			   uint32_t *dst)
+{
+	const uint8_t depth = png->depth;
+	const bool rgb = png->color == 2 && !png->keyed;
+	if (depth == 8 && (png->color == 6 || rgb)) {
+		// The common case, without per-sample unpacking
+		const size_t channels = png->color == 6 ? 4 : 3;
+		for (uint32_t x = 0; x < png->width; x++, row += channels) {
+			const uint32_t a = channels == 4 ? row[3] : 255;
+			const uint32_t px = a << 24 | (uint32_t)row[0] << 16 |
+					    (uint32_t)row[1] << 8 | row[2];
+			dst[x] = a == 255 ? px : fbgl_premultiply(px);
+		}
+		return true;
+	}
+	for (uint32_t x = 0; x < png->width; x++) {
+		uint32_t r, g, b, a = 255;
+		if (png->color == 3) {
+			const uint32_t index = i_fbgl_png_sample(row, x, depth);
+			if (index >= png->colors) {
+				return false;
+			}
+			dst[x] = png->palette[index];
+			continue;
+		}
+		if (png->color == 0 || png->color == 4) {
+			const size_t channels = png->color == 4 ? 2 : 1;
+			const uint32_t v = i_fbgl_png_sample(row, x * channels,
+							     depth);
+			if (png->color == 4) {
+				a = i_fbgl_png_sample(row, x * 2 + 1, depth);
+				a = i_fbgl_png_8bit(a, depth);
+			} else if (png->keyed && v == png->key[0]) {
+				a = 0;
+			}
+			r = g = b = i_fbgl_png_8bit(v, depth);
+		} else {
+			const size_t channels = png->color == 6 ? 4 : 3;
+			const uint32_t vr = i_fbgl_png_sample(row, x * channels,
+							      depth);
+			const uint32_t vg = i_fbgl_png_sample(
+				row, x * channels + 1, depth);
+			const uint32_t vb = i_fbgl_png_sample(
+				row, x * channels + 2, depth);
+			if (png->color == 6) {
+				a = i_fbgl_png_sample(row, x * 4 + 3, depth);
+				a = i_fbgl_png_8bit(a, depth);
+			} else if (png->keyed && vr == png->key[0] &&
+				   vg == png->key[1] && vb == png->key[2]) {
+				a = 0;
+			}
+			r = i_fbgl_png_8bit(vr, depth);
+			g = i_fbgl_png_8bit(vg, depth);
+			b = i_fbgl_png_8bit(vb, depth);
+		}
+		const uint32_t px = a << 24 | r << 16 | g << 8 | b;
+		dst[x] = a == 255 ? px : fbgl_premultiply(px);
+	}
+	return true;
+}
+
+static bool i_fbgl_png_unfilter(uint8_t *row, const uint8_t *prev,
+				size_t size, size_t bpp, uint8_t filter)
+{
+	switch (filter) {
+	case 0:
+		break;
+	case 1:
+		for (size_t i = bpp; i < size; i++) {
+			row[i] += row[i - bpp];
+		}
+		break;
+	case 2:
+		for (size_t i = 0; i < size; i++) {
+			row[i] += prev[i];
+		}
+		break;
+	case 3:
+		// The first pixel has nothing to its left
+		for (size_t i = 0; i < bpp && i < size; i++) {
+			row[i] += prev[i] >> 1;
+		}
+		for (size_t i = bpp; i < size; i++) {
+			row[i] += (uint8_t)((row[i - bpp] + prev[i]) >> 1);
+		}
+		break;
+	case 4:
+		for (size_t i = 0; i < bpp && i < size; i++) {
+			row[i] += prev[i];
+		}
+		for (size_t i = bpp; i < size; i++) {
+			const int32_t a = row[i - bpp];
+			const int32_t b = prev[i];
+			const int32_t c = prev[i - bpp];
+			const int32_t pa = i_fbgl_abs_int(b - c);
+			const int32_t pb = i_fbgl_abs_int(a - c);
+			const int32_t pc = i_fbgl_abs_int(a + b - 2 * c);
+			row[i] += (uint8_t)(pa <= pb && pa <= pc ? a :
+					    pb <= pc	     ? b :
+							       c);
+		}
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+static void i_fbgl_png_transparency(i_fbgl_png_t *png, const uint8_t *body,
+				    uint32_t length, int32_t colors)
+{
+	if (png->color == 3) {
+		// Alpha per palette entry
+		for (uint32_t i = 0; i < length && i < (uint32_t)colors; i++) {
+			png->palette[i] =
+				fbgl_premultiply((png->palette[i] & 0xFFFFFF) |
+						 (uint32_t)body[i] << 24);
+		}
+		return;
+	}
+
+	// One transparent gray or RGB value, 16 bits per sample
+	const uint32_t samples = png->color == 2 ? 3 : 1;
+	if ((png->color == 0 || png->color == 2) && length >= samples * 2) {
+		png->keyed = true;
+		for (uint32_t i = 0; i < samples; i++) {
+			png->key[i] =
+				(uint16_t)(body[i * 2] << 8 | body[i * 2 + 1]);
+		}
+	}
+}
+
+// Read the chunks up to the first IDAT, returning its offset or 0
+static size_t i_fbgl_png_header(i_fbgl_png_t *png, const uint8_t *data,
+				size_t size, uint32_t *height)
+{
+	static const uint8_t signature[8] = { 0x89, 'P',  'N',	'G',
+					      '\r', '\n', 0x1A, '\n' };
+	if (size < 33 || memcmp(data, signature, 8) != 0 ||
+	    memcmp(data + 12, "IHDR", 4) != 0 || i_fbgl_be32(data + 8) != 13) {
+		fprintf(stderr, "Error: invalid PNG header.\n");
+		return 0;
+	}
+	png->width = i_fbgl_be32(data + 16);
+	*height = i_fbgl_be32(data + 20);
+	png->depth = data[24];
+	png->color = data[25];
+	const uint8_t depth = png->depth;
+	const bool valid = png->color == 0 ? depth == 1 || depth == 2 ||
+						     depth == 4 || depth == 8 ||
+						     depth == 16 :
+			   png->color == 3 ? depth == 1 || depth == 2 ||
+						     depth == 4 || depth == 8 :
+			   png->color == 2 || png->color == 4 ||
+					   png->color == 6 ?
+					     depth == 8 || depth == 16 :
+					     false;
+	if (!valid || data[26] != 0 || data[27] != 0) {
+		fprintf(stderr, "Unsupported PNG type %d, depth %d\n",
+			png->color, depth);
+		return 0;
+	}
+	if (data[28] != 0) {
+		fprintf(stderr, "Unsupported PNG: interlaced\n");
+		return 0;
+	}
+
+	int32_t colors = 0;
+	for (size_t pos = 33; size - pos >= 12;) {
+		const uint32_t length = i_fbgl_be32(data + pos);
+		const uint8_t *type = data + pos + 4;
+		const uint8_t *body = data + pos + 8;
+		if (length > size - pos - 12) {
+			break;
+		}
+		if (memcmp(type, "IDAT", 4) == 0) {
+			return pos;
+		}
+		if (memcmp(type, "PLTE", 4) == 0 && length % 3 == 0 &&
+		    length <= 768) {
+			colors = (int32_t)length / 3;
+			png->colors = (uint32_t)colors;
+			for (int32_t i = 0; i < colors; i++) {
+				const uint8_t *c = body + i * 3;
+				png->palette[i] = 0xFF000000 |
+						  (uint32_t)c[0] << 16 |
+						  (uint32_t)c[1] << 8 | c[2];
+			}
+		} else if (memcmp(type, "tRNS", 4) == 0) {
+			i_fbgl_png_transparency(png, body, length, colors);
+		}
+		pos += 12 + (size_t)length;
+	}
+	fprintf(stderr, "Error: PNG has no image data.\n");
+	return 0;
+}
+
+static fbgl_tga_texture_t *i_fbgl_png_decode(const uint8_t *data,
+					     size_t size)
+{
+	i_fbgl_png_t *png = (i_fbgl_png_t *)calloc(1, sizeof(*png));
+	i_fbgl_inflate_t *z = (i_fbgl_inflate_t *)calloc(1, sizeof(*z));
+	if (!png || !z) {
+		perror("Failed to allocate PNG decoder");
+		free(png);
+		free(z);
+		return NULL;
+	}
+
+	uint32_t height = 0;
+	const size_t idat = i_fbgl_png_header(png, data, size, &height);
+	fbgl_tga_texture_t *texture =
+		idat ? i_fbgl_texture_alloc(png->width, height) : NULL;
+	const size_t channels = png->color == 2 ? 3 :
+				png->color == 4 ? 2 :
+				png->color == 6 ? 4 :
+						  1;
+	const size_t bits = channels * png->depth;
+	const size_t stride = (png->width * bits + 7) / 8;
+	uint8_t *rows = texture ? (uint8_t *)calloc(2, stride) : NULL;
+	if (!rows) {
+		if (texture) {
+			perror("Failed to allocate PNG rows");
+		}
+		fbgl_destroy_texture(texture);
+		free(png);
+		free(z);
+		return NULL;
+	}
+
+	// Start as if at the end of the chunk before the first IDAT
+	z->data = data;
+	z->size = size;
+	z->pos = z->end = idat - 4;
+	const uint32_t cmf = i_fbgl_inflate_bits(z, 8);
+	const uint32_t flg = i_fbgl_inflate_bits(z, 8);
+	bool ok = (cmf & 0x0F) == 8 && (cmf << 8 | flg) % 31 == 0 &&
+		  !(flg & 0x20);
+
+	uint8_t *prev = rows;
+	uint8_t *row = rows + stride;
+	const size_t bpp = (bits + 7) / 8;
+	for (uint32_t y = 0; y < height && ok; y++) {
+		uint8_t filter;
+		ok = i_fbgl_inflate_read(z, &filter, 1) &&
+		     i_fbgl_inflate_read(z, row, stride) &&
+		     i_fbgl_png_unfilter(row, prev, stride, bpp, filter);
+		ok = ok && i_fbgl_png_row(png, row,
+					  texture->data +
+						  (size_t)y * png->width);
+		uint8_t *swap = prev;
+		prev = row;
+		row = swap;
+	}
+	free(rows);
+	free(png);
+	free(z);
+	if (!ok) {
+		fprintf(stderr, "Error: PNG image data is corrupt.\n");
+		fbgl_destroy_texture(texture);
+		return NULL;
+	}
+
+	fbgl_texture_update_runs(texture);
+	return texture;
+}
+
+// Pick the decoder by signature; TGA has none
+static fbgl_tga_texture_t *i_fbgl_texture_decode(const void *data,
+						 size_t size, bool parallel)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	if (data && size >= 8 && memcmp(bytes, "\x89PNG", 4) == 0) {
+		return i_fbgl_png_decode(bytes, size);
+	}
+	if (data && size >= 4 && memcmp(bytes, "qoif", 4) == 0) {
+		return i_fbgl_qoi_decode(bytes, size);
+	}
+	return i_fbgl_tga_decode(data, size, parallel);
+}
+
+fbgl_tga_texture_t *fbgl_load_texture_memory(const void *data, size_t size)
+{
+	return i_fbgl_texture_decode(data, size, true);
+}
+
+fbgl_tga_texture_t *fbgl_load_texture(const char *path)
+{
+	i_fbgl_file_t file;
+	if (i_fbgl_file_open(&file, path) != 0) {
+		return NULL;
+	}
+	fbgl_tga_texture_t *texture =
+		fbgl_load_texture_memory(file.data, file.size);
+	i_fbgl_file_close(&file);
+	return texture;
+}
+
+uint32_t fbgl_premultiply(uint32_t argb)
+{
+	return (argb & 0xFF000000) |
+	       (i_fbgl_scale_argb(argb, argb >> 24) & 0x00FFFFFF);
+}
+
+void fbgl_destroy_texture(fbgl_tga_texture_t *texture)
+{
+	if (texture) {
+		free(texture->row_runs);
+		free(texture->data);
+		free(texture);
+	}
+}
+
+// End of the run starting at row[tx], its kind in *kind, or 0 for none
+FBGL_INLINE int32_t i_fbgl_texel_run(const uint32_t *row, int32_t tx,
+				     int32_t end, uint8_t *kind)
+{
+	const uint32_t alpha = row[tx] >> 24;
+	*kind = alpha == 0xFF ? FBGL_RUN_OPAQUE : FBGL_RUN_PARTIAL;
+	if (alpha == 0) {
+		while (tx < end && (row[tx] >> 24) == 0) {
+			tx++;
+		}
+		return tx;
+	}
+	if (alpha == 0xFF) {
+		while (tx < end && (row[tx] >> 24) == 0xFF) {
+			tx++;
+		}
+		return tx;
+	}
+	while (tx < end && (row[tx] >> 24) != 0 && (row[tx] >> 24) != 0xFF) {
+		tx++;
+	}
+	return tx;
+}
+
+int fbgl_texture_update_runs(fbgl_tga_texture_t *texture)
+{
+	if (!texture || !texture->data) {
+		return -1;
+	}
+
+	free(texture->row_runs);
+	texture->row_runs = NULL;
+	texture->runs = NULL;
+	texture->flags = 0;
+
+	// Count first, so row indices and runs fit in one allocation
+	const int32_t width = texture->width;
+	const int32_t height = texture->height;
+	size_t count = 0;
+	bool opaque = true;
+	for (int32_t ty = 0; ty < height; ty++) {
+		const uint32_t *row = texture->data + (size_t)ty * width;
+		uint8_t kind;
+		for (int32_t tx = 0; tx < width;) {
+			const bool skip = (row[tx] >> 24) == 0;
+			tx = i_fbgl_texel_run(row, tx, width, &kind);
+			count += !skip;
+			opaque = opaque && !skip && kind == FBGL_RUN_OPAQUE;
+		}
+	}
+
+	const size_t index_bytes = ((size_t)height + 1) * sizeof(uint32_t);
+	uint32_t *row_runs = (uint32_t *)malloc(
+		index_bytes + count * sizeof(fbgl_texture_run_t));
+	if (!row_runs) {
+		perror("Failed to allocate texture runs");
+		return -1;
+	}
+	fbgl_texture_run_t *runs =
+		(fbgl_texture_run_t *)((uint8_t *)row_runs + index_bytes);
+
+	count = 0;
+	for (int32_t ty = 0; ty < height; ty++) {
+		const uint32_t *row = texture->data + (size_t)ty * width;
+		row_runs[ty] = (uint32_t)count;
+		for (int32_t tx = 0; tx < width;) {
+			fbgl_texture_run_t run = { (uint16_t)tx, 0, 0 };
+			const bool skip = (row[tx] >> 24) == 0;
+			tx = i_fbgl_texel_run(row, tx, width, &run.kind);
+			run.end = (uint16_t)tx;
+			if (!skip) {
+				runs[count++] = run;
+			}
+		}
+	}
+	row_runs[height] = (uint32_t)count;
+
+	texture->row_runs = row_runs;
+	texture->runs = runs;
+	texture->flags = opaque ? FBGL_TEXTURE_OPAQUE : 0;
+	return 0;
+}
+
+typedef struct i_fbgl_texture_job {
+	fbgl_t const *fb;
+	fbgl_tga_texture_t const *texture;
+	int32_t x, y; // Texture origin on the surface
+	int32_t tx0, tx1, ty0; // Visible columns and first visible row
+	uint32_t opacity;
+} i_fbgl_texture_job_t;
+
+// Draw texels [start, end) of row ty
+FBGL_INLINE void i_fbgl_texture_span(const i_fbgl_texture_job_t *job,
+				     const uint32_t *row, int32_t ty,
+				     int32_t start, int32_t end, uint8_t kind,
+				     bool stream)
+{
+	fbgl_t const *fb = job->fb;
+	uint8_t *dst = i_fbgl_pixel_addr(fb, job->x + start, job->y + ty);
+
+	if (kind == FBGL_RUN_PARTIAL || job->opacity != 255) {
+		i_fbgl_blend_pixels(fb, dst, row + start, end - start,
+				    job->opacity);
+	} else if (stream) {
+		i_fbgl_stream_copy(dst, (const uint8_t *)(row + start),
+				   (size_t)(end - start) * 4);
+	} else {
+		fb->ops.blit(dst, row + start, end - start);
+	}
+}
+
+// Texels are XRGB8888 already, copy them past the cache
+FBGL_INLINE bool i_fbgl_texture_streams(fbgl_t const *fb)
+{
+	return fb->stream_stores && fb->format == FBGL_FORMAT_XRGB8888;
+}
+
+// Draw visible texture rows [ty0 + begin, ty0 + end) run by run, without
+// the fence streaming stores need
+static void i_fbgl_texture_draw(const i_fbgl_texture_job_t *job,
+				int32_t begin, int32_t end, bool stream)
+{
+	fbgl_tga_texture_t const *texture = job->texture;
+	const int32_t tx0 = job->tx0;
+	const int32_t tx1 = job->tx1;
+	ptrdiff_t skip = 0;
+
+	for (int32_t ty = job->ty0 + begin; ty < job->ty0 + end; ty++) {
+		const uint32_t *row =
+			texture->data + (size_t)ty * texture->width;
+
+		if (texture->flags & FBGL_TEXTURE_OPAQUE) {
+			i_fbgl_texture_span(job, row, ty, tx0, tx1,
+					    FBGL_RUN_OPAQUE, stream);
+		} else if (texture->runs) {
+			// Atlas rows hold many runs; the runs left of tx0 in
+			// the row above are a close guess for this one
+			const fbgl_texture_run_t *first =
+				texture->runs + texture->row_runs[ty];
+			const fbgl_texture_run_t *last =
+				texture->runs + texture->row_runs[ty + 1];
+			const fbgl_texture_run_t *run =
+				skip < last - first ? first + skip : last;
+			while (run > first && run[-1].end > tx0) {
+				run--;
+			}
+			while (run < last && run->end <= tx0) {
+				run++;
+			}
+			skip = run - first;
+			for (; run < last && run->start < tx1; run++) {
+				const int32_t start =
+					run->start > tx0 ? run->start : tx0;
+				const int32_t stop = run->end < tx1 ? run->end :
+								      tx1;
+				i_fbgl_texture_span(job, row, ty, start, stop,
+						    run->kind, stream);
+			}
+		} else {
+			// No runs precomputed, classify while drawing
+			for (int32_t tx = tx0; tx < tx1;) {
+				const int32_t start = tx;
+				const bool skip = (row[tx] >> 24) == 0;
+				uint8_t kind;
+				tx = i_fbgl_texel_run(row, tx, tx1, &kind);
+				if (!skip) {
+					i_fbgl_texture_span(job, row, ty, start,
+							    tx, kind, stream);
+				}
+			}
+		}
+	}
+}
+
+static void i_fbgl_texture_rows(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_texture_job_t *job = (const i_fbgl_texture_job_t *)ctx;
+	const bool stream = i_fbgl_texture_streams(job->fb);
+	i_fbgl_texture_draw(job, begin, end, stream);
+	if (stream) {
+		i_fbgl_stream_fence();
+	}
+}
+
+// Set up drawing texels src of texture with src's top left corner at
+// (x, y), clipped. Returns the number of visible rows.
+static int32_t i_fbgl_texture_setup(i_fbgl_texture_job_t *job,
+				    fbgl_t const *fb,
+				    fbgl_tga_texture_t const *texture,
+				    fbgl_rect_t src, int32_t x, int32_t y,
+				    uint32_t opacity)
+{
+	int32_t x0 = x;
+	int32_t y0 = y;
+	int32_t x1 = x + src.width;
+	int32_t y1 = y + src.height;
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return 0;
+	}
+
+	// Job coordinates are relative to the texture origin
+	job->fb = fb;
+	job->texture = texture;
+	job->x = x - src.x;
+	job->y = y - src.y;
+	job->tx0 = x0 - job->x;
+	job->tx1 = x1 - job->x;
+	job->ty0 = y0 - job->y;
+	job->opacity = opacity;
+	return y1 - y0;
+}
+
+static void i_fbgl_draw_texture_rect(fbgl_t *fb,
+				     fbgl_tga_texture_t const *texture,
+				     fbgl_rect_t src, int32_t x, int32_t y,
+				     uint32_t opacity)
+{
+	i_fbgl_texture_job_t job;
+	const int32_t rows =
+		i_fbgl_texture_setup(&job, fb, texture, src, x, y, opacity);
+	if (rows == 0) {
+		return;
+	}
+
+	i_fbgl_damage(fb, job.x + job.tx0, job.y + job.ty0, job.x + job.tx1,
+		      job.y + job.ty0 + rows);
+	i_fbgl_parallel_for(i_fbgl_texture_rows, &job, rows,
+			    i_fbgl_row_grain((size_t)(job.tx1 - job.tx0) * 4));
+}
+
+void fbgl_draw_texture(fbgl_t *fb, fbgl_tga_texture_t const *texture, int32_t x,
+		       int32_t y)
+{
+	fbgl_draw_texture_blend(fb, texture, x, y, 255);
+}
+
+void fbgl_draw_texture_blend(fbgl_t *fb, fbgl_tga_texture_t const *texture,
+			     int32_t x, int32_t y, uint32_t opacity)
+{
+	if (!fb || !texture || !texture->data || opacity == 0) {
+		return;
+	}
+	opacity = opacity > 255 ? 255 : opacity;
+
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[3] = { x, y, (int32_t)opacity };
+		if (i_fbgl_record(fb, I_FBGL_CMD_TEXTURE, x, y,
+				  x + texture->width, y + texture->height, 0,
+				  args, 3, texture, NULL, 0)) {
+			return;
+		}
+	}
+
+	const fbgl_rect_t src = { 0, 0, texture->width, texture->height };
+	i_fbgl_draw_texture_rect(fb, texture, src, x, y, opacity);
+}
+
+#define I_FBGL_SCALE_CHUNK 256
+
+// Write count sampled premultiplied texels to the draw target at dst
+static void i_fbgl_texture_emit(fbgl_t const *fb, uint8_t *dst,
+				const uint32_t *texels, int32_t count,
+				bool opaque)
+{
+	if (!opaque) {
+		i_fbgl_blend_pixels(fb, dst, texels, count, 255);
+	} else if (fb->stream_stores && fb->format == FBGL_FORMAT_XRGB8888) {
+		i_fbgl_stream_copy(dst, (const uint8_t *)texels,
+				   (size_t)count * 4);
+	} else {
+		fb->ops.blit(dst, texels, count);
+	}
+}
+
+typedef struct i_fbgl_scale_job {
+	fbgl_t const *fb;
+	fbgl_tga_texture_t const *texture;
+	fbgl_rect_t rect; // Where the whole texture lands
+	fbgl_filter_t filter;
+	int32_t x0, x1, y0; // Visible columns and first visible row
+	const int32_t *ix0, *ix1; // Source columns of each visible column
+	const uint32_t *wx; // Their bilinear weights
+} i_fbgl_scale_job_t;
+
+// Center of destination pixel i of n in a source of size texels, 16.16
+FBGL_INLINE int64_t i_fbgl_scale_pos(int64_t i, int64_t n, int64_t size)
+{
+	const int64_t num = (2 * i + 1) * size;
+	return (num / (2 * n)) * 65536 + (num % (2 * n)) * 65536 / (2 * n);
+}
+
+// Source texels and weight for a bilinear sample at 16.16 pos
+FBGL_INLINE void i_fbgl_scale_taps(int64_t pos, int32_t size, int32_t *s0,
+				   int32_t *s1, uint32_t *weight)
+{
+	pos = pos > 0x8000 ? pos - 0x8000 : 0;
+	*s0 = (int32_t)(pos >> 16);
+	*s1 = *s0 + 1 < size ? *s0 + 1 : *s0;
+	*weight = (uint32_t)(pos >> 8) & 0xFF;
+}
+
+// Sample visible rows [y0 + begin, y0 + end), then copy or blend them
+static void i_fbgl_scale_rows(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_scale_job_t *job = (const i_fbgl_scale_job_t *)ctx;
+	fbgl_t const *fb = job->fb;
+	fbgl_tga_texture_t const *texture = job->texture;
+	const int32_t width = job->x1 - job->x0;
+	const size_t bpp = fb->ops.bytes_per_pixel;
+	const bool opaque = (texture->flags & FBGL_TEXTURE_OPAQUE) != 0;
+	const bool direct = opaque && !fb->stream_stores &&
+			    fb->format == FBGL_FORMAT_XRGB8888;
+
+	uint32_t buffer[I_FBGL_SCALE_CHUNK];
+	int64_t last = -1; // Source rows and weight of the previous row
+	const uint8_t *previous = NULL;
+
+	for (int32_t y = job->y0 + begin; y < job->y0 + end; y++) {
+		const int64_t pos = i_fbgl_scale_pos(y - job->rect.y,
+						     job->rect.height,
+						     texture->height);
+		int32_t sy0 = (int32_t)(pos >> 16);
+		int32_t sy1 = sy0;
+		uint32_t fy = 0;
+		if (job->filter == FBGL_FILTER_BILINEAR) {
+			i_fbgl_scale_taps(pos, texture->height, &sy0, &sy1,
+					  &fy);
+		}
+		uint8_t *dst = i_fbgl_pixel_addr(fb, job->x0, y);
+
+		// Upscaled rows repeat; device memory is too slow to read back
+		const int64_t key = (int64_t)sy0 << 8 | fy;
+		if (opaque && !fb->stream_stores && key == last) {
+			memcpy(dst, previous, (size_t)width * bpp);
+			previous = dst;
+			continue;
+		}
+
+		const uint32_t *row0 = texture->data +
+				       (size_t)sy0 * texture->width;
+		const uint32_t *row1 = texture->data +
+				       (size_t)sy1 * texture->width;
+		for (int32_t i = 0; i < width; i += I_FBGL_SCALE_CHUNK) {
+			const int32_t n = width - i < I_FBGL_SCALE_CHUNK ?
+						  width - i :
+						  I_FBGL_SCALE_CHUNK;
+			uint32_t *out = direct ? (uint32_t *)dst + i : buffer;
+			if (job->filter == FBGL_FILTER_BILINEAR) {
+				i_fbgl_bilinear(out, row0, row1, job->ix0 + i,
+						job->ix1 + i, job->wx + i, fy,
+						n);
+			} else {
+				i_fbgl_nearest(out, row0, job->ix0 + i, n);
+			}
+
+			if (!direct) {
+				i_fbgl_texture_emit(fb, dst + (size_t)i * bpp,
+						    buffer, n, opaque);
+			}
+		}
+		last = key;
+		previous = dst;
+	}
+	if (fb->stream_stores) {
+		i_fbgl_stream_fence();
+	}
+}
+
+void fbgl_draw_texture_scaled(fbgl_t *fb, fbgl_tga_texture_t const *texture,
+			      fbgl_rect_t rect, fbgl_filter_t filter)
+{
+	if (!fb || !texture || !texture->data || !texture->width ||
+	    !texture->height || rect.width <= 0 || rect.height <= 0) {
+		return;
+	}
+	if (rect.width == texture->width && rect.height == texture->height) {
+		fbgl_draw_texture(fb, texture, rect.x, rect.y);
+		return;
+	}
+
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[5] = { rect.x, rect.y, rect.width,
+					  rect.height, (int32_t)filter };
+		if (i_fbgl_record(fb, I_FBGL_CMD_TEXTURE_SCALED, rect.x, rect.y,
+				  rect.x + rect.width, rect.y + rect.height, 0,
+				  args, 5, texture, NULL, 0)) {
+			return;
+		}
+	}
+
+	i_fbgl_scale_job_t job = { fb, texture, rect, filter, rect.x,
+				   rect.x + rect.width, rect.y, NULL, NULL,
+				   NULL };
+	int32_t y1 = rect.y + rect.height;
+	if (!i_fbgl_clip_box(fb, &job.x0, &job.y0, &job.x1, &y1)) {
+		return;
+	}
+
+	// Source columns are the same for every row, work them out once
+	const int32_t width = job.x1 - job.x0;
+	int32_t stack_columns[2 * I_FBGL_SCALE_CHUNK];
+	uint32_t stack_weights[I_FBGL_SCALE_CHUNK];
+	int32_t *columns = stack_columns;
+	uint32_t *weights = stack_weights;
+	if (width > I_FBGL_SCALE_CHUNK) {
+		columns = (int32_t *)malloc((size_t)width * 2 *
+					    sizeof(*columns));
+		weights = (uint32_t *)malloc((size_t)width * sizeof(*weights));
+		if (!columns || !weights) {
+			perror("Failed to allocate texture scale columns");
+			free(columns);
+			free(weights);
+			return;
+		}
+	}
+	for (int32_t i = 0; i < width; i++) {
+		const int64_t pos =
+			i_fbgl_scale_pos(job.x0 + i - rect.x, rect.width,
+					 texture->width);
+		int32_t *s0 = &columns[i];
+		int32_t *s1 = &columns[width + i];
+		uint32_t fx = 0;
+		*s0 = *s1 = (int32_t)(pos >> 16);
+		if (filter == FBGL_FILTER_BILINEAR) {
+			i_fbgl_scale_taps(pos, texture->width, s0, s1, &fx);
+		}
+		weights[i] = fx | fx << 16;
+	}
+	job.ix0 = columns;
+	job.ix1 = columns + width;
+	job.wx = weights;
+
+	i_fbgl_damage(fb, job.x0, job.y0, job.x1, y1);
+	i_fbgl_parallel_for(i_fbgl_scale_rows, &job, y1 - job.y0,
+			    i_fbgl_row_grain((size_t)width * 4));
+
+	if (columns != stack_columns) {
+		free(columns);
+		free(weights);
+	}
+}
+
+fbgl_matrix_t fbgl_matrix_identity(void)
+{
+	return (fbgl_matrix_t){ 1, 0, 0, 0, 1, 0 };
+}
+
+fbgl_matrix_t fbgl_matrix_translate(float x, float y)
+{
+	return (fbgl_matrix_t){ 1, 0, x, 0, 1, y };
+}
+
+fbgl_matrix_t fbgl_matrix_scale(float sx, float sy)
+{
+	return (fbgl_matrix_t){ sx, 0, 0, 0, sy, 0 };
+}
+
+fbgl_matrix_t fbgl_matrix_rotate(float radians)
+{
+	const float c = cosf(radians);
+	const float s = sinf(radians);
+	return (fbgl_matrix_t){ c, -s, 0, s, c, 0 };
+}
+
+// a applied after b
+fbgl_matrix_t fbgl_matrix_multiply(fbgl_matrix_t a, fbgl_matrix_t b)
+{
+	return (fbgl_matrix_t){ a.xx * b.xx + a.xy * b.yx,
+				a.xx * b.xy + a.xy * b.yy,
+				a.xx * b.x0 + a.xy * b.y0 + a.x0,
+				a.yx * b.xx + a.yy * b.yx,
+				a.yx * b.xy + a.yy * b.yy,
+				a.yx * b.x0 + a.yy * b.y0 + a.y0 };
+}
+
+typedef struct i_fbgl_affine_job {
+	fbgl_t const *fb;
+	fbgl_tga_texture_t const *texture;
+	int32_t x0, x1, y0; // Clipped destination box
+	int64_t u, v; // 16.16 texel position of pixel (x0, y0)
+	int64_t du_dx, dv_dx, du_dy, dv_dy;
+	i_fbgl_affine_fn sample;
+} i_fbgl_affine_job_t;
+
+// Narrow [*k0, *k1] to the k where lo <= base + k * step <= hi
+FBGL_INLINE void i_fbgl_span_limit(int64_t base, int64_t step, int64_t lo,
+				   int64_t hi, int64_t *k0, int64_t *k1)
+{
+	if (step == 0) {
+		if (base < lo || base > hi) {
+			*k1 = *k0 - 1;
+		}
+		return;
+	}
+	if (step < 0) {
+		const int64_t t = lo;
+		lo = -hi;
+		hi = -t;
+		base = -base;
+		step = -step;
+	}
+	const int64_t first = -i_fbgl_floor_div(base - lo, step);
+	const int64_t last = i_fbgl_floor_div(hi - base, step);
+	*k0 = first > *k0 ? first : *k0;
+	*k1 = last < *k1 ? last : *k1;
+}
+
+// Sample the in-texture span of rows [y0 + begin, y0 + end)
+static void i_fbgl_affine_rows(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_affine_job_t *job = (const i_fbgl_affine_job_t *)ctx;
+	fbgl_t const *fb = job->fb;
+	fbgl_tga_texture_t const *texture = job->texture;
+	const bool opaque = (texture->flags & FBGL_TEXTURE_OPAQUE) != 0;
+	const bool direct = opaque && !fb->stream_stores &&
+			    fb->format == FBGL_FORMAT_XRGB8888;
+	const int64_t u_max = ((int64_t)texture->width << 16) - 1;
+	const int64_t v_max = ((int64_t)texture->height << 16) - 1;
+	uint32_t buffer[I_FBGL_SCALE_CHUNK];
+
+	for (int32_t y = job->y0 + begin; y < job->y0 + end; y++) {
+		const int64_t u = job->u + (y - job->y0) * job->du_dy;
+		const int64_t v = job->v + (y - job->y0) * job->dv_dy;
+		int64_t k0 = 0;
+		int64_t k1 = job->x1 - job->x0 - 1;
+		i_fbgl_span_limit(u, job->du_dx, 0, u_max, &k0, &k1);
+		i_fbgl_span_limit(v, job->dv_dx, 0, v_max, &k0, &k1);
+		if (k0 > k1) {
+			continue;
+		}
+
+		uint32_t su = (uint32_t)(u + k0 * job->du_dx);
+		uint32_t sv = (uint32_t)(v + k0 * job->dv_dx);
+		uint8_t *dst = i_fbgl_pixel_addr(fb, job->x0 + (int32_t)k0, y);
+		const int32_t count = (int32_t)(k1 - k0 + 1);
+		for (int32_t i = 0; i < count; i += I_FBGL_SCALE_CHUNK) {
+			const int32_t n = count - i < I_FBGL_SCALE_CHUNK ?
+						  count - i :
+						  I_FBGL_SCALE_CHUNK;
+			uint32_t *out = direct ? (uint32_t *)dst : buffer;
+			job->sample(out, texture->data, texture->width, su, sv,
+				    (uint32_t)job->du_dx, (uint32_t)job->dv_dx,
+				    n);
+			if (!direct) {
+				i_fbgl_texture_emit(fb, dst, buffer, n, opaque);
+			}
+			su += (uint32_t)n * (uint32_t)job->du_dx;
+			sv += (uint32_t)n * (uint32_t)job->dv_dx;
+			dst += (size_t)n * fb->ops.bytes_per_pixel;
+		}
+	}
+	if (fb->stream_stores) {
+		i_fbgl_stream_fence();
+	}
+}
+
+void fbgl_draw_texture_affine(fbgl_t *fb, fbgl_tga_texture_t const *texture,
+			      fbgl_matrix_t matrix)
+{
+	if (!fb || !texture || !texture->data) {
+		return;
+	}
+
+	const double m[6] = { matrix.xx, matrix.xy, matrix.x0,
+			      matrix.yx, matrix.yy, matrix.y0 };
+	const double det = m[0] * m[4] - m[1] * m[3];
+	if (!(fabs(det) > 1e-9)) {
+		return; // Degenerate, or NaN
+	}
+
+	// Destination bounds of the texture corners, kept in int32 range
+	const double w = texture->width;
+	const double h = texture->height;
+	const double cx[4] = { m[2], m[0] * w + m[2], m[1] * h + m[2],
+			       m[0] * w + m[1] * h + m[2] };
+	const double cy[4] = { m[5], m[3] * w + m[5], m[4] * h + m[5],
+			       m[3] * w + m[4] * h + m[5] };
+	double bounds[4] = { cx[0], cy[0], cx[0], cy[0] };
+	for (int i = 1; i < 4; i++) {
+		bounds[0] = cx[i] < bounds[0] ? cx[i] : bounds[0];
+		bounds[1] = cy[i] < bounds[1] ? cy[i] : bounds[1];
+		bounds[2] = cx[i] > bounds[2] ? cx[i] : bounds[2];
+		bounds[3] = cy[i] > bounds[3] ? cy[i] : bounds[3];
+	}
+	int32_t box[4];
+	for (int i = 0; i < 4; i++) {
+		double b = i < 2 ? floor(bounds[i]) : ceil(bounds[i]);
+		b = b < -(1 << 30) ? -(1 << 30) : b;
+		b = b > (1 << 30) ? (1 << 30) : b;
+		box[i] = (int32_t)b;
+	}
+
+	if (i_fbgl_deferring(fb) &&
+	    i_fbgl_record(fb, I_FBGL_CMD_TEXTURE_AFFINE, box[0], box[1],
+			  box[2], box[3], 0, NULL, 0, texture, &matrix,
+			  sizeof(matrix))) {
+		return;
+	}
+
+	// Inverse mapping in 16.16, anchored at the unclipped box so every
+	// pixel gets the same texel whatever the clip rect
+	const double scale = 65536.0;
+	const double px = box[0] + 0.5 - m[2];
+	const double py = box[1] + 0.5 - m[5];
+	const double u = (m[4] * px - m[1] * py) / det * scale;
+	const double v = (m[0] * py - m[3] * px) / det * scale;
+	const double limit = 1e15;
+	if (!(fabs(u) < limit && fabs(v) < limit)) {
+		return;
+	}
+
+	i_fbgl_affine_job_t job = { fb, texture, box[0], box[2], box[1],
+				    llround(u), llround(v),
+				    llround(m[4] / det * scale),
+				    llround(-m[3] / det * scale),
+				    llround(-m[1] / det * scale),
+				    llround(m[0] / det * scale),
+				    i_fbgl_affine };
+	if ((size_t)texture->width * texture->height > INT32_MAX) {
+		job.sample = i_fbgl_affine_scalar;
+	}
+
+	int32_t y1 = box[3];
+	const int32_t bx = box[0];
+	const int32_t by = box[1];
+	if (!i_fbgl_clip_box(fb, &job.x0, &job.y0, &job.x1, &y1)) {
+		return;
+	}
+	job.u += (job.x0 - bx) * job.du_dx + (job.y0 - by) * job.du_dy;
+	job.v += (job.x0 - bx) * job.dv_dx + (job.y0 - by) * job.dv_dy;
+
+	i_fbgl_damage(fb, job.x0, job.y0, job.x1, y1);
+	i_fbgl_parallel_for(i_fbgl_affine_rows, &job, y1 - job.y0,
+			    i_fbgl_row_grain((size_t)(job.x1 - job.x0) * 4));
+}
+
+typedef struct i_fbgl_shelf_item {
+	int32_t index;
+	int32_t width;
+	int32_t height;
+} i_fbgl_shelf_item_t;
+
+// Tallest first, so each shelf wastes little height above short images
+static int i_fbgl_shelf_order(const void *a, const void *b)
+{
+	const i_fbgl_shelf_item_t *p = (const i_fbgl_shelf_item_t *)a;
+	const i_fbgl_shelf_item_t *q = (const i_fbgl_shelf_item_t *)b;
+	if (p->height != q->height) {
+		return q->height - p->height;
+	}
+	if (p->width != q->width) {
+		return q->width - p->width;
+	}
+	return p->index - q->index;
+}
+
+fbgl_atlas_t *fbgl_atlas_create(fbgl_tga_texture_t const *const *images,
+				int32_t count, int32_t max_width)
+{
+	if (!images || count <= 0) {
+		fprintf(stderr, "Error: no images to pack into an atlas.\n");
+		return NULL;
+	}
+
+	fbgl_atlas_t *atlas = (fbgl_atlas_t *)calloc(
+		1, sizeof(*atlas) + (size_t)count * sizeof(fbgl_rect_t));
+	i_fbgl_shelf_item_t *items =
+		(i_fbgl_shelf_item_t *)malloc((size_t)count * sizeof(*items));
+	if (!atlas || !items) {
+		perror("Failed to allocate atlas");
+		free(atlas);
+		free(items);
+		return NULL;
+	}
+	atlas->rects = (fbgl_rect_t *)(atlas + 1);
+	atlas->count = count;
+
+	int32_t limit = max_width;
+	for (int32_t i = 0; i < count; i++) {
+		if (!images[i] || !images[i]->data) {
+			fprintf(stderr, "Error: atlas image %d has no data.\n",
+				(int)i);
+			free(items);
+			free(atlas);
+			return NULL;
+		}
+		items[i].index = i;
+		items[i].width = images[i]->width;
+		items[i].height = images[i]->height;
+		limit = items[i].width > limit ? items[i].width : limit;
+	}
+	qsort(items, count, sizeof(*items), i_fbgl_shelf_order);
+
+	// Fill shelves left to right, opening the next one below when full
+	int32_t x = 0;
+	int32_t y = 0;
+	int32_t shelf = 0;
+	int32_t width = 0;
+	for (int32_t i = 0; i < count && y <= UINT16_MAX; i++) {
+		if (x + items[i].width > limit) {
+			y += shelf;
+			x = 0;
+			shelf = 0;
+		}
+		const fbgl_rect_t rect = { x, y, items[i].width,
+					   items[i].height };
+		atlas->rects[items[i].index] = rect;
+		x += items[i].width;
+		width = x > width ? x : width;
+		shelf = items[i].height > shelf ? items[i].height : shelf;
+	}
+	free(items);
+
+	const int32_t height = y + shelf;
+	if (width == 0 || height == 0 || width > UINT16_MAX ||
+	    height > UINT16_MAX) {
+		fprintf(stderr, "Error: images do not fit in a %dx%d atlas.\n",
+			UINT16_MAX, UINT16_MAX);
+		free(atlas);
+		return NULL;
+	}
+
+	// Texels between images stay transparent
+	atlas->texture.width = (uint16_t)width;
+	atlas->texture.height = (uint16_t)height;
+	atlas->texture.data =
+		(uint32_t *)calloc((size_t)width * height, sizeof(uint32_t));
+	if (!atlas->texture.data) {
+		perror("Failed to allocate atlas texels");
+		free(atlas);
+		return NULL;
+	}
+	for (int32_t i = 0; i < count; i++) {
+		const fbgl_rect_t *r = &atlas->rects[i];
+		for (int32_t row = 0; row < r->height; row++) {
+			memcpy(atlas->texture.data +
+				       (size_t)(r->y + row) * width + r->x,
+			       images[i]->data + (size_t)row * r->width,
+			       (size_t)r->width * sizeof(uint32_t));
+		}
+	}
+
+	fbgl_texture_update_runs(&atlas->texture);
+	return atlas;
+}
+
+void fbgl_atlas_destroy(fbgl_atlas_t *atlas)
+{
+	if (atlas) {
+		free(atlas->texture.row_runs);
+		free(atlas->texture.data);
+		free(atlas);
+	}
+}
+
+// The part of a sprite's rect inside its atlas, and where that lands
+static bool i_fbgl_sprite_src(fbgl_sprite_t const *sprite, fbgl_rect_t *src,
+			      int32_t *x, int32_t *y)
+{
+	if (!sprite->atlas || !sprite->atlas->texture.data) {
+		return false;
+	}
+	fbgl_tga_texture_t const *texture = &sprite->atlas->texture;
+	const fbgl_rect_t r = sprite->rect;
+	const int32_t x0 = r.x > 0 ? r.x : 0;
+	const int32_t y0 = r.y > 0 ? r.y : 0;
+	const int32_t x1 = r.x + r.width < texture->width ? r.x + r.width :
+							    texture->width;
+	const int32_t y1 = r.y + r.height < texture->height ?
+				   r.y + r.height :
+				   texture->height;
+	if (x0 >= x1 || y0 >= y1) {
+		return false;
+	}
+	src->x = x0;
+	src->y = y0;
+	src->width = x1 - x0;
+	src->height = y1 - y0;
+	*x = sprite->x + x0 - r.x;
+	*y = sprite->y + y0 - r.y;
+	return true;
+}
+
+// Sprites binned into bands of FBGL_TILE_SIZE surface rows, each band
+// listing the sprites touching it in submission order
+typedef struct i_fbgl_sprite_job {
+	fbgl_t const *fb;
+	fbgl_sprite_t const *sprites;
+	const int32_t *band_start; // Per band offsets into band_sprites
+	const int32_t *band_sprites;
+} i_fbgl_sprite_job_t;
+
+// Set up one sprite of a band, returning its visible rows
+static int32_t i_fbgl_sprite_setup(i_fbgl_texture_job_t *blit,
+				   fbgl_t const *band,
+				   fbgl_sprite_t const *sprite)
+{
+	fbgl_rect_t src;
+	int32_t x;
+	int32_t y;
+	if (!i_fbgl_sprite_src(sprite, &src, &x, &y)) {
+		return 0;
+	}
+	return i_fbgl_texture_setup(blit, band, &sprite->atlas->texture, src,
+				    x, y, 255);
+}
+
+// Blending reads the destination, and sprites land all over the surface,
+// so start fetching the next sprite's lines while this one is drawn
+FBGL_INLINE void i_fbgl_prefetch_rows(const i_fbgl_texture_job_t *blit,
+				      int32_t rows)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	fbgl_t const *fb = blit->fb;
+	const size_t bytes =
+		(size_t)(blit->tx1 - blit->tx0) * fb->ops.bytes_per_pixel;
+	for (int32_t row = 0; row < rows; row++) {
+		const uint8_t *line = i_fbgl_pixel_addr(
+			fb, blit->x + blit->tx0, blit->y + blit->ty0 + row);
+		for (size_t offset = 0; offset < bytes; offset += 64) {
+			__builtin_prefetch(line + offset, 1);
+		}
+		__builtin_prefetch(line + bytes - 1, 1);
+	}
+#else
+	(void)blit;
+	(void)rows;
+#endif
+}
+
+static void i_fbgl_sprite_bands(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_sprite_job_t *job = (const i_fbgl_sprite_job_t *)ctx;
+	const bool stream = i_fbgl_texture_streams(job->fb);
+
+	for (int32_t b = begin; b < end; b++) {
+		// Clipped to the band, no two bands touch the same pixel
+		fbgl_t band = *job->fb;
+		int32_t x0 = band.clip.x;
+		int32_t y0 = b * FBGL_TILE_SIZE;
+		int32_t x1 = band.clip.x + band.clip.width;
+		int32_t y1 = y0 + FBGL_TILE_SIZE;
+		if (!i_fbgl_clip_box(job->fb, &x0, &y0, &x1, &y1)) {
+			continue;
+		}
+		band.clip.y = y0;
+		band.clip.height = y1 - y0;
+
+		const int32_t first = job->band_start[b];
+		const int32_t last = job->band_start[b + 1];
+		i_fbgl_texture_job_t next;
+		int32_t next_rows = 0;
+		if (first < last) {
+			next_rows = i_fbgl_sprite_setup(
+				&next, &band,
+				&job->sprites[job->band_sprites[first]]);
+		}
+		for (int32_t i = first; i < last; i++) {
+			const i_fbgl_texture_job_t blit = next;
+			const int32_t rows = next_rows;
+			next_rows = 0;
+			if (i + 1 < last) {
+				const int32_t index = job->band_sprites[i + 1];
+				next_rows = i_fbgl_sprite_setup(
+					&next, &band, &job->sprites[index]);
+				i_fbgl_prefetch_rows(&next, next_rows);
+			}
+			if (rows) {
+				i_fbgl_texture_draw(&blit, 0, rows, stream);
+			}
+		}
+	}
+	if (stream) {
+		i_fbgl_stream_fence();
+	}
+}
+
+void fbgl_draw_sprites(fbgl_t *fb, fbgl_sprite_t const *sprites,
+		       int32_t count)
+{
+	if (!fb || !sprites || count <= 0) {
+		return;
+	}
+
+	fbgl_rect_t src;
+	int32_t x;
+	int32_t y;
+	if (i_fbgl_deferring(fb)) {
+		for (int32_t i = 0; i < count; i++) {
+			if (!i_fbgl_sprite_src(&sprites[i], &src, &x, &y)) {
+				continue;
+			}
+			const int32_t args[6] = { x,	     y,
+						  src.x,     src.y,
+						  src.width, src.height };
+			fbgl_tga_texture_t const *texture =
+				&sprites[i].atlas->texture;
+			if (!i_fbgl_record(fb, I_FBGL_CMD_SPRITE, x, y,
+					   x + src.width, y + src.height, 0,
+					   args, 6, texture, NULL, 0)) {
+				i_fbgl_draw_texture_rect(fb, texture, src, x,
+							 y, 255);
+			}
+		}
+		return;
+	}
+
+	// Counting sort by band keeps the submission order within each band,
+	// so overlapping sprites still stack in order
+	const int32_t bands =
+		(fb->height + FBGL_TILE_SIZE - 1) / FBGL_TILE_SIZE;
+	int32_t *band_start =
+		(int32_t *)calloc(2 * ((size_t)bands + 1), sizeof(int32_t));
+	if (!band_start) {
+		perror("Failed to allocate sprite bands");
+		return;
+	}
+	int32_t *band_fill = band_start + bands + 1;
+
+	size_t total = 0;
+	for (int32_t i = 0; i < count; i++) {
+		i_fbgl_texture_job_t blit;
+		if (!i_fbgl_sprite_src(&sprites[i], &src, &x, &y)) {
+			continue;
+		}
+		const int32_t rows = i_fbgl_texture_setup(
+			&blit, fb, &sprites[i].atlas->texture, src, x, y, 255);
+		if (rows == 0) {
+			continue;
+		}
+		const int32_t y0 = blit.y + blit.ty0;
+		i_fbgl_damage(fb, blit.x + blit.tx0, y0, blit.x + blit.tx1,
+			      y0 + rows);
+		for (int32_t b = y0 / FBGL_TILE_SIZE;
+		     b <= (y0 + rows - 1) / FBGL_TILE_SIZE; b++) {
+			band_start[b + 1]++;
+			total++;
+		}
+	}
+	if (total > INT32_MAX) {
+		fprintf(stderr, "Error: too many sprites in one batch.\n");
+		free(band_start);
+		return;
+	}
+	for (int32_t b = 0; b < bands; b++) {
+		band_start[b + 1] += band_start[b];
+		band_fill[b] = band_start[b];
+	}
+
+	int32_t *band_sprites =
+		(int32_t *)malloc((total ? total : 1) * sizeof(int32_t));
+	if (!band_sprites) {
+		perror("Failed to allocate sprite bands");
+		free(band_start);
+		return;
+	}
+	for (int32_t i = 0; i < count; i++) {
+		i_fbgl_texture_job_t blit;
+		if (!i_fbgl_sprite_src(&sprites[i], &src, &x, &y)) {
+			continue;
+		}
+		const int32_t rows = i_fbgl_texture_setup(
+			&blit, fb, &sprites[i].atlas->texture, src, x, y, 255);
+		const int32_t y0 = blit.y + blit.ty0;
+		for (int32_t b = y0 / FBGL_TILE_SIZE;
+		     rows && b <= (y0 + rows - 1) / FBGL_TILE_SIZE; b++) {
+			band_sprites[band_fill[b]++] = i;
+		}
+	}
+
+	i_fbgl_sprite_job_t job = { fb, sprites, band_start, band_sprites };
+	i_fbgl_parallel_for(i_fbgl_sprite_bands, &job, bands, 1);
+
+	free(band_sprites);
+	free(band_start);
+}
+
+uint32_t fb_get_width(fbgl_t const *fb)
+{
+	return fb->width;
+}
+
+uint32_t fb_get_height(fbgl_t const *fb)
+{
+	return fb->height;
+}
+
+uint32_t fb_get_pitch(fbgl_t const *fb)
+{
+	return fb->pitch;
+}
+
+typedef struct i_fbgl_read_job {
+	fbgl_t const *fb;
+	fbgl_rect_t rect;
+	uint8_t *dst;
+	size_t dst_pitch;
+} i_fbgl_read_job_t;
+
+static void i_fbgl_read_rows(void *ctx, int32_t begin, int32_t end)
+{
+	const i_fbgl_read_job_t *job = (const i_fbgl_read_job_t *)ctx;
+	for (int32_t y = begin; y < end; y++) {
+		job->fb->ops.read((uint32_t *)(job->dst + y * job->dst_pitch),
+				  i_fbgl_pixel_addr(job->fb, job->rect.x,
+						    job->rect.y + y),
+				  job->rect.width);
+	}
+}
+
+int fbgl_read_pixels(fbgl_t const *fb, fbgl_rect_t rect, uint32_t *dst,
+		     size_t dst_pitch)
+{
+	if (!fb || !fb->pixels || !dst || rect.x < 0 || rect.y < 0 ||
+	    rect.width <= 0 || rect.height <= 0 ||
+	    rect.x + rect.width > fb->width ||
+	    rect.y + rect.height > fb->height ||
+	    dst_pitch < (size_t)rect.width * 4) {
+		fprintf(stderr, "Error: invalid fbgl_read_pixels arguments.\n");
+		return -1;
+	}
+
+	i_fbgl_read_job_t job = { fb, rect, (uint8_t *)dst, dst_pitch };
+	i_fbgl_parallel_for(i_fbgl_read_rows, &job, rect.height,
+			    i_fbgl_row_grain((size_t)rect.width * 4));
+	return 0;
+}
+
+uint32_t *fb_get_data(fbgl_t const *fb)
+{
+	return fb->pixels;
+}
+
+float fbgl_get_fps(void)
+{
+	struct timespec current_time;
+	clock_gettime(CLOCK_MONOTONIC, &current_time);
+
+	if (previous_frame_time.tv_sec == 0 &&
+	    previous_frame_time.tv_nsec == 0) {
+		previous_frame_time = current_time;
+		return 0.0f;
+	}
+
+	double time_diff =
+		(current_time.tv_sec - previous_frame_time.tv_sec) +
+		(current_time.tv_nsec - previous_frame_time.tv_nsec) / 1e9;
+
+	previous_frame_time = current_time;
+
+	if (time_diff > 0.0) {
+		return 1.0 / time_diff;
+	} else {
+		return 0.0f; // Avoid division by zero
+	}
+}
+
+// Bytes per glyph: char_height rows of whole bytes
+FBGL_INLINE size_t i_fbgl_glyph_size(fbgl_psf1_font_t const *font)
+{
+	return (size_t)(font->char_width + 7) / 8 * font->char_height;
+}
+
+// Next codepoint of UTF-8 text, advancing *s. A byte that does not start
+// a valid sequence stands for itself, so Latin-1 text and raw glyph
+// indices still draw as they always have.
+FBGL_INLINE uint32_t i_fbgl_utf8_next(const uint8_t **s, const uint8_t *end)
+{
+	static const uint32_t smallest[4] = { 0, 0x80, 0x800, 0x10000 };
+	const uint8_t *p = *s;
+	const uint32_t lead = p[0];
+	*s = p + 1;
+	if (lead < 0x80) {
+		return lead;
+	}
+
+	const int32_t n = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0;
+	if (n == 0 || lead > 0xF4 || end - p <= n) {
+		return lead;
+	}
+	uint32_t cp = lead & (0x3F >> n);
+	for (int32_t i = 1; i <= n; i++) {
+		if ((p[i] & 0xC0) != 0x80) {
+			return lead;
+		}
+		cp = cp << 6 | (p[i] & 0x3F);
+	}
+	const bool surrogate = cp >= 0xD800 && cp < 0xE000;
+	if (cp < smallest[n] || cp > 0x10FFFF || surrogate) {
+		return lead;
+	}
+	*s = p + n + 1;
+	return cp;
+}
+
+FBGL_INLINE const uint8_t *i_fbgl_font_glyph(fbgl_psf1_font_t const *font,
+					     uint32_t cp)
+{
+	uint32_t index;
+	if (font->unicode) {
+		const uint32_t page = cp >> 8 < FBGL_FONT_UNICODE_PAGES ?
+					      font->unicode[cp >> 8] :
+					      0;
+		index = font->unicode[FBGL_FONT_UNICODE_PAGES + page * 256u +
+				      (cp & 0xFF)];
+	} else {
+		index = cp < font->glyph_count ? cp : 0;
+	}
+	return font->glyphs + index * i_fbgl_glyph_size(font);
+}
+
+// Two-level glyph map from the (codepoint, glyph) pairs of a Unicode
+// table: one page of 256 glyphs per used block of codepoints, the rest
+// sharing page 0. Unmapped codepoints get the glyph of U+FFFD, else of
+// '?', else glyph 0.
+static uint16_t *i_fbgl_unicode_map(const uint32_t *pairs, size_t count,
+				    uint32_t *size)
+{
+	const uint32_t top = FBGL_FONT_UNICODE_PAGES;
+	uint16_t *map = (uint16_t *)calloc(top, sizeof(*map));
+	if (!map) {
+		perror("Failed to allocate Unicode map");
+		return NULL;
+	}
+	uint32_t pages = 1;
+	for (size_t i = 0; i < count; i++) {
+		if (!map[pairs[i * 2] >> 8]) {
+			map[pairs[i * 2] >> 8] = (uint16_t)pages++;
+		}
+	}
+
+	*size = top + pages * 256;
+	uint16_t *grown = (uint16_t *)realloc(map, *size * sizeof(*map));
+	if (!grown) {
+		perror("Failed to allocate Unicode map");
+		free(map);
+		return NULL;
+	}
+	map = grown;
+	memset(map + top, 0xFF, (size_t)pages * 256 * sizeof(*map));
+	for (size_t i = 0; i < count; i++) {
+		const uint32_t cp = pairs[i * 2];
+		uint16_t *slot = &map[top + map[cp >> 8] * 256u + (cp & 0xFF)];
+		if (*slot == 0xFFFF) {
+			*slot = (uint16_t)pairs[i * 2 + 1];
+		}
+	}
+
+	uint16_t fallback = map[top + map[0xFF] * 256u + 0xFD];
+	if (fallback == 0xFFFF) {
+		fallback = map[top + map[0] * 256u + '?'];
+	}
+	fallback = fallback == 0xFFFF ? 0 : fallback;
+	for (uint32_t i = top; i < *size; i++) {
+		map[i] = map[i] == 0xFFFF ? fallback : map[i];
+	}
+	return map;
+}
+
+// Read the Unicode table after the glyphs: per glyph, its codepoints as
+// 16-bit words (PSF1) or UTF-8 (PSF2), then sequences, then a terminator.
+// Sequences only matter for combining characters and are skipped.
+static bool i_fbgl_psf_unicode(fbgl_psf1_font_t *font, const uint8_t *table,
+			       const uint8_t *end, bool psf2)
+{
+	const size_t limit = (size_t)(end - table);
+	uint32_t *pairs = (uint32_t *)malloc((limit + 1) * 2 * sizeof(*pairs));
+	if (!pairs) {
+		perror("Failed to allocate Unicode table");
+		return false;
+	}
+
+	size_t count = 0;
+	const uint8_t *p = table;
+	for (uint32_t glyph = 0; glyph < font->glyph_count && p < end;
+	     glyph++) {
+		bool sequence = false;
+		while (p < end) {
+			uint32_t cp;
+			if (psf2) {
+				if (*p == 0xFF || *p == 0xFE) {
+					cp = *p == 0xFF ? 0xFFFF : 0xFFFE;
+					p++;
+				} else {
+					cp = i_fbgl_utf8_next(&p, end);
+				}
+			} else {
+				if (end - p < 2) {
+					p = end;
+					break;
+				}
+				cp = p[0] | (uint32_t)p[1] << 8;
+				p += 2;
+			}
+			if (cp == 0xFFFF) {
+				break;
+			}
+			sequence |= cp == 0xFFFE;
+			if (!sequence) {
+				pairs[count * 2] = cp;
+				pairs[count * 2 + 1] = glyph;
+				count++;
+			}
+		}
+	}
+
+	font->unicode = i_fbgl_unicode_map(pairs, count, &font->unicode_size);
+	free(pairs);
+	return font->unicode != NULL;
+}
+
+static fbgl_psf1_font_t *i_fbgl_psf_parse(const uint8_t *data, size_t size)
+{
+	const bool psf2 = size >= 32 && data[0] == 0x72 && data[1] == 0xB5 &&
+			  data[2] == 0x4A && data[3] == 0x86;
+	if (!psf2 && (size < 4 || data[0] != 0x36 || data[1] != 0x04)) {
+		fprintf(stderr, "Invalid PSF magic number\n");
+		return NULL;
+	}
+
+	// Allocate memory for the font structure
+	fbgl_psf1_font_t *font = calloc(1, sizeof(fbgl_psf1_font_t));
+	if (!font) {
+		perror("Failed to allocate memory for font");
+		return NULL;
+	}
+	font->magic[0] = data[0];
+	font->magic[1] = data[1];
+
+	size_t offset = 4;
+	bool unicode;
+	if (psf2) {
+		// Little-endian header: version, size, flags, glyphs, bytes
+		// per glyph, height, width
+		uint32_t h[7];
+		for (int32_t i = 0; i < 7; i++) {
+			const uint8_t *v = data + 4 + i * 4;
+			h[i] = v[0] | (uint32_t)v[1] << 8 |
+			       (uint32_t)v[2] << 16 | (uint32_t)v[3] << 24;
+		}
+		if (h[1] < 32 || h[1] > size || h[3] == 0 || h[3] > 65535 ||
+		    h[5] == 0 || h[5] > 255 || h[6] == 0 || h[6] > 256 ||
+		    h[4] != (h[6] + 7) / 8 * h[5]) {
+			fprintf(stderr, "Unsupported PSF2 font layout\n");
+			free(font);
+			return NULL;
+		}
+		offset = h[1];
+		unicode = h[2] & 0x01;
+		font->glyph_count = (uint16_t)h[3];
+		font->char_height = (uint8_t)h[5];
+		font->char_width = (uint16_t)h[6];
+	} else {
+		font->mode = data[2];
+		font->char_height = data[3];
+		font->glyph_count = (font->mode & 0x01) ? 512 : 256;
+		font->char_width = 8; // PSF1 glyphs are always 8 pixels wide
+		unicode = font->mode & 0x06;
+	}
+
+	size_t glyph_data_size = font->glyph_count * i_fbgl_glyph_size(font);
+	if (size - offset < glyph_data_size) {
+		fprintf(stderr, "Failed to read glyph data: file truncated\n");
+		free(font);
+		return NULL;
+	}
+
+	// Allocate memory for glyphs
+	font->glyphs = malloc(glyph_data_size ? glyph_data_size : 1);
+	if (!font->glyphs) {
+		perror("Failed to allocate memory for glyphs");
+		free(font);
+		return NULL;
+	}
+	memcpy(font->glyphs, data + offset, glyph_data_size);
+
+	const uint8_t *table = data + offset + glyph_data_size;
+	if (unicode && !i_fbgl_psf_unicode(font, table, data + size, psf2)) {
+		fbgl_destroy_psf1_font(font);
+		return NULL;
+	}
+	return font;
+}
+
+fbgl_psf1_font_t *fbgl_load_psf_font(const char *path)
+{
+	i_fbgl_file_t file;
+	if (i_fbgl_file_open(&file, path) != 0) {
+		return NULL;
+	}
+	fbgl_psf1_font_t *font = i_fbgl_psf_parse(file.data, file.size);
+	i_fbgl_file_close(&file);
+	return font;
+}
+
+fbgl_psf1_font_t *fbgl_load_psf1_font(const char *path)
+{
+	return fbgl_load_psf_font(path);
+}
+
+void fbgl_destroy_psf1_font(fbgl_psf1_font_t *font)
+{
+	if (font) {
+		free(font->unicode);
+		free(font->glyphs);
+		free(font);
+	}
+}
+
+// Glyphs gathered per kernel call
+#define I_FBGL_TEXT_CHUNK 64
+
+// Lay one row of count glyphs side by side as a single bit row
+static void i_fbgl_glyph_gather(uint8_t *bits, const uint8_t *const *glyphs,
+				int32_t count, size_t offset, int32_t width)
+{
+	const size_t row_bytes = (size_t)(width + 7) / 8;
+	if (width == 8) {
+		for (int32_t i = 0; i < count; i++) {
+			bits[i] = glyphs[i][offset];
+		}
+		return;
+	}
+	if ((width & 7) == 0) {
+		for (int32_t i = 0; i < count; i++) {
+			memcpy(bits + i * row_bytes, glyphs[i] + offset,
+			       row_bytes);
+		}
+		return;
+	}
+
+	// Other widths are shifted into place, dropping the padding bits
+	const uint32_t pad = 0xFF & (0xFF << (row_bytes * 8 - width));
+	memset(bits, 0, ((size_t)count * width + 7) / 8 + 1);
+	for (int32_t i = 0; i < count; i++) {
+		size_t pos = (size_t)i * width;
+		for (size_t b = 0; b < row_bytes; b++, pos += 8) {
+			uint32_t byte = glyphs[i][offset + b];
+			byte &= b + 1 == row_bytes ? pad : 0xFF;
+			const uint32_t wide = byte << 8 >> (pos & 7);
+			bits[pos >> 3] |= (uint8_t)(wide >> 8);
+			bits[(pos >> 3) + 1] |= (uint8_t)wide;
+		}
+	}
+}
+
+// Draw the first length bytes of text
+static void i_fbgl_render_psf(fbgl_t *fb, fbgl_psf1_font_t const *font,
+			      const char *text, size_t length, int x, int y,
+			      uint32_t color)
+{
+	// Every glyph takes at least one byte, so this bounds the width
+	const int32_t width = font->char_width;
+	if (i_fbgl_deferring(fb)) {
+		const int32_t args[3] = { x, y, (int32_t)length };
+		if (i_fbgl_record(fb, I_FBGL_CMD_TEXT, x, y,
+				  x + (int32_t)length * width,
+				  y + font->char_height, color, args, 3, font,
+				  text, length)) {
+			return;
+		}
+	}
+
+	const uint32_t native = fb->ops.map_color(color);
+
+	// Clip the whole string once, glyphs only clip columns
+	int32_t x0 = x;
+	int32_t y0 = y;
+	int32_t x1 = x + (int32_t)length * width;
+	int32_t y1 = y + font->char_height;
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+
+	// Rows of the glyphs that land inside the clip rect
+	const int row0 = y0 - y;
+	const int row1 = y1 - y;
+	const size_t row_bytes = (size_t)(width + 7) / 8;
+
+	// Skip glyphs left of the clip rect without looking them up
+	const uint8_t *s = (const uint8_t *)text;
+	const uint8_t *end = s + length;
+	int32_t pen = x;
+	while (s < end && pen + width <= x0) {
+		i_fbgl_utf8_next(&s, end);
+		pen += width;
+	}
+
+	// Decode a chunk of glyphs, then draw it a bit row at a time
+	const uint8_t *glyphs[I_FBGL_TEXT_CHUNK];
+	uint8_t bits[I_FBGL_TEXT_CHUNK * 32 + 2];
+	while (s < end && pen < x1) {
+		const int32_t left = pen;
+		int32_t count = 0;
+		while (s < end && pen < x1 && count < I_FBGL_TEXT_CHUNK) {
+			const uint32_t cp = i_fbgl_utf8_next(&s, end);
+			glyphs[count++] = i_fbgl_font_glyph(font, cp);
+			pen += width;
+		}
+
+		// Columns of the chunk that land inside the clip rect
+		const int32_t col0 = x0 > left ? x0 - left : 0;
+		const int32_t col1 = x1 < pen ? x1 - left : pen - left;
+		uint8_t *dst = i_fbgl_pixel_addr(fb, left + col0, y + row0);
+		for (int row = row0; row < row1; row++, dst += fb->pitch) {
+			i_fbgl_glyph_gather(bits, glyphs, count,
+					    (size_t)row * row_bytes, width);
+			fb->ops.glyph(dst, bits, col0, col1, native);
+		}
+	}
+	if (pen > x0) {
+		i_fbgl_damage(fb, x0, y0, pen < x1 ? pen : x1, y1);
+	}
+}
+
+void fbgl_render_psf1_text(fbgl_t *fb, fbgl_psf1_font_t *font, const char *text,
+			   int x, int y, uint32_t color)
+{
+	if (!fb || !font || !text)
+		return;
+
+	i_fbgl_render_psf(fb, font, text, strlen(text), x, y, color);
+}
+
+/**
+ * TrueType fonts
+ *
+ * FreeType renders a glyph the first time it is drawn inside the clip
+ * rect; measuring loads only its advance. The coverage goes into a square 8-bit atlas, packed
+ * onto shelves of similar height.
+ * Metrics stay cached for the life of the font. When the atlas is full,
+ * the least recently drawn shelf that is tall enough is cleared, or the
+ * whole atlas if none is. Text is drawn by scaling the premultiplied
+ * color by coverage and compositing it like any other blend.
+ */
+#ifdef FBGL_USE_FREETYPE
+#define I_FBGL_TTF_EMPTY UINT32_MAX
+#define I_FBGL_TTF_KERN_SLOTS 4096
+
+typedef struct i_fbgl_ttf_glyph {
+	uint32_t cp; // Key, I_FBGL_TTF_EMPTY when unused
+	uint32_t index; // FreeType glyph index
+	int32_t advance; // 26.6 pixels
+	int16_t left, top; // Bitmap offset from the pen on the baseline
+	uint16_t width, height; // 0 for glyphs that draw nothing
+	uint16_t x, y; // Atlas position
+	int32_t shelf; // -1 when not in the atlas
+	bool rendered; // left, top, width and height are known
+} i_fbgl_ttf_glyph_t;
+
+typedef struct i_fbgl_ttf_shelf {
+	int32_t y, height;
+	int32_t fill; // Columns in use
+	uint64_t used; // Draw call that last read it
+} i_fbgl_ttf_shelf_t;
+
+typedef struct i_fbgl_ttf_kern {
+	uint64_t pair; // Left << 32 | right glyph index, UINT64_MAX if unused
+	int32_t x; // 26.6 pixels
+} i_fbgl_ttf_kern_t;
+
+struct fbgl_ttf_font {
+	FT_Library library;
+	FT_Face face;
+	int32_t ascent; // Pixels from the top of a line to the baseline
+	int32_t line_height;
+	uint8_t *atlas;
+	int32_t atlas_size; // Texels per side
+	i_fbgl_ttf_shelf_t *shelves; // One per row at most
+	int32_t shelf_count;
+	int32_t shelf_bottom; // First row below the last shelf
+	i_fbgl_ttf_glyph_t *glyphs; // Open addressing by codepoint
+	uint32_t glyph_mask;
+	i_fbgl_ttf_kern_t *kerns; // NULL if the font has no kerning
+	uint32_t kern_count;
+	uint64_t tick; // Draw calls so far
+	fbgl_ttf_stats_t stats;
+};
+
+FBGL_INLINE uint32_t i_fbgl_ttf_hash(uint64_t key)
+{
+	return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static i_fbgl_ttf_glyph_t *i_fbgl_ttf_slot(i_fbgl_ttf_glyph_t *glyphs,
+					   uint32_t mask, uint32_t cp)
+{
+	uint32_t i = i_fbgl_ttf_hash(cp) & mask;
+	while (glyphs[i].cp != cp && glyphs[i].cp != I_FBGL_TTF_EMPTY) {
+		i = (i + 1) & mask;
+	}
+	return &glyphs[i];
+}
+
+static bool i_fbgl_ttf_grow(fbgl_ttf_font_t *font)
+{
+	const uint32_t mask = font->glyph_mask * 2 + 1;
+	i_fbgl_ttf_glyph_t *glyphs =
+		(i_fbgl_ttf_glyph_t *)malloc((mask + 1) * sizeof(*glyphs));
+	if (!glyphs) {
+		perror("Failed to grow glyph table");
+		return false;
+	}
+	for (uint32_t i = 0; i <= mask; i++) {
+		glyphs[i].cp = I_FBGL_TTF_EMPTY;
+	}
+	for (uint32_t i = 0; i <= font->glyph_mask; i++) {
+		if (font->glyphs[i].cp != I_FBGL_TTF_EMPTY) {
+			*i_fbgl_ttf_slot(glyphs, mask, font->glyphs[i].cp) =
+				font->glyphs[i];
+		}
+	}
+	free(font->glyphs);
+	font->glyphs = glyphs;
+	font->glyph_mask = mask;
+	return true;
+}
+
+// Drop the glyphs on shelf, or on every shelf if shelf is -1
+static void i_fbgl_ttf_evict(fbgl_ttf_font_t *font, int32_t shelf)
+{
+	for (uint32_t i = 0; i <= font->glyph_mask; i++) {
+		i_fbgl_ttf_glyph_t *g = &font->glyphs[i];
+		if (g->cp != I_FBGL_TTF_EMPTY && g->shelf >= 0 &&
+		    (shelf < 0 || g->shelf == shelf)) {
+			g->shelf = -1;
+			font->stats.evictions++;
+		}
+	}
+	if (shelf < 0) {
+		font->shelf_count = 0;
+		font->shelf_bottom = 0;
+	} else {
+		font->shelves[shelf].fill = 0;
+	}
+}
+
+// Shelf with room for a width x height glyph, making room if needed
+static int32_t i_fbgl_ttf_shelf(fbgl_ttf_font_t *font, int32_t width,
+				int32_t height)
+{
+	// Tightest shelf with room that is not much taller than the glyph
+	const int32_t size = font->atlas_size;
+	const int32_t slack = height + height / 4 + 2;
+	int32_t best = -1;
+	for (int32_t i = 0; i < font->shelf_count; i++) {
+		const i_fbgl_ttf_shelf_t *s = &font->shelves[i];
+		if (s->height >= height && s->height <= slack &&
+		    s->fill + width <= size &&
+		    (best < 0 || s->height < font->shelves[best].height)) {
+			best = i;
+		}
+	}
+	if (best >= 0) {
+		return best;
+	}
+
+	if (font->shelf_bottom + height > size) {
+		// Least recently drawn shelf that is tall enough
+		for (int32_t i = 0; i < font->shelf_count; i++) {
+			const i_fbgl_ttf_shelf_t *s = &font->shelves[i];
+			if (s->height >= height &&
+			    (best < 0 || s->used < font->shelves[best].used)) {
+				best = i;
+			}
+		}
+		i_fbgl_ttf_evict(font, best);
+		if (best >= 0) {
+			return best;
+		}
+	}
+
+	// Rounded up so glyphs of nearby heights share shelves
+	const int32_t rounded = (height + 3) & ~3;
+	i_fbgl_ttf_shelf_t *s = &font->shelves[font->shelf_count];
+	s->y = font->shelf_bottom;
+	s->height = rounded <= size - s->y ? rounded : height;
+	s->fill = 0;
+	font->shelf_bottom += s->height;
+	return font->shelf_count++;
+}
+
+// Render g with FreeType and copy its coverage into the atlas
+static void i_fbgl_ttf_rasterize(fbgl_ttf_font_t *font, i_fbgl_ttf_glyph_t *g)
+{
+	const FT_GlyphSlot slot = font->face->glyph;
+	const FT_Bitmap *bitmap = &slot->bitmap;
+	g->width = 0;
+	g->height = 0;
+	g->rendered = true;
+	if (FT_Load_Glyph(font->face, g->index, FT_LOAD_RENDER) != 0) {
+		return;
+	}
+	font->stats.rasterized++;
+	g->advance = (int32_t)slot->advance.x;
+	g->left = (int16_t)slot->bitmap_left;
+	g->top = (int16_t)slot->bitmap_top;
+
+	const int32_t width = (int32_t)bitmap->width;
+	const int32_t height = (int32_t)bitmap->rows;
+	const bool mono = bitmap->pixel_mode == FT_PIXEL_MODE_MONO;
+	if (width == 0 || height == 0 || width > font->atlas_size ||
+	    height > font->atlas_size ||
+	    (!mono && bitmap->pixel_mode != FT_PIXEL_MODE_GRAY)) {
+		return;
+	}
+
+	g->shelf = i_fbgl_ttf_shelf(font, width, height);
+	i_fbgl_ttf_shelf_t *s = &font->shelves[g->shelf];
+	g->x = (uint16_t)s->fill;
+	g->y = (uint16_t)s->y;
+	g->width = (uint16_t)width;
+	g->height = (uint16_t)height;
+	s->fill += width;
+	s->used = font->tick;
+
+	// Rows run bottom up when the pitch is negative
+	const uint8_t *src = bitmap->buffer;
+	if (bitmap->pitch < 0) {
+		src -= (ptrdiff_t)bitmap->pitch * (height - 1);
+	}
+	uint8_t *dst = font->atlas + (size_t)g->y * font->atlas_size + g->x;
+	for (int32_t y = 0; y < height; y++) {
+		for (int32_t x = 0; x < width; x++) {
+			if (mono) {
+				const uint32_t bits = src[x >> 3] << (x & 7);
+				dst[x] = bits & 0x80 ? 255 : 0;
+			} else {
+				dst[x] = src[x];
+			}
+		}
+		src += bitmap->pitch;
+		dst += font->atlas_size;
+	}
+}
+
+// Cached glyph of cp with its advance. It is rasterized into the atlas
+// only once it is drawn where it can be seen.
+static i_fbgl_ttf_glyph_t *i_fbgl_ttf_glyph(fbgl_ttf_font_t *font,
+					    uint32_t cp)
+{
+	i_fbgl_ttf_glyph_t *g =
+		i_fbgl_ttf_slot(font->glyphs, font->glyph_mask, cp);
+	if (g->cp == cp) {
+		return g;
+	}
+
+	// Kept at most half full
+	if ((uint32_t)font->stats.glyphs * 2 + 2 > font->glyph_mask + 1) {
+		if (!i_fbgl_ttf_grow(font)) {
+			return NULL;
+		}
+		g = i_fbgl_ttf_slot(font->glyphs, font->glyph_mask, cp);
+	}
+	memset(g, 0, sizeof(*g));
+	g->cp = cp;
+	g->index = FT_Get_Char_Index(font->face, cp);
+	g->shelf = -1;
+	font->stats.glyphs++;
+	if (FT_Load_Glyph(font->face, g->index, FT_LOAD_DEFAULT) == 0) {
+		g->advance = (int32_t)font->face->glyph->advance.x;
+	}
+	return g;
+}
+
+// Kerning between two glyphs in 26.6 pixels, through a bounded cache
+static int32_t i_fbgl_ttf_kerning(fbgl_ttf_font_t *font, uint32_t left,
+				  uint32_t right)
+{
+	if (!font->kerns || left == 0 || right == 0) {
+		return 0;
+	}
+	const uint32_t mask = I_FBGL_TTF_KERN_SLOTS - 1;
+	const uint64_t pair = (uint64_t)left << 32 | right;
+	uint32_t i = i_fbgl_ttf_hash(pair) & mask;
+	while (font->kerns[i].pair != UINT64_MAX) {
+		if (font->kerns[i].pair == pair) {
+			return font->kerns[i].x;
+		}
+		i = (i + 1) & mask;
+	}
+
+	// Start over once three quarters full
+	if (font->kern_count >= I_FBGL_TTF_KERN_SLOTS / 4 * 3) {
+		for (uint32_t k = 0; k <= mask; k++) {
+			font->kerns[k].pair = UINT64_MAX;
+		}
+		font->kern_count = 0;
+		i = i_fbgl_ttf_hash(pair) & mask;
+	}
+	FT_Vector kerning;
+	if (FT_Get_Kerning(font->face, left, right, FT_KERNING_DEFAULT,
+			   &kerning) != 0) {
+		kerning.x = 0;
+	}
+	font->kerns[i].pair = pair;
+	font->kerns[i].x = (int32_t)kerning.x;
+	font->kern_count++;
+	return font->kerns[i].x;
+}
+
+fbgl_ttf_font_t *fbgl_load_ttf_font(const char *path, int px)
+{
+	if (!path || px < 1 || px > FBGL_TTF_MAX_SIZE) {
+		fprintf(stderr, "Invalid TrueType font size %d\n", px);
+		return NULL;
+	}
+	fbgl_ttf_font_t *font = (fbgl_ttf_font_t *)calloc(1, sizeof(*font));
+	if (!font) {
+		perror("Failed to allocate memory for font");
+		return NULL;
+	}
+	if (FT_Init_FreeType(&font->library) != 0) {
+		fprintf(stderr, "Failed to initialize FreeType\n");
+		free(font);
+		return NULL;
+	}
+	if (FT_New_Face(font->library, path, 0, &font->face) != 0 ||
+	    FT_Set_Pixel_Sizes(font->face, 0, (FT_UInt)px) != 0) {
+		fprintf(stderr, "Failed to load TrueType font %s\n", path);
+		fbgl_destroy_ttf_font(font);
+		return NULL;
+	}
+	const FT_Size_Metrics *metrics = &font->face->size->metrics;
+	font->ascent = (int32_t)((metrics->ascender + 63) >> 6);
+	font->line_height = (int32_t)((metrics->height + 63) >> 6);
+
+	// Room for a few hundred glyphs at any size
+	font->atlas_size = 256;
+	while (font->atlas_size < px * 8) {
+		font->atlas_size *= 2;
+	}
+	const size_t size = (size_t)font->atlas_size;
+	font->atlas = (uint8_t *)malloc(size * size);
+	font->shelves =
+		(i_fbgl_ttf_shelf_t *)malloc(size * sizeof(*font->shelves));
+	font->glyph_mask = 255;
+	font->glyphs = (i_fbgl_ttf_glyph_t *)malloc(
+		(font->glyph_mask + 1) * sizeof(*font->glyphs));
+	if (FT_HAS_KERNING(font->face)) {
+		font->kerns = (i_fbgl_ttf_kern_t *)malloc(
+			I_FBGL_TTF_KERN_SLOTS * sizeof(*font->kerns));
+	}
+	if (!font->atlas || !font->shelves || !font->glyphs ||
+	    (FT_HAS_KERNING(font->face) && !font->kerns)) {
+		perror("Failed to allocate glyph cache");
+		fbgl_destroy_ttf_font(font);
+		return NULL;
+	}
+	for (uint32_t i = 0; i <= font->glyph_mask; i++) {
+		font->glyphs[i].cp = I_FBGL_TTF_EMPTY;
+	}
+	for (uint32_t i = 0; font->kerns && i < I_FBGL_TTF_KERN_SLOTS; i++) {
+		font->kerns[i].pair = UINT64_MAX;
+	}
+	return font;
+}
+
+void fbgl_destroy_ttf_font(fbgl_ttf_font_t *font)
+{
+	if (!font) {
+		return;
+	}
+	if (font->face) {
+		FT_Done_Face(font->face);
+	}
+	FT_Done_FreeType(font->library);
+	free(font->atlas);
+	free(font->shelves);
+	free(font->glyphs);
+	free(font->kerns);
+	free(font);
+}
+
+int fbgl_ttf_line_height(fbgl_ttf_font_t const *font)
+{
+	return font ? font->line_height : 0;
+}
+
+fbgl_ttf_stats_t fbgl_ttf_font_stats(fbgl_ttf_font_t const *font)
+{
+	fbgl_ttf_stats_t stats;
+	if (font) {
+		stats = font->stats;
+	} else {
+		memset(&stats, 0, sizeof(stats));
+	}
+	return stats;
+}
+
+// Composite count pixels of shade by coverage over dst
+static void i_fbgl_ttf_row(fbgl_t const *fb, uint8_t *dst,
+			   const uint8_t *coverage, int32_t count,
+			   const uint32_t *shade)
+{
+	uint32_t row[I_FBGL_BLEND_CHUNK];
+	while (count > 0) {
+		const int32_t n = count < I_FBGL_BLEND_CHUNK ?
+					  count :
+					  I_FBGL_BLEND_CHUNK;
+		for (int32_t i = 0; i < n; i++) {
+			row[i] = shade[coverage[i]];
+		}
+		i_fbgl_blend_pixels(fb, dst, row, n, 255);
+		dst += (size_t)n * fb->ops.bytes_per_pixel;
+		coverage += n;
+		count -= n;
+	}
+}
+
+// Draw the first length bytes of text
+static void i_fbgl_render_ttf(fbgl_t *fb, fbgl_ttf_font_t *font,
+			      const char *text, size_t length, int x, int y,
+			      uint32_t color)
+{
+	// Drawing can rasterize and evict glyphs, which tiles replayed on
+	// the pool must not do, so what is queued is drawn first
+	if (i_fbgl_deferring(fb)) {
+		i_fbgl_deferred_flush(fb);
+	}
+
+	// Premultiplied color at every coverage level
+	uint32_t shade[256];
+	const uint32_t premultiplied =
+		fbgl_premultiply(color >> 24 ? color : color | 0xFF000000);
+	for (uint32_t i = 0; i < 256; i++) {
+		shade[i] = i_fbgl_scale_argb(premultiplied, i);
+	}
+
+	font->tick++;
+	const uint8_t *s = (const uint8_t *)text;
+	const uint8_t *end = s + length;
+	int32_t pen = 0; // 26.6 pixels right of x
+	uint32_t prev = 0;
+	int32_t box[4] = { INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN };
+	while (s < end) {
+		i_fbgl_ttf_glyph_t *g =
+			i_fbgl_ttf_glyph(font, i_fbgl_utf8_next(&s, end));
+		if (!g) {
+			break;
+		}
+		pen += i_fbgl_ttf_kerning(font, prev, g->index);
+		prev = g->index;
+		const int32_t origin = x + ((pen + 32) >> 6);
+		pen += g->advance;
+
+		// A glyph never drawn has no bitmap size yet. It is rendered
+		// only if a box a line height larger all round than its
+		// advance could be seen, so text off screen leaves the atlas
+		// alone.
+		const bool cached = g->shelf >= 0;
+		if (!g->rendered) {
+			const int32_t margin = font->line_height;
+			const int32_t advance = (g->advance + 63) >> 6;
+			int32_t bx0 = origin - margin;
+			int32_t by0 = y - margin;
+			int32_t bx1 = origin + advance + margin;
+			int32_t by1 = y + font->line_height + margin;
+			if (!i_fbgl_clip_box(fb, &bx0, &by0, &bx1, &by1)) {
+				continue;
+			}
+			i_fbgl_ttf_rasterize(font, g);
+			if (g->shelf < 0) {
+				continue;
+			}
+		}
+
+		const int32_t gx = origin + g->left;
+		const int32_t gy = y + font->ascent - g->top;
+		int32_t x0 = gx;
+		int32_t y0 = gy;
+		int32_t x1 = gx + g->width;
+		int32_t y1 = gy + g->height;
+		if (g->width == 0 || !i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+			continue;
+		}
+		if (cached) {
+			font->stats.hits++;
+			font->shelves[g->shelf].used = font->tick;
+		} else if (g->shelf < 0) {
+			i_fbgl_ttf_rasterize(font, g);
+			if (g->shelf < 0) {
+				continue;
+			}
+		}
+
+		const uint8_t *coverage = font->atlas +
+					  (size_t)(g->y + y0 - gy) *
+						  font->atlas_size +
+					  g->x + (x0 - gx);
+		uint8_t *dst = i_fbgl_pixel_addr(fb, x0, y0);
+		for (int32_t yy = y0; yy < y1; yy++) {
+			i_fbgl_ttf_row(fb, dst, coverage, x1 - x0, shade);
+			coverage += font->atlas_size;
+			dst += fb->pitch;
+		}
+		box[0] = x0 < box[0] ? x0 : box[0];
+		box[1] = y0 < box[1] ? y0 : box[1];
+		box[2] = x1 > box[2] ? x1 : box[2];
+		box[3] = y1 > box[3] ? y1 : box[3];
+	}
+
+	if (box[0] < box[2]) {
+		i_fbgl_damage(fb, box[0], box[1], box[2], box[3]);
+		if (fb->stream_stores) {
+			i_fbgl_stream_fence();
+		}
+	}
+}
+
+void fbgl_render_ttf_text(fbgl_t *fb, fbgl_ttf_font_t *font, const char *text,
+			  int x, int y, uint32_t color)
+{
+	if (!fb || !font || !text)
+		return;
+
+	i_fbgl_render_ttf(fb, font, text, strlen(text), x, y, color);
+}
+#endif // FBGL_USE_FREETYPE
+
+struct fbgl_pack {
+	i_fbgl_file_t file;
+	const fbgl_pack_entry_t *entries;
+	int32_t count;
+	fbgl_atlas_t *atlases; // Texture and atlas views, one per entry
+	fbgl_psf1_font_t *fonts; // Font views, one per entry
+};
+
+// Whether size bytes at offset lie inside the pack, suitably aligned
+static bool i_fbgl_pack_range(fbgl_pack_t const *pack, uint64_t offset,
+			      uint64_t size, uint64_t align)
+{
+	return offset % align == 0 && offset <= pack->file.size &&
+	       size <= pack->file.size - offset;
+}
+
+// Every page index and glyph of a font's Unicode map must be in range
+static bool i_fbgl_pack_check_font(fbgl_pack_t const *pack,
+				   fbgl_pack_entry_t const *e)
+{
+	const uint64_t glyph_bytes = (uint64_t)(e->width + 7) / 8 * e->height;
+	if (e->width == 0 || e->width > 256 || e->height == 0 ||
+	    e->height > 255 || e->count == 0 || e->count > 65535 ||
+	    !i_fbgl_pack_range(pack, e->data, e->count * glyph_bytes, 1)) {
+		return false;
+	}
+	if (e->runs == 0) {
+		return e->rect_count == 0;
+	}
+
+	const uint32_t top = FBGL_FONT_UNICODE_PAGES;
+	const uint32_t size = e->rect_count;
+	if (size <= top || (size - top) % 256 != 0 ||
+	    !i_fbgl_pack_range(pack, e->runs, (uint64_t)size * 2, 2)) {
+		return false;
+	}
+	const uint16_t *map =
+		(const uint16_t *)((const uint8_t *)pack->file.data + e->runs);
+	for (uint32_t i = 0; i < size; i++) {
+		if (map[i] >= (i < top ? (size - top) / 256 : e->count)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Check everything drawing trusts: bounds, row indices and runs. Texels
+// and glyphs are never read here, so their pages stay on disk until used.
+static bool i_fbgl_pack_check(fbgl_pack_t const *pack,
+			      fbgl_pack_entry_t const *e)
+{
+	const uint8_t *base = pack->file.data;
+	if (!memchr(e->name, 0, sizeof(e->name))) {
+		return false;
+	}
+
+	if (e->kind == FBGL_PACK_FONT) {
+		return i_fbgl_pack_check_font(pack, e);
+	}
+	if (e->kind != FBGL_PACK_TEXTURE && e->kind != FBGL_PACK_ATLAS) {
+		return false;
+	}
+	if (e->width == 0 || e->height == 0 ||
+	    (e->flags & ~(uint32_t)FBGL_TEXTURE_OPAQUE) ||
+	    !i_fbgl_pack_range(pack, e->data,
+			       (uint64_t)e->width * e->height * 4, 4)) {
+		return false;
+	}
+	if (e->kind == FBGL_PACK_ATLAS &&
+	    !i_fbgl_pack_range(pack, e->rects,
+			       (uint64_t)e->rect_count * sizeof(fbgl_rect_t),
+			       4)) {
+		return false;
+	}
+	if (e->runs == 0) {
+		return e->count == 0;
+	}
+
+	const uint64_t index_bytes = ((uint64_t)e->height + 1) * 4;
+	if (!i_fbgl_pack_range(pack, e->runs,
+			       index_bytes +
+				       (uint64_t)e->count *
+					       sizeof(fbgl_texture_run_t),
+			       4)) {
+		return false;
+	}
+	const uint32_t *row_runs = (const uint32_t *)(base + e->runs);
+	const fbgl_texture_run_t *runs =
+		(const fbgl_texture_run_t *)(base + e->runs + index_bytes);
+	if (row_runs[0] != 0 || row_runs[e->height] != e->count) {
+		return false;
+	}
+	for (uint32_t y = 0; y < e->height; y++) {
+		if (row_runs[y] > row_runs[y + 1]) {
+			return false;
+		}
+		uint32_t x = 0;
+		for (uint32_t i = row_runs[y]; i < row_runs[y + 1]; i++) {
+			if (runs[i].start < x || runs[i].end <= runs[i].start ||
+			    runs[i].end > e->width ||
+			    runs[i].kind > FBGL_RUN_PARTIAL) {
+				return false;
+			}
+			x = runs[i].end;
+		}
+	}
+	return true;
+}
+
+fbgl_pack_t *fbgl_pack_open(const char *path)
+{
+	fbgl_pack_t *pack = (fbgl_pack_t *)calloc(1, sizeof(*pack));
+	if (!pack) {
+		perror("Failed to allocate asset pack");
+		return NULL;
+	}
+	if (i_fbgl_file_open(&pack->file, path) != 0) {
+		free(pack);
+		return NULL;
+	}
+
+	fbgl_pack_header_t header;
+	if (pack->file.size < sizeof(header)) {
+		fprintf(stderr, "Error: %s is not an fbgl asset pack.\n", path);
+		fbgl_pack_close(pack);
+		return NULL;
+	}
+	memcpy(&header, pack->file.data, sizeof(header));
+	if (memcmp(header.magic, FBGL_PACK_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != FBGL_PACK_VERSION ||
+	    header.entry_count > INT32_MAX ||
+	    !i_fbgl_pack_range(pack, header.entries,
+			       (uint64_t)header.entry_count *
+				       sizeof(fbgl_pack_entry_t),
+			       8)) {
+		fprintf(stderr, "Error: %s is not an fbgl asset pack.\n", path);
+		fbgl_pack_close(pack);
+		return NULL;
+	}
+	pack->entries =
+		(const fbgl_pack_entry_t *)(pack->file.data + header.entries);
+	pack->count = (int32_t)header.entry_count;
+
+	if (pack->count > 0) {
+		pack->atlases = (fbgl_atlas_t *)calloc(
+			pack->count,
+			sizeof(fbgl_atlas_t) + sizeof(fbgl_psf1_font_t));
+		if (!pack->atlases) {
+			perror("Failed to allocate asset pack");
+			fbgl_pack_close(pack);
+			return NULL;
+		}
+		pack->fonts =
+			(fbgl_psf1_font_t *)(pack->atlases + pack->count);
+	}
+
+	uint8_t *base = (uint8_t *)pack->file.data;
+	for (int32_t i = 0; i < pack->count; i++) {
+		fbgl_pack_entry_t const *e = &pack->entries[i];
+		// Sorted names keep lookups a bisection
+		if (!i_fbgl_pack_check(pack, e) ||
+		    (i > 0 &&
+		     strcmp(pack->entries[i - 1].name, e->name) >= 0)) {
+			fprintf(stderr, "Error: corrupt entry %d in %s.\n",
+				(int)i, path);
+			fbgl_pack_close(pack);
+			return NULL;
+		}
+
+		// Views share the read-only mapping, nothing is copied
+		if (e->kind == FBGL_PACK_FONT) {
+			fbgl_psf1_font_t *font = &pack->fonts[i];
+			font->magic[0] = 0x72;
+			font->magic[1] = 0xB5;
+			font->char_height = (uint8_t)e->height;
+			font->glyphs = base + e->data;
+			font->glyph_count = (uint16_t)e->count;
+			font->char_width = e->width;
+			if (e->runs) {
+				font->unicode = (uint16_t *)(base + e->runs);
+				font->unicode_size = e->rect_count;
+			}
+			continue;
+		}
+		fbgl_atlas_t *atlas = &pack->atlases[i];
+		atlas->texture.width = e->width;
+		atlas->texture.height = e->height;
+		atlas->texture.data = (uint32_t *)(base + e->data);
+		atlas->texture.flags = e->flags;
+		if (e->runs) {
+			atlas->texture.row_runs = (uint32_t *)(base + e->runs);
+			atlas->texture.runs =
+				(fbgl_texture_run_t *)(base + e->runs +
+						       ((size_t)e->height + 1) *
+							       4);
+		}
+		if (e->kind == FBGL_PACK_ATLAS) {
+			atlas->rects = (fbgl_rect_t *)(base + e->rects);
+			atlas->count = (int32_t)e->rect_count;
+		}
+	}
+	return pack;
+}
+
+void fbgl_pack_close(fbgl_pack_t *pack)
+{
+	if (pack) {
+		if (pack->file.data) {
+			i_fbgl_file_close(&pack->file);
+		}
+		free(pack->atlases);
+		free(pack);
+	}
+}
+
+// Entries are sorted by name, bisect for it
+static int32_t i_fbgl_pack_find(fbgl_pack_t const *pack, const char *name,
+				uint32_t kind, uint32_t alias)
+{
+	int32_t lo = 0;
+	int32_t hi = pack ? pack->count : 0;
+	while (name && lo < hi) {
+		const int32_t mid = lo + (hi - lo) / 2;
+		const int order = strcmp(name, pack->entries[mid].name);
+		if (order == 0) {
+			const uint32_t found = pack->entries[mid].kind;
+			return found == kind || found == alias ? mid : -1;
+		}
+		if (order < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return -1;
+}
+
+fbgl_tga_texture_t const *fbgl_pack_texture(fbgl_pack_t const *pack,
+					    const char *name)
+{
+	// An atlas is a texture too
+	const int32_t i = i_fbgl_pack_find(pack, name, FBGL_PACK_TEXTURE,
+					   FBGL_PACK_ATLAS);
+	return i < 0 ? NULL : &pack->atlases[i].texture;
+}
+
+fbgl_atlas_t const *fbgl_pack_atlas(fbgl_pack_t const *pack,
+				    const char *name)
+{
+	const int32_t i = i_fbgl_pack_find(pack, name, FBGL_PACK_ATLAS,
+					   FBGL_PACK_ATLAS);
+	return i < 0 ? NULL : &pack->atlases[i];
+}
+
+fbgl_psf1_font_t *fbgl_pack_font(fbgl_pack_t const *pack, const char *name)
+{
+	const int32_t i = i_fbgl_pack_find(pack, name, FBGL_PACK_FONT,
+					   FBGL_PACK_FONT);
+	return i < 0 ? NULL : &pack->fonts[i];
+}
+
+/**
+ * Asset cache
+ *
+ * Every get stat()s the path; a known path whose inode, size and times
+ * are unchanged is answered without opening the file. Otherwise the file
+ * is read and hashed, so the same bytes under another path, or a file
+ * that was touched but not changed, still share one decoded copy.
+ * Released assets stay cached until the total decoded size exceeds the
+ * budget, then the least recently used go first.
+ */
+typedef struct i_fbgl_asset {
+	struct i_fbgl_asset *prev, *next; // Most recently used first
+	uint32_t kind;
+	void *asset;
+	size_t bytes;
+	uint64_t hash; // Of the file contents
+	uint64_t file_size;
+	int32_t refs;
+} i_fbgl_asset_t;
+
+typedef struct i_fbgl_asset_path {
+	char *path;
+	uint32_t kind;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t ctime;
+	i_fbgl_asset_t *asset;
+} i_fbgl_asset_path_t;
+
+struct fbgl_asset_cache {
+	i_fbgl_asset_t *head;
+	i_fbgl_asset_t *tail;
+	i_fbgl_asset_path_t *paths;
+	int32_t path_count;
+	int32_t path_capacity;
+	fbgl_asset_stats_t stats;
+};
+
+// Four independent multiply chains, so hashing keeps up with the decoders
+static uint64_t i_fbgl_hash64(const uint8_t *data, size_t size)
+{
+	const uint64_t k = 0x9E3779B97F4A7C15ull;
+	uint64_t h[4] = { k ^ size, k + 1, k + 2, k + 3 };
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		for (int lane = 0; lane < 4; lane++) {
+			uint64_t w;
+			memcpy(&w, data + i + lane * 8, 8);
+			h[lane] = (h[lane] ^ w) * 0xFF51AFD7ED558CCDull;
+			h[lane] ^= h[lane] >> 32;
+		}
+	}
+	uint64_t r = h[0] ^ h[1] * 3 ^ h[2] * 5 ^ h[3] * 7;
+	for (; i < size; i++) {
+		r = (r ^ data[i]) * 0x100000001B3ull;
+	}
+	r ^= r >> 33;
+	r *= 0xC4CEB9FE1A85EC53ull;
+	return r ^ r >> 33;
+}
+
+static size_t i_fbgl_asset_bytes(uint32_t kind, const void *asset)
+{
+	if (kind == FBGL_ASSET_FONT) {
+		const fbgl_psf1_font_t *font = (const fbgl_psf1_font_t *)asset;
+		return sizeof(*font) +
+		       font->glyph_count * i_fbgl_glyph_size(font) +
+		       (size_t)font->unicode_size * sizeof(uint16_t);
+	}
+	const fbgl_tga_texture_t *texture = (const fbgl_tga_texture_t *)asset;
+	size_t bytes = sizeof(*texture) +
+		       (size_t)texture->width * texture->height * 4;
+	if (texture->row_runs) {
+		bytes += ((size_t)texture->height + 1) * sizeof(uint32_t) +
+			 texture->row_runs[texture->height] *
+				 sizeof(fbgl_texture_run_t);
+	}
+	return bytes;
+}
+
+static void i_fbgl_asset_unlink(fbgl_asset_cache_t *cache, i_fbgl_asset_t *a)
+{
+	if (a->prev) {
+		a->prev->next = a->next;
+	} else {
+		cache->head = a->next;
+	}
+	if (a->next) {
+		a->next->prev = a->prev;
+	} else {
+		cache->tail = a->prev;
+	}
+	a->prev = a->next = NULL;
+}
+
+static void i_fbgl_asset_push(fbgl_asset_cache_t *cache, i_fbgl_asset_t *a)
+{
+	a->next = cache->head;
+	if (cache->head) {
+		cache->head->prev = a;
+	} else {
+		cache->tail = a;
+	}
+	cache->head = a;
+}
+
+// Free an asset together with the paths naming it
+static void i_fbgl_asset_free(fbgl_asset_cache_t *cache, i_fbgl_asset_t *a)
+{
+	for (int32_t i = 0; i < cache->path_count;) {
+		i_fbgl_asset_path_t *p = &cache->paths[i];
+		if (p->asset == a) {
+			free(p->path);
+			*p = cache->paths[--cache->path_count];
+		} else {
+			i++;
+		}
+	}
+	i_fbgl_asset_unlink(cache, a);
+	if (a->kind == FBGL_ASSET_FONT) {
+		fbgl_destroy_psf1_font((fbgl_psf1_font_t *)a->asset);
+	} else {
+		fbgl_destroy_texture((fbgl_tga_texture_t *)a->asset);
+	}
+	cache->stats.bytes -= a->bytes;
+	cache->stats.count--;
+	free(a);
+}
+
+static void i_fbgl_asset_trim(fbgl_asset_cache_t *cache)
+{
+	i_fbgl_asset_t *a = cache->tail;
+	while (a && cache->stats.bytes > cache->stats.budget) {
+		i_fbgl_asset_t *prev = a->prev;
+		if (a->refs == 0) {
+			i_fbgl_asset_free(cache, a);
+			cache->stats.evictions++;
+		}
+		a = prev;
+	}
+}
+
+fbgl_asset_cache_t *fbgl_asset_cache_create(size_t budget)
+{
+	fbgl_asset_cache_t *cache =
+		(fbgl_asset_cache_t *)calloc(1, sizeof(*cache));
+	if (!cache) {
+		perror("Failed to allocate asset cache");
+		return NULL;
+	}
+	cache->stats.budget = budget;
+	return cache;
+}
+
+void fbgl_asset_cache_destroy(fbgl_asset_cache_t *cache)
+{
+	if (cache) {
+		while (cache->head) {
+			i_fbgl_asset_free(cache, cache->head);
+		}
+		free(cache->paths);
+		free(cache);
+	}
+}
+
+void fbgl_asset_cache_set_budget(fbgl_asset_cache_t *cache, size_t budget)
+{
+	if (cache) {
+		cache->stats.budget = budget;
+		i_fbgl_asset_trim(cache);
+	}
+}
+
+fbgl_asset_stats_t fbgl_asset_cache_stats(fbgl_asset_cache_t const *cache)
+{
+	fbgl_asset_stats_t stats;
+	if (cache) {
+		stats = cache->stats;
+	} else {
+		memset(&stats, 0, sizeof(stats));
+	}
+	return stats;
+}
+
+// Read path, then share a cached asset with the same contents or decode it
+static i_fbgl_asset_t *i_fbgl_asset_load(fbgl_asset_cache_t *cache,
+					 const char *path, uint32_t kind)
+{
+	i_fbgl_file_t file;
+	if (i_fbgl_file_open(&file, path) != 0) {
+		return NULL;
+	}
+	const uint64_t hash = i_fbgl_hash64(file.data, file.size);
+	for (i_fbgl_asset_t *a = cache->head; a; a = a->next) {
+		if (a->kind == kind && a->hash == hash &&
+		    a->file_size == file.size) {
+			i_fbgl_file_close(&file);
+			cache->stats.hits++;
+			cache->stats.shared++;
+			return a;
+		}
+	}
+
+	i_fbgl_asset_t *a = (i_fbgl_asset_t *)calloc(1, sizeof(*a));
+	if (!a) {
+		perror("Failed to allocate asset");
+		i_fbgl_file_close(&file);
+		return NULL;
+	}
+	if (kind == FBGL_ASSET_FONT) {
+		a->asset = i_fbgl_psf_parse(file.data, file.size);
+	} else {
+		a->asset = fbgl_load_texture_memory(file.data, file.size);
+	}
+	i_fbgl_file_close(&file);
+	if (!a->asset) {
+		fprintf(stderr, "Failed to decode %s\n", path);
+		free(a);
+		return NULL;
+	}
+	a->kind = kind;
+	a->bytes = i_fbgl_asset_bytes(kind, a->asset);
+	a->hash = hash;
+	a->file_size = file.size;
+	i_fbgl_asset_push(cache, a);
+	cache->stats.bytes += a->bytes;
+	cache->stats.count++;
+	cache->stats.misses++;
+	return a;
+}
+
+void *fbgl_asset_get(fbgl_asset_cache_t *cache, const char *path,
+		     fbgl_asset_kind_t kind)
+{
+	if (!cache || !path ||
+	    (kind != FBGL_ASSET_TEXTURE && kind != FBGL_ASSET_FONT)) {
+		fprintf(stderr, "Invalid asset request\n");
+		return NULL;
+	}
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		perror(path);
+		return NULL;
+	}
+
+	i_fbgl_asset_path_t *p = NULL;
+	for (int32_t i = 0; i < cache->path_count && !p; i++) {
+		if (cache->paths[i].kind == (uint32_t)kind &&
+		    strcmp(cache->paths[i].path, path) == 0) {
+			p = &cache->paths[i];
+		}
+	}
+
+	i_fbgl_asset_t *a;
+	if (p && p->dev == st.st_dev && p->ino == st.st_ino &&
+	    p->size == st.st_size && p->mtime == st.st_mtime &&
+	    p->ctime == st.st_ctime) {
+		a = p->asset;
+		cache->stats.hits++;
+	} else {
+		if (!p && cache->path_count == cache->path_capacity) {
+			int32_t capacity = cache->path_capacity * 2;
+			capacity = capacity ? capacity : 16;
+			i_fbgl_asset_path_t *paths =
+				(i_fbgl_asset_path_t *)realloc(
+					cache->paths,
+					capacity * sizeof(*paths));
+			if (!paths) {
+				perror("Failed to allocate asset paths");
+				return NULL;
+			}
+			cache->paths = paths;
+			cache->path_capacity = capacity;
+		}
+		char *name = p ? p->path : strdup(path);
+		if (!name) {
+			perror("Failed to allocate asset path");
+			return NULL;
+		}
+		a = i_fbgl_asset_load(cache, path, kind);
+		if (!a) {
+			if (!p) {
+				free(name);
+			}
+			return NULL;
+		}
+		// A changed file gets the new asset; the old one ages out
+		if (!p) {
+			p = &cache->paths[cache->path_count++];
+		}
+		p->path = name;
+		p->kind = kind;
+		p->dev = st.st_dev;
+		p->ino = st.st_ino;
+		p->size = st.st_size;
+		p->mtime = st.st_mtime;
+		p->ctime = st.st_ctime;
+		p->asset = a;
+	}
+
+	if (a->refs++ == 0) {
+		cache->stats.in_use++;
+	}
+	i_fbgl_asset_unlink(cache, a);
+	i_fbgl_asset_push(cache, a);
+	i_fbgl_asset_trim(cache);
+	return a->asset;
+}
+
+void fbgl_asset_release(fbgl_asset_cache_t *cache, const void *asset)
+{
+	if (!cache || !asset) {
+		return;
+	}
+	for (i_fbgl_asset_t *a = cache->head; a; a = a->next) {
+		if (a->asset == asset) {
+			if (a->refs > 0 && --a->refs == 0) {
+				cache->stats.in_use--;
+				i_fbgl_asset_trim(cache);
+			}
+			return;
+		}
+	}
+	fprintf(stderr, "Released asset is not in the cache\n");
+}
+
+struct fbgl_load_job {
+	fbgl_load_job_t *next; // Queued after this one
+	uint32_t kind; // fbgl_asset_kind_t
+	int32_t status; // fbgl_load_status_t, published after asset
+	void *asset;
+	char path[];
+};
+
+// Decode on the calling thread; the pool stays with whoever is drawing
+static void i_fbgl_load_run(fbgl_load_job_t *job)
+{
+	i_fbgl_file_t file;
+	if (i_fbgl_file_open(&file, job->path) == 0) {
+		if (job->kind == FBGL_ASSET_FONT) {
+			job->asset = i_fbgl_psf_parse(file.data, file.size);
+		} else {
+			job->asset = i_fbgl_texture_decode(file.data,
+							   file.size, false);
+		}
+		i_fbgl_file_close(&file);
+	}
+	__atomic_store_n(&job->status,
+			 job->asset ? FBGL_LOAD_DONE : FBGL_LOAD_FAILED,
+			 __ATOMIC_RELEASE);
+}
+
+#ifdef FBGL_THREADS
+// A single loader thread works through the queue in order. It is started
+// by the first job and stopped, after the queue drains, by
+// fbgl_threads_destroy().
+static struct {
+	pthread_t thread;
+	bool running;
+	bool quit;
+	pthread_mutex_t lock;
+	pthread_cond_t queued;
+	pthread_cond_t loaded;
+	fbgl_load_job_t *head;
+	fbgl_load_job_t *tail;
+} i_fbgl_loader = { .lock = PTHREAD_MUTEX_INITIALIZER,
+		    .queued = PTHREAD_COND_INITIALIZER,
+		    .loaded = PTHREAD_COND_INITIALIZER };
+
+static void *i_fbgl_loader_main(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&i_fbgl_loader.lock);
+	for (;;) {
+		while (!i_fbgl_loader.head && !i_fbgl_loader.quit) {
+			pthread_cond_wait(&i_fbgl_loader.queued,
+					  &i_fbgl_loader.lock);
+		}
+		fbgl_load_job_t *job = i_fbgl_loader.head;
+		if (!job) {
+			break;
+		}
+		i_fbgl_loader.head = job->next;
+		if (!i_fbgl_loader.head) {
+			i_fbgl_loader.tail = NULL;
+		}
+		pthread_mutex_unlock(&i_fbgl_loader.lock);
+
+		i_fbgl_load_run(job);
+
+		pthread_mutex_lock(&i_fbgl_loader.lock);
+		pthread_cond_broadcast(&i_fbgl_loader.loaded);
+	}
+	pthread_mutex_unlock(&i_fbgl_loader.lock);
+	return NULL;
+}
+#endif // FBGL_THREADS
+
+static void i_fbgl_loader_stop(void)
+{
+#ifdef FBGL_THREADS
+	pthread_mutex_lock(&i_fbgl_loader.lock);
+	const bool running = i_fbgl_loader.running;
+	i_fbgl_loader.quit = true;
+	pthread_cond_signal(&i_fbgl_loader.queued);
+	pthread_mutex_unlock(&i_fbgl_loader.lock);
+
+	if (running) {
+		pthread_join(i_fbgl_loader.thread, NULL);
+	}
+	i_fbgl_loader.running = false;
+	i_fbgl_loader.quit = false;
+#endif // FBGL_THREADS
+}
+
+static fbgl_load_job_t *i_fbgl_load_async(const char *path, uint32_t kind)
+{
+	if (!path) {
+		fprintf(stderr, "Error: no path to load.\n");
+		return NULL;
+	}
+	const size_t length = strlen(path) + 1;
+	fbgl_load_job_t *job =
+		(fbgl_load_job_t *)calloc(1, sizeof(*job) + length);
+	if (!job) {
+		perror("Failed to allocate load job");
 		return NULL;
 	}
+	job->kind = kind;
+	job->status = FBGL_LOAD_PENDING;
+	memcpy(job->path, path, length);
+
+	// Pick kernels here, before another thread can race on the choice
+	i_fbgl_select_simd();
+
+#ifdef FBGL_THREADS
+	pthread_mutex_lock(&i_fbgl_loader.lock);
+	if (!i_fbgl_loader.running) {
+		i_fbgl_loader.running =
+			pthread_create(&i_fbgl_loader.thread, NULL,
+				       i_fbgl_loader_main, NULL) == 0;
+	}
+	if (i_fbgl_loader.running) {
+		if (i_fbgl_loader.tail) {
+			i_fbgl_loader.tail->next = job;
+		} else {
+			i_fbgl_loader.head = job;
+		}
+		i_fbgl_loader.tail = job;
+		pthread_cond_signal(&i_fbgl_loader.queued);
+		pthread_mutex_unlock(&i_fbgl_loader.lock);
+		return job;
+	}
+	pthread_mutex_unlock(&i_fbgl_loader.lock);
+	fprintf(stderr, "Error: failed to start the loader thread.\n");
+#endif // FBGL_THREADS
 
-	// Determine if image is flipped (based on image descriptor)
-	bool bottom_up = !(image_descriptor & 0x20);
+	// No loader thread: the job is done before it is returned
+	i_fbgl_load_run(job);
+	return job;
+}
 
-	for (size_t i = 0; i < pixel_count; i++) {
-		size_t pixel_index =
-			bottom_up ?
-				(texture->height - 1 - (i / texture->width)) *
-						texture->width +
-					(i % texture->width) :
-				i;
+fbgl_load_job_t *fbgl_load_tga_texture_async(const char *path)
+{
+	return i_fbgl_load_async(path, FBGL_ASSET_TEXTURE);
+}
 
-		if (fread(pixel_buffer, 1, bits_per_pixel / 8, file) !=
-		    bits_per_pixel / 8) {
-			perror("Error reading pixel data");
-			free(pixel_buffer);
-			free(texture->data);
-			free(texture);
-			fclose(file);
-			return NULL;
-		}
+fbgl_load_job_t *fbgl_load_psf1_font_async(const char *path)
+{
+	return i_fbgl_load_async(path, FBGL_ASSET_FONT);
+}
 
-		// Convert BGR(A) to RGBA
-		uint32_t pixel = 0xFF000000; // Default alpha to 255
-		pixel |= pixel_buffer[2] << 16; // R
-		pixel |= pixel_buffer[1] << 8; // G
-		pixel |= pixel_buffer[0]; // B
-		if (bits_per_pixel == 32) {
-			pixel = (pixel & 0x00FFFFFF) |
-				(pixel_buffer[3] << 24); // A
-		}
+fbgl_load_status_t fbgl_load_poll(fbgl_load_job_t const *job)
+{
+	if (!job) {
+		return FBGL_LOAD_FAILED;
+	}
+	return (fbgl_load_status_t)__atomic_load_n(&job->status,
+						   __ATOMIC_ACQUIRE);
+}
 
-		texture->data[pixel_index] = pixel;
+void *fbgl_load_finish(fbgl_load_job_t *job)
+{
+	if (!job) {
+		return NULL;
 	}
+#ifdef FBGL_THREADS
+	if (fbgl_load_poll(job) == FBGL_LOAD_PENDING) {
+		pthread_mutex_lock(&i_fbgl_loader.lock);
+		while (fbgl_load_poll(job) == FBGL_LOAD_PENDING) {
+			pthread_cond_wait(&i_fbgl_loader.loaded,
+					  &i_fbgl_loader.lock);
+		}
+		pthread_mutex_unlock(&i_fbgl_loader.lock);
+	}
+#endif // FBGL_THREADS
+	void *asset = job->asset;
+	free(job);
+	return asset;
+}
 
-	free(pixel_buffer);
-	fclose(file);
-	return texture;
+/**
+ * Text layout
+ *
+ * Lines break at newlines. With a wrap width, they also break at the last
+ * space that fits, or before the first glyph that does not fit when a
+ * word is wider than the line. The spaces at a wrap belong to neither
+ * line. Widths are pen advances, the positions the renderers use, so a
+ * run drawn on its own lands where the layout put it.
+ */
+FBGL_INLINE bool i_fbgl_text_valid(fbgl_text_font_t font)
+{
+#ifdef FBGL_USE_FREETYPE
+	return font.psf || font.ttf;
+#else
+	return font.psf;
+#endif
 }
 
-void fbgl_destroy_texture(fbgl_tga_texture_t *texture)
+static int32_t i_fbgl_text_line_height(fbgl_text_font_t font)
 {
-	if (texture) {
-		free(texture->data);
-		free(texture);
+#ifdef FBGL_USE_FREETYPE
+	if (!font.psf) {
+		return font.ttf->line_height;
 	}
+#endif
+	return font.psf->char_height;
 }
 
-void fbgl_draw_texture(fbgl_t *fb, fbgl_tga_texture_t const *texture, int32_t x,
-		       int32_t y)
+// Pen advance of cp in 26.6 pixels, kerned against the glyph in *prev
+static int32_t i_fbgl_text_advance(fbgl_text_font_t font, uint32_t cp,
+				   uint32_t *prev)
 {
-	if (!fb || !texture || !texture->data) {
-		return;
+#ifdef FBGL_USE_FREETYPE
+	if (!font.psf) {
+		const i_fbgl_ttf_glyph_t *g = i_fbgl_ttf_glyph(font.ttf, cp);
+		if (!g) {
+			return 0;
+		}
+		const int32_t kerning =
+			i_fbgl_ttf_kerning(font.ttf, *prev, g->index);
+		*prev = g->index;
+		return kerning + g->advance;
 	}
+#endif
+	(void)cp;
+	(void)prev;
+	return font.psf->char_width * 64;
+}
 
-	for (int ty = 0; ty < texture->height; ty++) {
-		for (int tx = 0; tx < texture->width; tx++) {
-			int screen_x = x + tx;
-			int screen_y = y + ty;
+typedef struct i_fbgl_text_lines {
+	fbgl_text_run_t *runs; // Grown as lines are added, unless measuring
+	int32_t count;
+	int32_t capacity;
+	int32_t width; // Of the widest line
+	bool measure; // Count lines without keeping runs
+} i_fbgl_text_lines_t;
+
+static bool i_fbgl_text_push(i_fbgl_text_lines_t *lines, int32_t start,
+			     int32_t length, int32_t width, int32_t height)
+{
+	if (!lines->measure) {
+		if (lines->count == lines->capacity) {
+			const int32_t capacity =
+				lines->capacity ? lines->capacity * 2 : 4;
+			fbgl_text_run_t *runs = (fbgl_text_run_t *)realloc(
+				lines->runs, capacity * sizeof(*runs));
+			if (!runs) {
+				perror("Failed to allocate text runs");
+				return false;
+			}
+			lines->runs = runs;
+			lines->capacity = capacity;
+		}
+		fbgl_text_run_t *run = &lines->runs[lines->count];
+		run->start = start;
+		run->length = length;
+		run->x = 0;
+		run->y = lines->count * height;
+		run->width = width;
+	}
+	lines->count++;
+	lines->width = width > lines->width ? width : lines->width;
+	return true;
+}
 
-			// Skip if outside screen bounds
-			if (screen_x < 0 || screen_x >= fb->width ||
-			    screen_y < 0 || screen_y >= fb->height) {
+static bool i_fbgl_text_break(fbgl_text_font_t font, const char *text,
+			      int32_t max_width, i_fbgl_text_lines_t *lines)
+{
+	const uint8_t *base = (const uint8_t *)text;
+	const uint8_t *end = base + strlen(text);
+	const int32_t height = i_fbgl_text_line_height(font);
+	const int32_t limit = max_width > 0 && max_width < INT32_MAX / 64 ?
+				      max_width * 64 :
+				      INT32_MAX;
+
+	const uint8_t *s = base;
+	bool newline = s < end;
+	while (s < end || newline) {
+		const uint8_t *line = s;
+		const uint8_t *stop = end; // End of the line's glyphs
+		const uint8_t *wrap = NULL; // Start of the last spaces
+		int32_t wrap_pen = 0;
+		int32_t pen = 0;
+		uint32_t prev = 0;
+		newline = false;
+		while (s < end) {
+			const uint8_t *at = s;
+			if (*s == '\n') {
+				stop = at;
+				s++;
+				newline = true;
+				break;
+			}
+			const uint32_t cp = i_fbgl_utf8_next(&s, end);
+			if (cp == ' ' && at > line && at[-1] != ' ') {
+				wrap = at;
+				wrap_pen = pen;
+			}
+			const int32_t advance =
+				i_fbgl_text_advance(font, cp, &prev);
+			if (pen + advance <= limit || at == line || cp == ' ') {
+				pen += advance;
 				continue;
 			}
 
-			uint32_t pixel =
-				texture->data[ty * texture->width + tx];
-			// Only draw if pixel is not fully transparent
-			if ((pixel & 0xFF000000) != 0) {
-				fbgl_put_pixel(screen_x, screen_y, pixel, fb);
+			// Wrap at the last spaces, or split the word here
+			stop = wrap ? wrap : at;
+			pen = wrap ? wrap_pen : pen;
+			s = stop;
+			while (s < end && *s == ' ') {
+				s++;
+			}
+			if (s < end && *s == '\n') {
+				s++;
+				newline = true;
 			}
+			break;
+		}
+		if (!i_fbgl_text_push(lines, (int32_t)(line - base),
+				      (int32_t)(stop - line), (pen + 32) >> 6,
+				      height)) {
+			return false;
 		}
 	}
+	return true;
 }
 
-uint32_t fb_get_width(fbgl_t const *fb)
+fbgl_text_size_t fbgl_text_measure(fbgl_text_font_t font, const char *text)
 {
-	return fb->width;
+	fbgl_text_size_t size = { 0, 0 };
+	if (!text || !i_fbgl_text_valid(font)) {
+		return size;
+	}
+	i_fbgl_text_lines_t lines = { NULL, 0, 0, 0, true };
+	i_fbgl_text_break(font, text, 0, &lines);
+	size.width = lines.width;
+	size.height = lines.count * i_fbgl_text_line_height(font);
+	return size;
 }
 
-uint32_t fb_get_height(fbgl_t const *fb)
+fbgl_text_layout_t *fbgl_text_layout(fbgl_text_font_t font, const char *text,
+				     int32_t max_width)
 {
-	return fb->height;
+	if (!text || !i_fbgl_text_valid(font)) {
+		return NULL;
+	}
+	fbgl_text_layout_t *layout =
+		(fbgl_text_layout_t *)calloc(1, sizeof(*layout));
+	const size_t length = strlen(text);
+	char *copy = (char *)malloc(length + 1);
+	if (!layout || !copy) {
+		perror("Failed to allocate text layout");
+		free(layout);
+		free(copy);
+		return NULL;
+	}
+	memcpy(copy, text, length + 1);
+	layout->font = font;
+	layout->text = copy;
+	layout->max_width = max_width > 0 ? max_width : 0;
+
+	i_fbgl_text_lines_t lines = { NULL, 0, 0, 0, false };
+	if (!i_fbgl_text_break(font, copy, layout->max_width, &lines)) {
+		free(lines.runs);
+		fbgl_text_layout_destroy(layout);
+		return NULL;
+	}
+	layout->runs = lines.runs;
+	layout->run_count = lines.count;
+	layout->width = lines.width;
+	layout->height = lines.count * i_fbgl_text_line_height(font);
+	return layout;
 }
 
-uint32_t *fb_get_data(fbgl_t const *fb)
+void fbgl_text_layout_destroy(fbgl_text_layout_t *layout)
 {
-	return fb->pixels;
+	if (layout) {
+		free(layout->text);
+		free(layout->runs);
+		free(layout);
+	}
 }
 
-float fbgl_get_fps(void)
+void fbgl_draw_text_layout(fbgl_t *fb, fbgl_text_layout_t const *layout,
+			   int x, int y, uint32_t color)
 {
-	struct timespec current_time;
-	clock_gettime(CLOCK_MONOTONIC, &current_time);
-
-	if (previous_frame_time.tv_sec == 0 &&
-	    previous_frame_time.tv_nsec == 0) {
-		previous_frame_time = current_time;
-		return 0.0f;
+	if (!fb || !layout) {
+		return;
+	}
+	const int32_t height = i_fbgl_text_line_height(layout->font);
+	const int32_t top = fb->clip.y;
+	const int32_t bottom = fb->clip.y + fb->clip.height;
+	for (int32_t i = 0; i < layout->run_count; i++) {
+		const fbgl_text_run_t *run = &layout->runs[i];
+		const char *text = layout->text + run->start;
+		const size_t length = (size_t)run->length;
+		const int32_t run_x = x + run->x;
+		const int32_t run_y = y + run->y;
+		if (length == 0 || run_y >= bottom || run_y + height <= top) {
+			continue;
+		}
+#ifdef FBGL_USE_FREETYPE
+		if (!layout->font.psf) {
+			i_fbgl_render_ttf(fb, layout->font.ttf, text, length,
+					  run_x, run_y, color);
+			continue;
+		}
+#endif
+		i_fbgl_render_psf(fb, layout->font.psf, text, length, run_x,
+				  run_y, color);
 	}
+}
 
-	double time_diff =
-		(current_time.tv_sec - previous_frame_time.tv_sec) +
-		(current_time.tv_nsec - previous_frame_time.tv_nsec) / 1e9;
+/**
+ * Text layout cache
+ *
+ * Layouts are found by a hash of font, wrap width and text in a chained
+ * table. The text is then compared, so a collision costs a relayout and
+ * never gives a wrong layout. Past capacity, the least recently used
+ * layout is freed.
+ */
+typedef struct i_fbgl_text_entry {
+	fbgl_text_layout_t *layout;
+	uint64_t hash;
+	int32_t chain; // Next entry in the same bucket, -1 at the end
+	int32_t prev, next; // Most recently used first, -1 at the ends
+} i_fbgl_text_entry_t;
+
+struct fbgl_text_cache {
+	i_fbgl_text_entry_t *entries;
+	int32_t *buckets; // First entry of each bucket, -1 if empty
+	uint32_t bucket_mask;
+	int32_t capacity;
+	int32_t count;
+	int32_t head, tail;
+};
+
+static uint64_t i_fbgl_text_hash(fbgl_text_font_t font, const char *text,
+				 size_t length, int32_t max_width)
+{
+	const uint64_t key[3] = { (uint64_t)(uintptr_t)font.psf,
+				  (uint64_t)(uintptr_t)font.ttf,
+				  (uint64_t)(uint32_t)max_width };
+	return i_fbgl_hash64((const uint8_t *)text, length) ^
+	       i_fbgl_hash64((const uint8_t *)key, sizeof(key)) * 3;
+}
 
-	previous_frame_time = current_time;
+static void i_fbgl_text_unlink(fbgl_text_cache_t *cache, int32_t i)
+{
+	i_fbgl_text_entry_t *e = &cache->entries[i];
+	if (e->prev >= 0) {
+		cache->entries[e->prev].next = e->next;
+	} else {
+		cache->head = e->next;
+	}
+	if (e->next >= 0) {
+		cache->entries[e->next].prev = e->prev;
+	} else {
+		cache->tail = e->prev;
+	}
+}
 
-	if (time_diff > 0.0) {
-		return 1.0 / time_diff;
+static void i_fbgl_text_push_front(fbgl_text_cache_t *cache, int32_t i)
+{
+	i_fbgl_text_entry_t *e = &cache->entries[i];
+	e->prev = -1;
+	e->next = cache->head;
+	if (cache->head >= 0) {
+		cache->entries[cache->head].prev = i;
 	} else {
-		return 0.0f; // Avoid division by zero
+		cache->tail = i;
 	}
+	cache->head = i;
 }
 
-fbgl_psf1_font_t *fbgl_load_psf1_font(const char *path)
+fbgl_text_cache_t *fbgl_text_cache_create(int32_t capacity)
 {
-	FILE *file = fopen(path, "rb");
-	if (!file) {
-		perror("Failed to open font file");
+	if (capacity < 1) {
+		fprintf(stderr, "Invalid text cache capacity %d\n",
+			(int)capacity);
 		return NULL;
 	}
-
-	// Allocate memory for the font structure
-	fbgl_psf1_font_t *font = malloc(sizeof(fbgl_psf1_font_t));
-	if (!font) {
-		perror("Failed to allocate memory for font");
-		fclose(file);
+	fbgl_text_cache_t *cache =
+		(fbgl_text_cache_t *)calloc(1, sizeof(*cache));
+	if (!cache) {
+		perror("Failed to allocate text cache");
+		return NULL;
+	}
+	uint32_t buckets = 16;
+	while (buckets < (uint32_t)capacity && buckets < (1u << 30)) {
+		buckets *= 2;
+	}
+	cache->entries = (i_fbgl_text_entry_t *)malloc(
+		(size_t)capacity * sizeof(*cache->entries));
+	cache->buckets = (int32_t *)malloc(buckets * sizeof(*cache->buckets));
+	if (!cache->entries || !cache->buckets) {
+		perror("Failed to allocate text cache");
+		fbgl_text_cache_destroy(cache);
 		return NULL;
 	}
+	memset(cache->buckets, 0xFF, buckets * sizeof(*cache->buckets));
+	cache->bucket_mask = buckets - 1;
+	cache->capacity = capacity;
+	cache->head = -1;
+	cache->tail = -1;
+	return cache;
+}
 
-	// Read the header (4 bytes)
-	uint8_t header[4];
-	if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
-		perror("Failed to read font header");
-		free(font);
-		fclose(file);
+void fbgl_text_cache_destroy(fbgl_text_cache_t *cache)
+{
+	if (!cache) {
+		return;
+	}
+	for (int32_t i = 0; i < cache->count; i++) {
+		fbgl_text_layout_destroy(cache->entries[i].layout);
+	}
+	free(cache->entries);
+	free(cache->buckets);
+	free(cache);
+}
+
+fbgl_text_layout_t const *fbgl_text_cache_layout(fbgl_text_cache_t *cache,
+						 fbgl_text_font_t font,
+						 const char *text,
+						 int32_t max_width)
+{
+	if (!cache || !text) {
 		return NULL;
 	}
+	max_width = max_width > 0 ? max_width : 0;
+	const uint64_t hash =
+		i_fbgl_text_hash(font, text, strlen(text), max_width);
+	int32_t *bucket = &cache->buckets[hash & cache->bucket_mask];
+	for (int32_t i = *bucket; i >= 0; i = cache->entries[i].chain) {
+		const fbgl_text_layout_t *layout = cache->entries[i].layout;
+		if (cache->entries[i].hash == hash &&
+		    layout->font.psf == font.psf &&
+		    layout->font.ttf == font.ttf &&
+		    layout->max_width == max_width &&
+		    strcmp(layout->text, text) == 0) {
+			i_fbgl_text_unlink(cache, i);
+			i_fbgl_text_push_front(cache, i);
+			return layout;
+		}
+	}
 
-	// Verify magic number
-	if (header[0] != 0x36 || header[1] != 0x04) {
-		fprintf(stderr, "Invalid PSF1 magic number\n");
-		free(font);
-		fclose(file);
+	fbgl_text_layout_t *layout = fbgl_text_layout(font, text, max_width);
+	if (!layout) {
 		return NULL;
 	}
+	int32_t i = cache->count;
+	if (cache->count < cache->capacity) {
+		cache->count++;
+	} else {
+		// Reuse the least recently used entry
+		i = cache->tail;
+		i_fbgl_text_entry_t *old = &cache->entries[i];
+		int32_t *link = &cache->buckets[old->hash & cache->bucket_mask];
+		while (*link != i) {
+			link = &cache->entries[*link].chain;
+		}
+		*link = old->chain;
+		i_fbgl_text_unlink(cache, i);
+		fbgl_text_layout_destroy(old->layout);
+	}
+
+	i_fbgl_text_entry_t *e = &cache->entries[i];
+	e->layout = layout;
+	e->hash = hash;
+	e->chain = *bucket;
+	*bucket = i;
+	i_fbgl_text_push_front(cache, i);
+	return layout;
+}
+
+/**
+ * Console
+ *
+ * A grid of cells, each a codepoint with its own colors. Next to the cells
+ * the console keeps a copy of what the last draw put on screen, so a draw
+ * repaints only cells that differ from it. Rows that were written since
+ * are flagged, so unchanged rows are not even compared. Scrolling moves
+ * the cells at once but leaves the pixels until the next draw, which then
+ * moves the framebuffer rows instead of repainting them.
+ */
+typedef struct i_fbgl_console_cell {
+	uint32_t cp;
+	uint32_t fg, bg;
+} i_fbgl_console_cell_t;
+
+struct fbgl_console {
+	fbgl_psf1_font_t const *font;
+	int32_t x, y; // Top left pixel
+	int32_t cols, rows;
+	int32_t cursor_col, cursor_row;
+	uint32_t fg, bg; // Colors of writes, prints and blank rows
+	i_fbgl_console_cell_t *cells; // What should be on screen
+	i_fbgl_console_cell_t *shown; // What the last draw left on screen
+	uint8_t *dirty; // Rows written since the last draw
+	int32_t scroll; // Rows moved up since the last draw, down if negative
+};
+
+// Never a codepoint, so a shown cell holding it is always repainted
+#define I_FBGL_CONSOLE_UNKNOWN UINT32_MAX
+
+FBGL_INLINE bool i_fbgl_console_same(i_fbgl_console_cell_t const *a,
+				     i_fbgl_console_cell_t const *b)
+{
+	return a->cp == b->cp && a->fg == b->fg && a->bg == b->bg;
+}
+
+static void i_fbgl_console_blank(fbgl_console_t *console, int32_t row,
+				 int32_t count)
+{
+	const i_fbgl_console_cell_t blank = { ' ', console->fg, console->bg };
+	const size_t row_cells = (size_t)console->cols;
+	i_fbgl_console_cell_t *cell = &console->cells[row * row_cells];
+	for (size_t i = 0; i < count * row_cells; i++) {
+		cell[i] = blank;
+	}
+	memset(&console->dirty[row], 1, (size_t)count);
+}
 
-	// Populate the font structure
-	font->magic[0] = header[0];
-	font->magic[1] = header[1];
-	font->mode = header[2];
-	font->char_height = header[3];
-	font->glyph_count = (font->mode & 0x01) ? 512 :
-						  256; // Determine glyph count
-	font->char_width = 8; // PSF1 glyphs are always 8 pixels wide
+static void i_fbgl_console_put(fbgl_console_t *console, int32_t col,
+			       int32_t row, uint32_t cp, uint32_t fg,
+			       uint32_t bg)
+{
+	const i_fbgl_console_cell_t cell = { cp, fg, bg };
+	i_fbgl_console_cell_t *dst =
+		&console->cells[(size_t)row * console->cols + col];
+	if (!i_fbgl_console_same(dst, &cell)) {
+		*dst = cell;
+		console->dirty[row] = 1;
+	}
+}
 
-	// Allocate memory for glyphs
-	size_t glyph_data_size = font->glyph_count * font->char_height;
-	font->glyphs = malloc(glyph_data_size);
-	if (!font->glyphs) {
-		perror("Failed to allocate memory for glyphs");
-		free(font);
-		fclose(file);
+fbgl_console_t *fbgl_console_create(fbgl_psf1_font_t const *font, int32_t x,
+				    int32_t y, int32_t cols, int32_t rows)
+{
+	if (!font) {
+		return NULL;
+	}
+	if (cols <= 0 || rows <= 0 ||
+	    cols > FBGL_CONSOLE_MAX_SIZE / font->char_width ||
+	    rows > FBGL_CONSOLE_MAX_SIZE / font->char_height) {
+		fprintf(stderr, "Invalid console size %dx%d\n", cols, rows);
 		return NULL;
 	}
 
-	// Read glyph data
-	if (fread(font->glyphs, 1, glyph_data_size, file) != glyph_data_size) {
-		perror("Failed to read glyph data");
-		free(font->glyphs);
-		free(font);
-		fclose(file);
+	fbgl_console_t *console = (fbgl_console_t *)calloc(1, sizeof(*console));
+	const size_t count = (size_t)cols * rows;
+	if (console) {
+		console->cells = (i_fbgl_console_cell_t *)malloc(
+			count * sizeof(*console->cells));
+		console->shown = (i_fbgl_console_cell_t *)malloc(
+			count * sizeof(*console->shown));
+		console->dirty = (uint8_t *)malloc((size_t)rows);
+	}
+	if (!console || !console->cells || !console->shown ||
+	    !console->dirty) {
+		perror("Failed to allocate console");
+		fbgl_console_destroy(console);
 		return NULL;
 	}
 
-	fclose(file);
-	return font;
+	console->font = font;
+	console->x = x;
+	console->y = y;
+	console->cols = cols;
+	console->rows = rows;
+	console->fg = 0xFFFFFF;
+	console->bg = 0x000000;
+	i_fbgl_console_blank(console, 0, rows);
+	fbgl_console_invalidate(console);
+	return console;
 }
 
-void fbgl_destroy_psf1_font(fbgl_psf1_font_t *font)
+void fbgl_console_destroy(fbgl_console_t *console)
 {
-	if (font) {
-		free(font->glyphs);
-		free(font);
+	if (!console) {
+		return;
 	}
+	free(console->cells);
+	free(console->shown);
+	free(console->dirty);
+	free(console);
 }
 
-void fbgl_render_psf1_text(fbgl_t *fb, fbgl_psf1_font_t *font, const char *text,
-			   int x, int y, uint32_t color)
+void fbgl_console_set_color(fbgl_console_t *console, uint32_t fg, uint32_t bg)
 {
-	if (!fb || !font || !text)
+	if (console) {
+		console->fg = fg;
+		console->bg = bg;
+	}
+}
+
+void fbgl_console_set_cursor(fbgl_console_t *console, int32_t col,
+			     int32_t row)
+{
+	if (console) {
+		console->cursor_col = col < 0 ? 0 : col;
+		console->cursor_row = row < 0 ? 0 : row;
+	}
+}
+
+void fbgl_console_set_cell(fbgl_console_t *console, int32_t col, int32_t row,
+			   uint32_t cp, uint32_t fg, uint32_t bg)
+{
+	if (console && col >= 0 && col < console->cols && row >= 0 &&
+	    row < console->rows) {
+		i_fbgl_console_put(console, col, row, cp, fg, bg);
+	}
+}
+
+void fbgl_console_write(fbgl_console_t *console, int32_t col, int32_t row,
+			const char *text)
+{
+	if (!console || !text || row < 0 || row >= console->rows) {
+		return;
+	}
+	const uint8_t *s = (const uint8_t *)text;
+	const uint8_t *end = s + strlen(text);
+	for (; s < end && col < console->cols; col++) {
+		const uint32_t cp = i_fbgl_utf8_next(&s, end);
+		if (col >= 0) {
+			i_fbgl_console_put(console, col, row, cp, console->fg,
+					   console->bg);
+		}
+	}
+}
+
+void fbgl_console_print(fbgl_console_t *console, const char *text)
+{
+	if (!console || !text) {
+		return;
+	}
+	const uint8_t *s = (const uint8_t *)text;
+	const uint8_t *end = s + strlen(text);
+	while (s < end) {
+		const uint32_t cp = i_fbgl_utf8_next(&s, end);
+		if (cp == '\n') {
+			console->cursor_col = 0;
+			console->cursor_row++;
+			continue;
+		}
+		if (cp == '\r') {
+			console->cursor_col = 0;
+			continue;
+		}
+		if (console->cursor_col >= console->cols) {
+			console->cursor_col = 0;
+			console->cursor_row++;
+		}
+		// Scroll only once something lands below the last row, so a
+		// final newline does not leave an empty row
+		if (console->cursor_row >= console->rows) {
+			fbgl_console_scroll(console, console->cursor_row -
+							     console->rows + 1);
+			console->cursor_row = console->rows - 1;
+		}
+		if (cp == '\t') {
+			const int32_t stop = (console->cursor_col | 7) + 1;
+			while (console->cursor_col < stop &&
+			       console->cursor_col < console->cols) {
+				fbgl_console_print(console, " ");
+			}
+			continue;
+		}
+		i_fbgl_console_put(console, console->cursor_col++,
+				   console->cursor_row, cp, console->fg,
+				   console->bg);
+	}
+}
+
+void fbgl_console_clear(fbgl_console_t *console)
+{
+	if (!console) {
+		return;
+	}
+	for (int32_t row = 0; row < console->rows; row++) {
+		for (int32_t col = 0; col < console->cols; col++) {
+			i_fbgl_console_put(console, col, row, ' ', console->fg,
+					   console->bg);
+		}
+	}
+	console->cursor_col = 0;
+	console->cursor_row = 0;
+}
+
+void fbgl_console_scroll(fbgl_console_t *console, int32_t lines)
+{
+	if (!console || lines == 0) {
+		return;
+	}
+	const int32_t rows = console->rows;
+	const size_t row_cells = (size_t)console->cols;
+	const int32_t n = lines < 0 ? -lines : lines;
+	if (n >= rows) {
+		i_fbgl_console_blank(console, 0, rows);
+		fbgl_console_invalidate(console);
 		return;
+	}
 
-	int cursor_x = x;
-	int cursor_y = y;
+	// Dirty flags travel with their rows, so a row that was drawn stays
+	// clean and is moved on screen rather than repainted
+	const size_t kept = (size_t)(rows - n);
+	if (lines > 0) {
+		memmove(console->cells, console->cells + n * row_cells,
+			kept * row_cells * sizeof(*console->cells));
+		memmove(console->dirty, console->dirty + n, kept);
+		i_fbgl_console_blank(console, rows - n, n);
+	} else {
+		memmove(console->cells + n * row_cells, console->cells,
+			kept * row_cells * sizeof(*console->cells));
+		memmove(console->dirty + n, console->dirty, kept);
+		i_fbgl_console_blank(console, 0, n);
+	}
 
-	for (const char *c = text; *c; c++) {
-		uint8_t glyph_index = (uint8_t)*c;
+	console->scroll += lines;
+	if (console->scroll <= -rows || console->scroll >= rows) {
+		fbgl_console_invalidate(console);
+	}
+}
 
-		// Ensure glyph index is within range
-		if (glyph_index >= font->glyph_count)
-			glyph_index = 0; // Default to space or undefined glyph
+void fbgl_console_invalidate(fbgl_console_t *console)
+{
+	if (!console) {
+		return;
+	}
+	const size_t count = (size_t)console->cols * console->rows;
+	for (size_t i = 0; i < count; i++) {
+		console->shown[i].cp = I_FBGL_CONSOLE_UNKNOWN;
+	}
+	memset(console->dirty, 1, (size_t)console->rows);
+	console->scroll = 0;
+}
 
-		// Locate the glyph in the glyph table
-		uint8_t *glyph = font->glyphs + glyph_index * font->char_height;
+// Columns from to to whose cells lie wholly between pixels x0 and x1,
+// which must not start left of the console
+static void i_fbgl_console_columns(fbgl_console_t const *console, int32_t x0,
+				   int32_t x1, int32_t *from, int32_t *to)
+{
+	const int32_t width = console->font->char_width;
+	*from = (x0 - console->x + width - 1) / width;
+	*to = (x1 - console->x) / width;
+	if (*to < *from) {
+		*to = *from;
+	}
+}
 
-		// Render the glyph
-		for (int row = 0; row < font->char_height; row++) {
-			for (int col = 0; col < font->char_width; col++) {
-				// Check if the bit is set in the glyph
-				if (glyph[row] & (0x80 >> col)) {
-					fbgl_put_pixel(cursor_x + col,
-						       cursor_y + row, color,
-						       fb);
-				}
+// Apply the pending scroll to the screen, moving the framebuffer rows that
+// stay visible and forgetting what was shown on the rest
+static void i_fbgl_console_move(fbgl_t *fb, fbgl_console_t *console)
+{
+	const int32_t n = console->scroll;
+	const int32_t rows = console->rows;
+	const int32_t height = console->font->char_height;
+	const size_t row_cells = (size_t)console->cols;
+	console->scroll = 0;
+
+	// Reading back device memory is slower than repainting, so rows are
+	// only moved in a back buffer or surface
+	int32_t x0 = console->x;
+	int32_t y0 = console->y;
+	int32_t x1 = x0 + console->cols * console->font->char_width;
+	int32_t y1 = y0 + rows * height;
+	const bool device = fb->mapping && !fb->back_buffer;
+	const bool move = !device && i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1);
+	if (move) {
+		const int32_t shift = n * height;
+		const size_t bytes =
+			(size_t)(x1 - x0) * fb->ops.bytes_per_pixel;
+		if (n > 0) {
+			for (int32_t y = y0; y + shift < y1; y++) {
+				memcpy(i_fbgl_pixel_addr(fb, x0, y),
+				       i_fbgl_pixel_addr(fb, x0, y + shift),
+				       bytes);
+			}
+		} else {
+			for (int32_t y = y1 - 1; y + shift >= y0; y--) {
+				memcpy(i_fbgl_pixel_addr(fb, x0, y),
+				       i_fbgl_pixel_addr(fb, x0, y + shift),
+				       bytes);
+			}
+		}
+		i_fbgl_damage(fb, x0, y0, x1, y1);
+	}
+
+	// A cell keeps what it showed only if it and the cell it came from
+	// are both wholly inside the clip rect; the rest is repainted
+	int32_t from = 0;
+	int32_t to = 0;
+	if (move) {
+		i_fbgl_console_columns(console, x0, x1, &from, &to);
+	}
+	const int32_t first = n > 0 ? 0 : rows - 1;
+	const int32_t step = n > 0 ? 1 : -1;
+	for (int32_t row = first; row >= 0 && row < rows; row += step) {
+		const int32_t source = row + n;
+		i_fbgl_console_cell_t *shown = &console->shown[row * row_cells];
+		const int32_t top = console->y + row * height;
+		const int32_t source_top = console->y + source * height;
+		const bool keep = move && source >= 0 && source < rows &&
+				  top >= y0 && top + height <= y1 &&
+				  source_top >= y0 &&
+				  source_top + height <= y1;
+		if (keep) {
+			memcpy(&shown[from],
+			       &console->shown[source * row_cells + from],
+			       (size_t)(to - from) * sizeof(*shown));
+		}
+		for (int32_t i = 0; i < console->cols; i++) {
+			if (!keep || i < from || i >= to) {
+				shown[i].cp = I_FBGL_CONSOLE_UNKNOWN;
 			}
 		}
+		if (!keep || to - from < console->cols) {
+			console->dirty[row] = 1;
+		}
+	}
+}
+
+// Paint columns col0 to col1 of a row, which share their colors. The
+// clip rect can cut them, so from and to are the cells painted whole.
+static void i_fbgl_console_paint(fbgl_t *fb, fbgl_console_t const *console,
+				 int32_t row, int32_t col0, int32_t col1,
+				 int32_t *from, int32_t *to)
+{
+	const fbgl_psf1_font_t *font = console->font;
+	const int32_t width = font->char_width;
+	const int32_t y = console->y + row * font->char_height;
+	const i_fbgl_console_cell_t *cells =
+		&console->cells[(size_t)row * console->cols];
+	int32_t x0 = console->x + col0 * width;
+	int32_t y0 = y;
+	int32_t x1 = console->x + col1 * width;
+	int32_t y1 = y + font->char_height;
+	*from = col0;
+	*to = col0;
+	if (!i_fbgl_clip_box(fb, &x0, &y0, &x1, &y1)) {
+		return;
+	}
+	if (y0 == y && y1 == y + font->char_height) {
+		i_fbgl_console_columns(console, x0, x1, from, to);
+	}
+
+	const uint32_t fg = fb->ops.map_color(cells[col0].fg);
+	const uint32_t bg = fb->ops.map_color(cells[col0].bg);
+	const size_t row_bytes = (size_t)(width + 7) / 8;
+	const uint8_t *glyphs[I_FBGL_TEXT_CHUNK];
+	uint8_t bits[I_FBGL_TEXT_CHUNK * 32 + 2];
+	for (int32_t col = col0; col < col1; col += I_FBGL_TEXT_CHUNK) {
+		const int32_t count = col1 - col < I_FBGL_TEXT_CHUNK ?
+					      col1 - col :
+					      I_FBGL_TEXT_CHUNK;
+		const int32_t left = console->x + col * width;
+		const int32_t right = left + count * width;
+		const int32_t c0 = x0 > left ? x0 - left : 0;
+		const int32_t c1 = (x1 < right ? x1 : right) - left;
+		if (c0 >= c1) {
+			continue;
+		}
+		for (int32_t i = 0; i < count; i++) {
+			glyphs[i] = i_fbgl_font_glyph(font, cells[col + i].cp);
+		}
+		uint8_t *dst = i_fbgl_pixel_addr(fb, left + c0, y0);
+		for (int32_t r = y0 - y; r < y1 - y; r++, dst += fb->pitch) {
+			fb->ops.fill(dst, bg, c1 - c0);
+			i_fbgl_glyph_gather(bits, glyphs, count,
+					    (size_t)r * row_bytes, width);
+			fb->ops.glyph(dst, bits, c0, c1, fg);
+		}
+	}
+	i_fbgl_damage(fb, x0, y0, x1, y1);
+}
+
+int32_t fbgl_console_draw(fbgl_t *fb, fbgl_console_t *console)
+{
+	if (!fb || !console) {
+		return 0;
+	}
+	// Cells are painted and moved in place, after what is queued
+	if (i_fbgl_deferring(fb)) {
+		i_fbgl_deferred_flush(fb);
+	}
+	if (console->scroll) {
+		i_fbgl_console_move(fb, console);
+	}
 
-		// Move to the next character position
-		cursor_x += font->char_width;
+	int32_t painted = 0;
+	const size_t row_cells = (size_t)console->cols;
+	for (int32_t row = 0; row < console->rows; row++) {
+		if (!console->dirty[row]) {
+			continue;
+		}
+		console->dirty[row] = 0;
+		const i_fbgl_console_cell_t *want =
+			&console->cells[row * row_cells];
+		i_fbgl_console_cell_t *have = &console->shown[row * row_cells];
+		int32_t col = 0;
+		while (col < console->cols) {
+			if (i_fbgl_console_same(&want[col], &have[col])) {
+				col++;
+				continue;
+			}
+			// Run of changed cells in the same colors
+			int32_t end = col + 1;
+			while (end < console->cols &&
+			       !i_fbgl_console_same(&want[end], &have[end]) &&
+			       want[end].fg == want[col].fg &&
+			       want[end].bg == want[col].bg) {
+				end++;
+			}
+			// Cells the clip rect cut may be partly painted, so
+			// they are forgotten and left for a later draw
+			int32_t from;
+			int32_t to;
+			i_fbgl_console_paint(fb, console, row, col, end, &from,
+					     &to);
+			for (int32_t i = col; i < end; i++) {
+				if (i < from || i >= to) {
+					have[i].cp = I_FBGL_CONSOLE_UNKNOWN;
+				}
+			}
+			memcpy(&have[from], &want[from],
+			       (size_t)(to - from) * sizeof(*have));
+			painted += to - from;
+			if (to - from < end - col) {
+				console->dirty[row] = 1;
+			}
+			col = end;
+		}
 	}
+	return painted;
 }
 
 int fbgl_keyboard_init(void)
@@ -0,0 +1,293 @@
+#define FBGL_IMPLEMENTATION
+#include "fbgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PACK_ATLAS_WIDTH 1024
+#define PACK_MAX_IMAGES 256
+
+typedef struct pack_item {
+	const char *name;
+	char *sources; // Owned copy of the part after '='
+	fbgl_pack_entry_t entry;
+	fbgl_tga_texture_t *texture;
+	fbgl_atlas_t *atlas;
+	fbgl_psf1_font_t *font;
+} pack_item_t;
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: fbgl_pack OUTPUT NAME=FILE...\n"
+		"  NAME=image.tga          texture (TGA, QOI or PNG)\n"
+		"  NAME=a.tga+b.png+...    atlas, images in the order given\n"
+		"  NAME=font.psf           PSF1 or PSF2 font\n");
+}
+
+static bool has_suffix(const char *s, const char *suffix)
+{
+	const size_t n = strlen(s);
+	const size_t m = strlen(suffix);
+	return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static int by_name(const void *a, const void *b)
+{
+	return strcmp(((const pack_item_t *)a)->name,
+		      ((const pack_item_t *)b)->name);
+}
+
+static int load_item(pack_item_t *item)
+{
+	fbgl_pack_entry_t *e = &item->entry;
+	strncpy(e->name, item->name, sizeof(e->name) - 1);
+
+	if (strchr(item->sources, '+')) {
+		fbgl_tga_texture_t *images[PACK_MAX_IMAGES];
+		int32_t count = 0;
+		int status = 0;
+		for (char *path = strtok(item->sources, "+"); path;
+		     path = strtok(NULL, "+")) {
+			if (count == PACK_MAX_IMAGES) {
+				fprintf(stderr, "%s: more than %d images\n",
+					item->name, PACK_MAX_IMAGES);
+				status = -1;
+				break;
+			}
+			images[count] = fbgl_load_texture(path);
+			if (!images[count]) {
+				fprintf(stderr, "%s: cannot load %s\n",
+					item->name, path);
+				status = -1;
+				break;
+			}
+			count++;
+		}
+		if (status == 0 && count == 0) {
+			fprintf(stderr, "%s: no images\n", item->name);
+			return -1;
+		}
+		if (status == 0) {
+			item->atlas = fbgl_atlas_create(
+				(fbgl_tga_texture_t const *const *)images,
+				count, PACK_ATLAS_WIDTH);
+			status = item->atlas ? 0 : -1;
+		}
+		for (int32_t i = 0; i < count; i++) {
+			fbgl_destroy_texture(images[i]);
+		}
+		if (status != 0) {
+			return -1;
+		}
+		e->kind = FBGL_PACK_ATLAS;
+		e->rect_count = (uint32_t)item->atlas->count;
+		item->texture = &item->atlas->texture;
+	} else if (has_suffix(item->sources, ".psf")) {
+		item->font = fbgl_load_psf_font(item->sources);
+		if (!item->font) {
+			return -1;
+		}
+		e->kind = FBGL_PACK_FONT;
+		e->width = item->font->char_width;
+		e->height = item->font->char_height;
+		e->count = item->font->glyph_count;
+		e->rect_count = item->font->unicode_size;
+		return 0;
+	} else {
+		item->texture = fbgl_load_texture(item->sources);
+		if (!item->texture) {
+			return -1;
+		}
+		e->kind = FBGL_PACK_TEXTURE;
+	}
+
+	e->width = item->texture->width;
+	e->height = item->texture->height;
+	e->flags = item->texture->flags;
+	e->count = item->texture->runs ?
+			   item->texture->row_runs[item->texture->height] :
+			   0;
+	return 0;
+}
+
+static uint64_t align_up(uint64_t offset)
+{
+	const uint64_t mask = FBGL_PACK_ALIGN - 1;
+	return (offset + mask) & ~mask;
+}
+
+static uint64_t glyph_bytes(const fbgl_pack_entry_t *e)
+{
+	return (uint64_t)(e->width + 7) / 8 * e->height;
+}
+
+// Append size bytes at offset, zero filling the gap before it
+static int put(FILE *out, uint64_t *pos, uint64_t offset, const void *data,
+	       size_t size)
+{
+	static const uint8_t zeros[FBGL_PACK_ALIGN];
+	while (*pos < offset) {
+		const size_t gap = offset - *pos < sizeof(zeros) ?
+					   (size_t)(offset - *pos) :
+					   sizeof(zeros);
+		if (fwrite(zeros, 1, gap, out) != gap) {
+			return -1;
+		}
+		*pos += gap;
+	}
+	if (size && fwrite(data, 1, size, out) != size) {
+		return -1;
+	}
+	*pos += size;
+	return 0;
+}
+
+static int write_pack(const char *path, pack_item_t *items, int count)
+{
+	// Lay out every blob first so the entry table can be written up front
+	fbgl_pack_header_t header;
+	memcpy(header.magic, FBGL_PACK_MAGIC, sizeof(header.magic));
+	header.version = FBGL_PACK_VERSION;
+	header.entry_count = (uint32_t)count;
+	header.entries = sizeof(header);
+
+	uint64_t end = align_up(sizeof(header) +
+				(uint64_t)count * sizeof(fbgl_pack_entry_t));
+	for (int i = 0; i < count; i++) {
+		fbgl_pack_entry_t *e = &items[i].entry;
+		e->data = end;
+		if (e->kind == FBGL_PACK_FONT) {
+			end = align_up(end + (uint64_t)e->count * glyph_bytes(e));
+			if (e->rect_count) {
+				e->runs = end;
+				end = align_up(end + (uint64_t)e->rect_count * 2);
+			}
+			continue;
+		}
+		end = align_up(end + (uint64_t)e->width * e->height * 4);
+		if (e->count) {
+			e->runs = end;
+			end = align_up(end + ((uint64_t)e->height + 1) * 4 +
+				       (uint64_t)e->count *
+					       sizeof(fbgl_texture_run_t));
+		}
+		if (e->kind == FBGL_PACK_ATLAS) {
+			e->rects = end;
+			end = align_up(end + (uint64_t)e->rect_count *
+						     sizeof(fbgl_rect_t));
+		}
+	}
+
+	FILE *out = fopen(path, "wb");
+	if (!out) {
+		perror(path);
+		return -1;
+	}
+	uint64_t pos = 0;
+	int status = put(out, &pos, 0, &header, sizeof(header));
+	for (int i = 0; i < count && status == 0; i++) {
+		status = put(out, &pos, pos, &items[i].entry,
+			     sizeof(items[i].entry));
+	}
+	for (int i = 0; i < count && status == 0; i++) {
+		const fbgl_pack_entry_t *e = &items[i].entry;
+		const fbgl_tga_texture_t *t = items[i].texture;
+		if (e->kind == FBGL_PACK_FONT) {
+			const fbgl_psf1_font_t *font = items[i].font;
+			status = put(out, &pos, e->data, font->glyphs,
+				     (size_t)e->count * glyph_bytes(e));
+			if (status == 0 && e->runs) {
+				status = put(out, &pos, e->runs, font->unicode,
+					     (size_t)e->rect_count * 2);
+			}
+			continue;
+		}
+		status = put(out, &pos, e->data, t->data,
+			     (size_t)e->width * e->height * 4);
+		if (status == 0 && e->runs) {
+			status = put(out, &pos, e->runs, t->row_runs,
+				     ((size_t)e->height + 1) * 4);
+		}
+		for (uint32_t r = 0; status == 0 && r < e->count; r++) {
+			// Field by field, so struct padding is written as zero
+			fbgl_texture_run_t run;
+			memset(&run, 0, sizeof(run));
+			run.start = t->runs[r].start;
+			run.end = t->runs[r].end;
+			run.kind = t->runs[r].kind;
+			status = put(out, &pos, pos, &run, sizeof(run));
+		}
+		if (status == 0 && e->rects) {
+			status = put(out, &pos, e->rects, items[i].atlas->rects,
+				     (size_t)e->rect_count *
+					     sizeof(fbgl_rect_t));
+		}
+	}
+	if (status == 0) {
+		status = put(out, &pos, end, NULL, 0);
+	}
+	if (fclose(out) != 0 || status != 0) {
+		perror(path);
+		remove(path);
+		return -1;
+	}
+	return 0;
+}
+
+// Build an asset pack for fbgl_pack_open() from images and PSF fonts
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	const int count = argc - 2;
+	pack_item_t *items = calloc(count, sizeof(*items));
+	if (!items) {
+		perror("Failed to allocate items");
+		return EXIT_FAILURE;
+	}
+
+	int status = EXIT_SUCCESS;
+	for (int i = 0; i < count; i++) {
+		char *arg = argv[i + 2];
+		char *eq = strchr(arg, '=');
+		if (!eq || eq == arg || !eq[1] ||
+		    (size_t)(eq - arg) >= FBGL_PACK_NAME_SIZE) {
+			fprintf(stderr, "bad entry '%s'\n", arg);
+			usage();
+			free(items);
+			return EXIT_FAILURE;
+		}
+		*eq = '\0';
+		items[i].name = arg;
+		items[i].sources = strdup(eq + 1);
+	}
+
+	qsort(items, count, sizeof(*items), by_name);
+	for (int i = 0; i < count && status == EXIT_SUCCESS; i++) {
+		if (i > 0 && strcmp(items[i - 1].name, items[i].name) == 0) {
+			fprintf(stderr, "duplicate name '%s'\n", items[i].name);
+			status = EXIT_FAILURE;
+		} else if (!items[i].sources || load_item(&items[i]) != 0) {
+			status = EXIT_FAILURE;
+		}
+	}
+	if (status == EXIT_SUCCESS && write_pack(argv[1], items, count) != 0) {
+		status = EXIT_FAILURE;
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (items[i].atlas) {
+			fbgl_atlas_destroy(items[i].atlas);
+		} else {
+			fbgl_destroy_texture(items[i].texture);
+		}
+		fbgl_destroy_psf1_font(items[i].font);
+		free(items[i].sources);
+	}
+	free(items);
+	return status;
+}